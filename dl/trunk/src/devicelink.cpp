@@ -1,16 +1,150 @@
 /*! \file devicelink.cpp
-	\brief The main source file for the devicelink functions. v2.1.4.1
+	\brief The main source file for the devicelink functions. v2.2.0
 	\author Mike Couvillion
 	\date 2004-2007 Copyright.
 */
 
 #include "devicelink.h"
+#include "devicelink_shm.h"
+#include "devicelink_seq.h"
+#include <float.h>
+#include <math.h>
+#ifndef _WIN32
+#include <sched.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+#endif
+
+/*! \brief Describes how each DLParam is queried from the game and validated before caching.
+*/
+struct DLParamDef
+{
+	const char* code; //!< the devicelink get code
+	bool is_int; //!< true when the game answers with an int rather than a float
+	bool engine; //!< true when the code takes an engine index
+	float min_val; //!< smallest value accepted into the cache
+	float max_val; //!< largest value accepted into the cache
+};
+
+/*!
+\note Indexed by DLParam so the order must match the enum in devicelink.h. The ranges
+are the same ones the individual Query_ and Set_ methods check.
+*/
+static const DLParamDef dl_params[DLP_COUNT] =
+{
+	{DL_GET_IAS, false, false, 0.00f, FLT_MAX},
+	{DL_GET_VARIO, false, false, -FLT_MAX, FLT_MAX},
+	{DL_GET_SLIP, false, false, -45.00f, 45.00f},
+	{DL_GET_TURN, false, false, -1.00f, 1.00f},
+	{DL_GET_ANG_SPD, false, false, -FLT_MAX, FLT_MAX},
+	{DL_GET_ALT, false, false, 0.00f, FLT_MAX},
+	{DL_GET_AZI, false, false, 0.00f, 359.99f},
+	{DL_GET_BEACON_AZI, false, false, 0.00f, 359.99f},
+	{DL_GET_ROLL, false, false, -180.00f, 180.00f},
+	{DL_GET_PITCH, false, false, -90.00f, 90.00f},
+	{DL_GET_FUEL, false, false, 0.00f, FLT_MAX},
+	{DL_GET_FLAPS_POS, false, false, -1.00f, 1.00f},
+	{DL_GET_AILERON, false, false, -1.00f, 1.00f},
+	{DL_GET_ELV, false, false, -1.00f, 1.00f},
+	{DL_GET_RUDDER, false, false, -1.00f, 1.00f},
+	{DL_GET_BRAKES, false, false, -1.00f, 1.00f},
+	{DL_GET_AIL_TRIM, false, false, -1.00f, 1.00f},
+	{DL_GET_ELV_TRIM, false, false, -1.00f, 1.00f},
+	{DL_GET_RUDDER_TRIM, false, false, -1.00f, 1.00f},
+	{DL_GET_LVL_STAB, true, false, 0.00f, 1.00f},
+	{DL_GET_AIRBRK, true, false, 0.00f, 1.00f},
+	{DL_GET_TAILWHEEL, true, false, 0.00f, 1.00f},
+	{DL_GET_WING_FOLD, true, false, 0.00f, 1.00f},
+	{DL_GET_CANOPY, true, false, 0.00f, 1.00f},
+	{DL_GET_HOOK, true, false, 0.00f, 1.00f},
+	{DL_GET_CHOCKS, true, false, 0.00f, 1.00f},
+	{DL_GET_GUNNER, true, false, 0.00f, 1.00f},
+	{DL_GET_GUNPOD, true, false, 0.00f, 1.00f},
+	{DL_GET_WEAP1, true, false, 0.00f, 1.00f},
+	{DL_GET_WEAP2, true, false, 0.00f, 1.00f},
+	{DL_GET_WEAP3, true, false, 0.00f, 1.00f},
+	{DL_GET_WEAP4, true, false, 0.00f, 1.00f},
+	{DL_GET_WEAP1_2, true, false, 0.00f, 1.00f},
+	{DL_GET_RPM, false, true, 0.00f, FLT_MAX},
+	{DL_GET_MANIFOLD, false, true, 0.00f, FLT_MAX},
+	{DL_GET_TEMP_OILIN, false, true, -273.00f, FLT_MAX},
+	{DL_GET_TEMP_OILOUT, false, true, -273.00f, FLT_MAX},
+	{DL_GET_TEMP_WATER, false, true, -273.00f, FLT_MAX},
+	{DL_GET_TEMP_CYL, false, true, -273.00f, FLT_MAX},
+	{DL_GET_POWER, false, true, -1.00f, 1.00f},
+	{DL_GET_PROP_PITCH, false, true, -1.00f, 1.00f},
+	{DL_GET_MAG, true, true, 0.00f, 3.00f},
+	{DL_GET_OVERLOAD, false, false, -FLT_MAX, FLT_MAX},
+	{DL_GET_SHAKE, false, false, 0.00f, 1.00f},
+	{DL_GET_WEP, true, false, 0.00f, 1.00f},
+	{DL_GET_FEATHER, true, false, 0.00f, 1.00f},
+	{DL_GET_GEAR_STATUS, false, false, 0.00f, 1.00f},
+	{DL_GET_LEFT_GEAR_POS, false, false, 0.00f, 1.00f},
+	{DL_GET_RIGHT_GEAR_POS, false, false, 0.00f, 1.00f},
+	{DL_GET_CENTER_GEAR_POS, false, false, 0.00f, 1.00f}
+};
+
+/*! \brief Describes how each DLControl is sent to the game.
+*/
+struct DLControlDef
+{
+	const char* code; //!< the devicelink set code
+	bool engine; //!< true when the code takes an engine index
+};
+
+/*!
+\note Indexed by DLControl so the order must match the enum in devicelink.h.
+*/
+static const DLControlDef dl_controls[DLC_COUNT] =
+{
+	{DL_SET_AILERON, false},
+	{DL_SET_ELV, false},
+	{DL_SET_RUDDER, false},
+	{DL_SET_BRAKES, false},
+	{DL_SET_AIL_TRIM, false},
+	{DL_SET_ELV_TRIM, false},
+	{DL_SET_RUDDER_TRIM, false},
+	{DL_SET_FLAPS_POS, false},
+	{DL_SET_POWER, true},
+	{DL_SET_PROP_PITCH, true}
+};
 
 /*!
-/note	This variable will be used for providing a thread locking mechanism and is
-used throughout the class, hence it being global to the class.
+\note Indexed by DLSwitch, so the order must match that enum and DL_ALL_SWITCHES.
+*/
+static const DLParam dl_switches[DLS_COUNT] =
+{
+	DLP_LVL_STAB, DLP_AIRBRAKES, DLP_TAILWHEEL, DLP_WING_FOLD, DLP_CANOPY, DLP_HOOK,
+	DLP_CHOCKS, DLP_GUNNER, DLP_GUNPOD, DLP_WEAP1, DLP_WEAP2, DLP_WEAP3, DLP_WEAP4, DLP_WEAP1_2,
+	DLP_WEP, DLP_FEATHER
+};
+
+/*! \brief Pairs a subsystem with the get code that reports it and the code that toggles it.
 */
-MC_CritSection my_critsec;
+struct DLToggleDef
+{
+	DLParam param; //!< cached value that confirms the state
+	const char* code; //!< toggle command
+};
+
+/*!
+\note Indexed by DLToggle, so the order must match that enum.
+*/
+static const DLToggleDef dl_toggles[DLT_COUNT] =
+{
+	{DLP_GEAR_STATUS, DL_SET_GEAR_STATUS},
+	{DLP_LVL_STAB, DL_TOGGLE_STAB},
+	{DLP_AIRBRAKES, DL_TOGGLE_AIRBRK},
+	{DLP_TAILWHEEL, DL_TOGGLE_TAILWHEEL},
+	{DLP_WING_FOLD, DL_TOGGLE_WING_FOLD},
+	{DLP_CANOPY, DL_TOGGLE_CANOPY},
+	{DLP_HOOK, DL_TOGGLE_HOOK},
+	{DLP_CHOCKS, DL_TOGGLE_CHOCKS},
+	{DLP_WEP, DL_TOGGLE_WEP},
+	{DLP_FEATHER, DL_TOGGLE_FEATHER}
+};
 
 /*! \brief Constructor. Mainly initializes the private member variables.
 
@@ -21,7 +155,6 @@ C_DeviceLink::C_DeviceLink(void)
 ,m_initialized(FALSE)
 ,m_readdata(FALSE)
 ,m_sock(0)
-,m_ret_cnt(1)
 ,dl_output(NULL)
 ,m_ias(0.00)
 ,m_vario(0.00)
@@ -42,33 +175,82 @@ C_DeviceLink::C_DeviceLink(void)
 ,m_tailhook(0)
 ,m_chocks(0)
 ,m_gunner(0)
+,m_overload(0.00)
+,m_shake(0.00)
+,m_wep(0)
+,m_feather(0)
+,m_gear_status(0.00)
+,m_gear_left(0.00)
+,m_gear_right(0.00)
+,m_gear_center(0.00)
+,m_switches(0)
+,m_switches_valid(0)
+,m_requests(NULL)
+,m_shm(NULL)
+,m_shm_handle(NULL)
+,m_shm_depth(0)
 {
 	memset(m_cmd, NULL, sizeof(m_cmd));
 	memset(m_buff, NULL, sizeof(m_buff));
 	dl_strncpy(m_game_ip,"0.0.0.0",sizeof(m_game_ip));
 	memset(m_dl_ver, NULL, sizeof(m_dl_ver));
-	for (int i = 0; i < 4; ++i)
-	{
-		m_engine[i].rpm = 0.00;
-		m_engine[i].manifold = 0.00;
-		m_engine[i].temp_oilin = 0.00;
-		m_engine[i].temp_oilout = 0.00;
-		m_engine[i].temp_water = 0.00;
-		m_engine[i].temp_cylinders = 0.00;
-		m_engine[i].power = 0.00;
-		m_engine[i].prop_pitch = 0.00;
-	}
+	memset(m_plane, 0, sizeof(m_plane));
+	m_num_cockpits = 0;
+	m_profile_stamp = 0.00;
+	m_profile_checked = 0.00;
+	m_profile_check = 1000.00;
+	memset(&m_engine, 0, sizeof(m_engine));
+	m_num_engines = 0;
 	for (int j = MG; j < MGCANNON; ++j)
 	{
 		m_weap[j] = 0;
 	}
+	memset(m_stamp, 0, sizeof(m_stamp));
+	memset(m_pending, 0, sizeof(m_pending));
+	memset(m_poll, 0, sizeof(m_poll));
+	memset(m_att, 0, sizeof(m_att));
+	m_att_enabled = FALSE;
+	m_att_max_extrap = 100.00;
+	memset(m_shm_name, 0, sizeof(m_shm_name));
+	memset(m_ctrl, 0, sizeof(m_ctrl));
+	memset(m_ctrl_policy, 0, sizeof(m_ctrl_policy));
+	m_ctrl_frame = FALSE;
+	m_piggy = FALSE;
+	m_piggy_budget = 20.00;
+	memset(m_toggle, 0, sizeof(m_toggle));
+	m_toggle_timeout = DL_TOGGLE_TIMEOUT;
+	m_toggle_tries = DL_TOGGLE_TRIES;
+	m_ctrl_queue_on = FALSE;
+	m_update_queue_on = FALSE;
+	m_updates_dropped = 0;
+	m_update_cb = NULL;
+	m_update_user = NULL;
+	m_exec = NULL;
+	m_exec_pending = FALSE;
+#ifdef _WIN32
+	m_pt_handle = NULL;
+#endif
+	m_pt_started = FALSE;
+	m_pt_run = FALSE;
+	m_pt_period = 0.00;
+	m_pt_priority = 0;
+	m_pt_cpu = -1;
+	memset(&m_pt_stats, 0, sizeof(m_pt_stats));
+	ResetPollThreadStats();
+	m_busy = FALSE;
+	m_busy_budget = 0.20;
+	m_busy_sock_us = 0;
+	ResetRttStats();
+	ResetControlStats();
 }
 
 /*! \brief Deconstructor
 */
 C_DeviceLink::~C_DeviceLink()
 {
-
+	StopPollThread();
+	SetExecutor(NULL);
+	CloseShm();
 }
 /**************************/
 /* Private Method Section */
@@ -92,12 +274,12 @@ bool C_DeviceLink::set_command_buff(const char * code)
 		errmsg("Invalid code passed to set_command_buff.\n");
 		return FALSE;
 	}
-	if (strlen(code) > sizeof(m_cmd))
+	if ((strlen(code) + 2) >= sizeof(m_cmd))
 	{
 		errmsg("temp buffer too large for m_cmd in set_command_buff.\n");
 		return FALSE;
 	}
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 #if _MSC_VER >= 1400
 	_snprintf_s(m_cmd,sizeof(m_cmd),_TRUNCATE,"%c%c%s",REQUEST,DELIM_1,code);
 #else
@@ -106,6 +288,48 @@ bool C_DeviceLink::set_command_buff(const char * code)
 	return TRUE;
 }
 
+/*! \brief Finds the first value of a code in the answer records returned by QueryRaw().
+\param reply : the answer records
+\param key : the get code to look for
+\param val : receives the value with any escapes removed
+\param size : size of val
+\return \b boolean : FALSE if the code isn't in the reply
+*/
+static bool find_answer(const char* reply, const char* key, char* val, unsigned int size)
+{
+	size_t klen = strlen(key);
+	const char* ptr = reply;
+	while ((ptr = strchr(ptr, DELIM_1)) != NULL)
+	{
+		++ptr;
+		if ((strncmp(ptr, key, klen) != 0) || (ptr[klen] != DELIM_2))
+		{
+			continue;
+		}
+		ptr += klen + 1;
+		unsigned int j = 0;
+		while ((ptr[0] != '\0') && (ptr[0] != DELIM_1))
+		{
+			if (ptr[0] == DELIM_2)
+			{
+				if ((ptr[1] != DELIM_1) && (ptr[1] != DELIM_2))
+				{
+					break;
+				}
+				++ptr;
+			}
+			if (j < (size - 1))
+			{
+				val[j++] = ptr[0];
+			}
+			++ptr;
+		}
+		val[j] = '\0';
+		return TRUE;
+	}
+	return FALSE;
+}
+
 /*! \brief This private routine does an actual query to the devicelink server for a float value.
 \param code : a const char defined devicelink code for the float value you will query for
 \return \b float
@@ -115,20 +339,14 @@ into a true float value.
 */
 float C_DeviceLink::queryfloat(const char *code)
 {
-	float fval = 0.00;
-	if (QueryMsg(code) == TRUE)
-	{
-		getval(code, &fval);
-	} else
+	char temp[64];
+	memset(temp, 0, sizeof(temp));
+	if (querystring(code, temp, sizeof(temp)) == FALSE)
 	{
-		errmsg("QueryMsg returned FALSE in queryfloat\n");
-		if (HasData() == FALSE)
-		{
-			errmsg("queryfloat: Query failed to read data from socket.\n");
-		}
-		fval = 0.00;
+		errmsg("querystring returned FALSE in queryfloat\n");
+		return 0.00;
 	}
-	return fval;
+	return static_cast<float>(atof(temp));
 }
 
 /*! \brief Gets a string representation of the return value from the queried code and places it in the passed qstr.
@@ -136,137 +354,56 @@ float C_DeviceLink::queryfloat(const char *code)
 \param qstr : the buffer you will store the server return value
 \param buff_size : the size of qstr you allocated
 \return \b boolean
-\sa QueryMsg()
-\sa getparamval()
+\sa QueryRaw()
+\sa find_answer()
 \sa HasData()
 \warning Calling function is responsible for allocating memory for qstr.
+\note The answer is read from this call's own reply buffer, so other threads querying at
+the same time can't overwrite it.
 
 */
 bool C_DeviceLink::querystring(const char* code, char* qstr, unsigned int buff_size)
 {
-	if (QueryMsg(code) == TRUE)
+	if ((code == NULL) || (qstr == NULL) || (buff_size == 0))
 	{
-		if (getparamval(code, qstr, buff_size) == TRUE)
-		{
-			return TRUE;
-		}
-	} else
+		errmsg("Invalid parameter passed to querystring.\n");
+		return FALSE;
+	}
+	char reply[DL_MAX_REPLY];
+	if (QueryRaw(code, 1, reply, sizeof(reply)) == 0)
 	{
-		errmsg("QueryMsg returned FALSE in querystring\n");
+		errmsg("QueryRaw returned no answer in querystring\n");
 		if (HasData() == FALSE)
 		{
 			errmsg("Query failed to read data from socket.\n");
 		}
 		return FALSE;
 	}
-	
-	return FALSE;
-}
-
-/*! \brief This private routine that returns the value of the paramter returned in an A coded response from the server.
-\param code : The devicelink code you will parse the command buffer for
-\param strval : The buffer you will store the resulting paramter value in
-\param buff_size : the size of the strval buffer
-\return : boolean
-\sa get-read_buff()
-\note The result is stored in the buffer pointed to by strval.
-\warning strval must be allocated by the calling function!
-*/
-bool C_DeviceLink::getparamval(const char *code, char* strval, unsigned int buff_size)
-{
-	char temp_buff[256];
-	memset(temp_buff, NULL, sizeof(temp_buff));
-	unsigned int tbuff_size = sizeof(temp_buff);
-	if (get_read_buff(temp_buff, tbuff_size) == FALSE)
-	{
-		errmsg("get_read_buff returned FALSE in getparamval.\n");
-		return FALSE;
-	}
-	tbuff_size = strlen(temp_buff); //get length of temp_buff to compare to strval size.
-	if (tbuff_size > buff_size)
-	{
-		errmsg("strval has not been allocated enought space in getparamval.\n");
-		return FALSE;
-	}
-	
-	//null out token and set pdest to point at the part of the temp_buff
-	//that contains the result from a query. i.e if code 80 was passed
-	//in we look for code 80 in "A/80\0.35" and then grab the 0.35 
-	char* token = NULL;
-	token = strstr(temp_buff, code);
-	if (token == NULL)
+	if ((find_answer(reply, code, qstr, buff_size) == FALSE) || (qstr[0] == '\0'))
 	{
-		errmsg("No matching response in buffer to query in getparamval.\n");
+		errmsg("No matching response in buffer to query in querystring.\n");
 		return FALSE;
 	}
-	//Parse to the number of m_ret_cnt delimiters for the code. We don't care about it.
-	//setting up a max amount to step through so we don't walk off the end of the buffer.
-	unsigned int sz = strlen(token); 
-	unsigned int cnt = 0;
-	unsigned int tokcnt = 0;
-	while ((token[0] != NULL) && (cnt <= sz) && (tokcnt < m_ret_cnt))
-	{
-		if (token[0] == DELIM_2)
-		{
-			++tokcnt;
-		}
-		++token;
-		++cnt;
-	}
-	//Now get the param value.
-	unsigned int j = 0;
-	sz = strlen(token);
-	char * ptr = NULL;
-	ptr = strval;
-	//copying the data to strval for conversion. Why didn't I use strcpy or some variant?
-	//well, because in 1C's infinite wisdom they chose to use / and \ as delimiters. Since
-	//some data can render an unescaped series of tokens with \0 that renders most of the
-	//string functions useless.
-	while ((token[0] != DELIM_2) & (token[0] != NULL) & (token[0] != DELIM_1) & (j <= sz))
-	{
-		*ptr = *token;
-		++ptr;
-		++token;
-		++j;
-	}
-	
-	if (strval != NULL)
-	{
-		if (strlen(strval) > 0)
-		{
-			return TRUE;
-		}
-	}
-
-	return FALSE;
+	return TRUE;
 }
 
 /*! \brief Executes a query expecting an int return.
 \param code : a const char defined devicelink code
-\return \b integer : The integer result associated with the code. -1 indicates failure.
-\sa QueryMsg()
-\sa getintval()
+\return \b integer : The integer result associated with the code. 0 indicates failure.
+\sa querystring()
 \sa HasData()
-\note Error conditions are reached when either getintval fails or the socket has no data in the buffer
-from the query.
 
 */
 int C_DeviceLink::queryint(const char *code)
 {
-	int ivar = 0;
-	if (QueryMsg(code) == TRUE)
-	{
-		getval(code, &ivar);
-	} else
+	char temp[64];
+	memset(temp, 0, sizeof(temp));
+	if (querystring(code, temp, sizeof(temp)) == FALSE)
 	{
-		errmsg("QueryMsg returned FALSE in queryint\n");
-		if (HasData() == FALSE)
-		{
-			errmsg("queryint: Query failed to read data from socket.\n");
-		}
-		ivar = 0;
+		errmsg("querystring returned FALSE in queryint\n");
+		return 0;
 	}
-	return ivar;
+	return atoi(temp);
 }
 
 /*! \brief This routine is used as a generic routine for flipping a toggle switch.
@@ -279,18 +416,12 @@ Set style commands that require no parameters like IncSightDist
 */
 bool C_DeviceLink::toggleswitch(const char* code)
 {
-	if (set_command_buff(code) == FALSE)
-	{
-		errmsg("set_command_buff returned FALSE in toggleswitch.\n");
-		return FALSE;
-	}
-	if (SendMsg()== TRUE)
-	{
-		return TRUE;
-	} else
+	if (send_packet(code) == FALSE)
 	{
+		errmsg("send_packet returned FALSE in toggleswitch.\n");
 		return FALSE;
 	}
+	return TRUE;
 }
 
 /*! \brief private function to set the passed in engine part to the queried float val
@@ -301,7 +432,7 @@ bool C_DeviceLink::toggleswitch(const char* code)
 */
 bool C_DeviceLink::setengfloats(const int eng_num, const char* code, float *engine_part)
 {
-	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_FOUR))
+	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_EIGHT))
 	{
 		errmsg("setengfloats called with invalid engine number.\n");
 		return FALSE;
@@ -313,16 +444,11 @@ bool C_DeviceLink::setengfloats(const int eng_num, const char* code, float *engi
 #else
 	_snprintf(temp_cmd,sizeof(temp_cmd),"%s%c%d",code,DELIM_2,eng_num);
 #endif
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_ret_cnt = 2; //set expected return value delimiter count to 2
-	}
 	float fval = 0.00;
 	fval = queryfloat(temp_cmd);
 	{
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	*engine_part = fval;
-	m_ret_cnt = 1; //set expected return value delimiter count to 2
 	}
 	return TRUE;
 }
@@ -348,59 +474,21 @@ void C_DeviceLink::dl_strncpy(char * dest_str, char * src_str, unsigned int dest
 *		- starteng(DL_SELECT_ENG_1,DL_TOGGLE_ENGINE1);\n
 *		.
 \return \b boolean
-\sa SendMsg()
+\note Runs as a C_DLSequence without waits, so the three steps go out in one packet.
+\sa C_DLSequence
 */
 bool C_DeviceLink::starteng(const char* seleng, const char* togeng)
 {
-	char temp_cmd[64];
-	memset(temp_cmd, NULL,sizeof(temp_cmd));
-#if _MSC_VER >= 1400
-	_snprintf_s(temp_cmd,sizeof(temp_cmd),_TRUNCATE,"%s/%s/%s",seleng,togeng,DL_SELECT_ENG_ALL);
-#else
-	_snprintf(temp_cmd,sizeof(temp_cmd),"%s/%s/%s",seleng,togeng,DL_SELECT_ENG_ALL);
-#endif
-	if (set_command_buff(temp_cmd) == FALSE)
-	{
-		errmsg("set_command_buff returned FALSE in starteng.\n");
-		return FALSE;
-	}
-	if (SendMsg() == TRUE)
-	{
-		return TRUE;
-	} else
-	{
-		return FALSE;
-	}
-}
-
-/*! \brief This will copy m_buff into the temp_buff to promote thread safety.
-\param temp_buff : storage for the private buffer m_buff to be copied to
-\param buff_size : size of temp_buff
-\return \b boolean
-\sa dl_strncpy
-\note tries to make sure the receiving buffer is large enough to receive the data
-*/
-
-bool C_DeviceLink::get_read_buff(char* temp_buff, unsigned int buff_size)
-{
-	if (temp_buff[0] != NULL)
-	{
-		errmsg("temp_buff not initialized to NULL in get_read_buff.\n");
-		return FALSE;
-	}
-	if(m_buff[0] != ANSWER)
-	{
-		errmsg("Not a valid response code in buffer!\n");
-		return FALSE;
-	}
-	if (buff_size < strlen(m_buff))
+	C_DLSequence seq;
+	seq.Add(seleng);
+	seq.Add(togeng);
+	seq.Add(DL_SELECT_ENG_ALL);
+	if (seq.IsValid() == FALSE)
 	{
-		errmsg("Insufficient temp buffer size in get_read_buff.\n");
+		errmsg("invalid engine codes in starteng.\n");
 		return FALSE;
 	}
-	MC_Lock m_Lock(&my_critsec);
-	dl_strncpy(temp_buff, m_buff,buff_size);	
-	return TRUE;
+	return seq.Start(this);
 }
 
 /*! \brief This copies the string temp_buff into m_buff.
@@ -413,7 +501,7 @@ bool C_DeviceLink::set_read_buff(const char* temp_buff, unsigned int buff_size)
 {
 	if (temp_buff == NULL)
 	{
-		MC_Lock m_Lock(&my_critsec);
+		DL_Lock m_Lock(&m_critsec);
 		memset(m_buff, NULL,sizeof(m_buff));
 		return TRUE;
 	}
@@ -422,7 +510,7 @@ bool C_DeviceLink::set_read_buff(const char* temp_buff, unsigned int buff_size)
 		errmsg("temp buffer size too large for m_buff in set_read_buff.\n");
 		return FALSE;
 	}
-	MC_Lock m_Lock(&my_critsec); 
+	DL_Lock m_Lock(&m_critsec); 
 	dl_strncpy(m_buff,const_cast<char *>(temp_buff), sizeof(m_buff));	
 	return TRUE;
 }
@@ -436,7 +524,7 @@ the game before trying to process it.
 */
 bool C_DeviceLink::set_has_read_data(bool flag)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_readdata = flag;
 	return TRUE;
 }
@@ -459,7 +547,7 @@ bool C_DeviceLink::get_cmd_buff(char* temp_buff, unsigned int buff_size)
 		errmsg("Insufficient temp buffer size in get_cmd_buff.\n");
 		return FALSE;
 	}
-	MC_Lock m_Lock(&my_critsec); 
+	DL_Lock m_Lock(&m_critsec); 
 	dl_strncpy(temp_buff, m_cmd, buff_size);
 	return TRUE;
 }
@@ -486,12 +574,12 @@ float C_DeviceLink::getengfloats(const int eng_num, float *engine_part)
 		init_err();
 		return -1.00;
 	}
-	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_FOUR))
+	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_EIGHT))
 	{
 		errmsg("getengfloats called with invalid engine number.\n");
 		return -1.00;
 	}
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return *engine_part;
 }
 
@@ -503,126 +591,1261 @@ void C_DeviceLink::init_err(void)
 		errmsg("DeviceLink object not Initialized.\nYou must call Init() first!");
 }
 
-/*! \brief private function for setting the various controls
-\param const char* code : the devicelink code for the control to be set
-\param float pos : the value you to set the control too
-
+/*! \brief Formats one control value as it appears in an R packet, i.e. "81\\0\\0.500000".
+\param ctrl : the control
+\param eng_num : engine index for power and prop pitch, 0 otherwise
+\param pos : the value
+\param item : receives the formatted code
+\param size : size of item
 */
-bool C_DeviceLink::setctrl(const char* code, float pos)
+static void format_ctrl(DLControl ctrl, const int eng_num, float pos, char* item, unsigned int size)
 {
-	char tmp_cmd[80];
-	memset(tmp_cmd,NULL,sizeof(tmp_cmd));
+	memset(item, 0, size);
+	if (dl_controls[ctrl].engine == true)
+	{
+#if _MSC_VER >= 1400
+		_snprintf_s(item,size,_TRUNCATE,"%s%c%d%c%f",dl_controls[ctrl].code,DELIM_2,eng_num,DELIM_2,pos);
+#else
+		_snprintf(item,size,"%s%c%d%c%f",dl_controls[ctrl].code,DELIM_2,eng_num,DELIM_2,pos);
+#endif
+	} else
+	{
 #if _MSC_VER >= 1400
-	_snprintf_s(tmp_cmd,sizeof(tmp_cmd),_TRUNCATE,"%s%c%f",code,DELIM_2,pos);
+		_snprintf_s(item,size,_TRUNCATE,"%s%c%f",dl_controls[ctrl].code,DELIM_2,pos);
 #else
-	_snprintf(tmp_cmd,sizeof(tmp_cmd),"%s%c%f",code,DELIM_2,pos);
+		_snprintf(item,size,"%s%c%f",dl_controls[ctrl].code,DELIM_2,pos);
 #endif
-	if (set_command_buff(tmp_cmd) == FALSE)
+	}
+}
+
+/*! \brief Says if a subsystem reading is one of its end states.
+\param val : the cached reading
+\return \b boolean : FALSE while it is between off and on, i.e. the gear status during travel
+*/
+static bool toggle_settled(float val)
+{
+	return ((val == 0.00f) || (val == 1.00f));
+}
+
+/*! \brief Says if the toggle layer needs a newer reading of a subsystem before it can decide.
+\param toggle : the subsystem
+\param now : MC_Timer::Now() of the tick
+\return \b boolean : TRUE if its get code should be queried. Call with m_critsec held.
+\note Before the first toggle any reading younger than DL_GEAR_MAX_AGE will do. After a toggle
+only a reading taken after it can confirm it, and only one taken a full timeout after it can
+show the toggle was lost. While the subsystem is moving it is read again every DL_GEAR_MAX_AGE
+until it settles.
+*/
+bool C_DeviceLink::toggle_read_due(DLToggle toggle, double now)
+{
+	const struct m_toggle_type* tog = &m_toggle[toggle];
+	DLParam param = dl_toggles[toggle].param;
+	double stamp = m_stamp[param][0];
+	if (tog->state != DLTS_PENDING)
 	{
-		errmsg("set_command_buff returned FALSE in setctrl.\n");
 		return FALSE;
 	}
-	if (SendMsg()== TRUE)
+	if ((tog->sent == 0.00) || ((stamp > tog->sent) && (toggle_settled(param_value(param, 0)) == FALSE)))
 	{
-		return TRUE;
-	} else
+		return ((stamp == 0.00) || ((now - stamp) > DL_GEAR_MAX_AGE));
+	}
+	if (stamp <= tog->sent)
 	{
-		return FALSE;
+		return TRUE;
 	}
+	return (((now - tog->sent) >= m_toggle_timeout) && (stamp < (tog->sent + m_toggle_timeout)));
 }
 
-/*!  \brief takes code and int and asignes a float value to the passed in param
-\param const char* code : devicelink code to convert
-\param \b float : val value to set on converted string from read buffer
-
+/*! \brief Applies the control's output policy to one slot. Call with m_critsec held.
+\param ctrl : the control
+\param slot : its slot
+\param now : MC_Timer::Now() of the flush
+\return \b boolean : TRUE if the slot's value should go in this flush
+\note A value inside the deadband is dropped. A value stopped by min_interval or max_rate stays
+pending for a later flush. Once refresh has run out the last value sent is sent again, so a
+refresh never carries a value the deadband dropped.
 */
-void C_DeviceLink::getval(const char* code, int *val)
+bool C_DeviceLink::ctrl_due(DLControl ctrl, struct m_ctrl_type* slot, double now)
 {
-	//null out temp and call getparamval
-	//to set temp equal to the string representation
-	//of returned val. We then convert it to a float
-	char temp[64];
-	memset(temp, NULL, sizeof(temp));
-	if (getparamval(code, temp, sizeof(temp)) == TRUE)
+	const DLControlPolicy* pol = &m_ctrl_policy[ctrl];
+	if (slot->pending == FALSE)
 	{
-		*val = atoi(temp);
-	} else
+		if ((pol->refresh > 0.00) && (slot->ever_sent == TRUE) && ((now - slot->sent_time) >= pol->refresh))
+		{
+			++m_ctrl_refreshed;
+			slot->written = now;
+			return TRUE;
+		}
+		return FALSE;
+	}
+	if (slot->ever_sent == TRUE)
+	{
+		float diff = slot->value - slot->sent_value;
+		if (diff < 0.00f)
+		{
+			diff = -diff;
+		}
+		bool endpoint = ((slot->value == -1.00f) || (slot->value == 0.00f) || (slot->value == 1.00f));
+		if ((diff < pol->deadband) && ((endpoint == FALSE) || (diff == 0.00f)))
+		{
+			++m_ctrl_filtered;
+			slot->pending = FALSE;
+			return FALSE;
+		}
+		if ((pol->min_interval > 0.00) && ((now - slot->sent_time) < pol->min_interval))
+		{
+			++m_ctrl_held;
+			return FALSE;
+		}
+	}
+	if (pol->max_rate > 0.00)
 	{
-		errmsg("getparamval returned FALSE in getval.\n");
-		*val = 0;
+		if ((now - slot->rate_start) >= 1000.00)
+		{
+			slot->rate_start = now;
+			slot->rate_cnt = 0;
+		}
+		if (static_cast<double>(slot->rate_cnt) >= pol->max_rate)
+		{
+			++m_ctrl_held;
+			return FALSE;
+		}
 	}
+	return TRUE;
 }
 
-/*!  \brief takes code and float and asignes a float value to the passed in param
-\param const char* code : devicelink code to convert
-\param \b float : val value to set on converted string from read buffer
+/*! \brief Appends every control that is due to a packet being built.
+\param keys : the packet, codes separated by DELIM_1 without the leading "R/"
+\param size : size of keys
+\param len : current length of keys. Updated as controls are added
+\param next : the control slot to start from. Left on the first slot that didn't fit, or DLC_COUNT * DL_MAX_ENGINES when done
+\param now : MC_Timer::Now() of the flush
+\return \b unsigned \b int : the number of controls added
+\note A slot only counts as sent once it is in keys, so the caller must send the packet.
+*/
+unsigned int C_DeviceLink::pack_controls(char* keys, unsigned int size, unsigned int* len, int* next, double now)
+{
+	char item[64];
+	unsigned int cnt = 0;
+	drain_controls();
+	DL_Lock m_Lock(&m_critsec);
+	for (; *next < (DLC_COUNT * DL_MAX_ENGINES); ++(*next))
+	{
+		DLControl c = static_cast<DLControl>(*next / DL_MAX_ENGINES);
+		int eng = *next % DL_MAX_ENGINES;
+		struct m_ctrl_type* slot = &m_ctrl[c][eng];
+		if ((slot->pending == FALSE) && ((m_ctrl_policy[c].refresh <= 0.00) || (slot->ever_sent == FALSE)))
+		{
+			continue;
+		}
+		//a refresh repeats what the game already has, not a value the deadband dropped
+		float val = (slot->pending == TRUE) ? slot->value : slot->sent_value;
+		format_ctrl(c, eng, val, item, sizeof(item));
+		if ((*len + strlen(item) + 1) >= size)
+		{
+			break;
+		}
+		if (ctrl_due(c, slot, now) == FALSE)
+		{
+			continue;
+		}
+		if (*len > 0)
+		{
+			keys[(*len)++] = DELIM_1;
+		}
+		dl_strncpy(keys + *len, item, size - *len);
+		*len += static_cast<unsigned int>(strlen(item));
+		double latency = now - slot->written;
+		m_ctrl_sum_latency += latency;
+		if (latency > m_ctrl_max_latency)
+		{
+			m_ctrl_max_latency = latency;
+		}
+		slot->pending = FALSE;
+		slot->ever_sent = TRUE;
+		slot->sent_value = val;
+		slot->sent_time = now;
+		++slot->rate_cnt;
+		++m_ctrl_sent;
+		++cnt;
+	}
+	return cnt;
+}
 
+/*! \brief private function for setting the various controls
+\param ctrl : the control to be set
+\param eng_num : engine index for power and prop pitch, 0 otherwise
+\param float pos : the value you to set the control too
+\param flush : FALSE to only fill the slot, for callers that write several controls and flush once
+\note Sends straight away unless EnableControlFrame() is on, in which case the value waits
+in its slot for FlushControls(). A later write to the same slot replaces it.
 */
-void C_DeviceLink::getval(const char* code, float *val)
+bool C_DeviceLink::setctrl(DLControl ctrl, const int eng_num, float pos, bool flush)
 {
-	//null out temp and call getparamval
-	//to set temp equal to the string representation
-	//of returned val. We then convert it to a float
-	char temp[256];
-	memset(temp, NULL, sizeof(temp));
-	if (getparamval(code, temp, sizeof(temp)) == TRUE)
+	if ((ctrl < 0) || (ctrl >= DLC_COUNT) || (eng_num < 0) || (eng_num >= DL_MAX_ENGINES)
+		|| ((dl_controls[ctrl].engine == false) && (eng_num != 0)))
 	{
-		*val = static_cast<float>(atof(temp));
-	} else
+		errmsg("setctrl called with an invalid control.\n");
+		return FALSE;
+	}
+	double now = MC_Timer::Now();
+	if ((m_ctrl_queue_on == TRUE) && (m_ctrl_frame == TRUE))
+	{
+		DLRecord rec;
+		rec.key = static_cast<unsigned short>(ctrl);
+		rec.eng = static_cast<unsigned char>(eng_num);
+		rec.flags = 0;
+		rec.value = pos;
+		rec.stamp = now;
+		if (m_ctrl_queue.Push(rec) == TRUE)
+		{
+			return TRUE;
+		}
+		drain_controls(); //full. empty it so this write can't overtake the queued ones
+	}
+	{
+	DL_Lock m_Lock(&m_critsec);
+	ctrl_write(ctrl, eng_num, pos, now);
+	if ((m_ctrl_frame == TRUE) || (flush == FALSE))
 	{
-		errmsg("getparamval returned FALSE in getval.\n");
-		*val = 0;
+		return TRUE;
+	}
 	}
+	return FlushControls();
 }
 
-/************************/
-/* Public Method Section */
-/************************/
-
-/*! \brief Overload for Init(FILE *output) with no file pointer passed in. Just calls Init with a NULL.
-
+/*! \brief Stores one control write in its slot for the next FlushControls(). Call with m_critsec held.
+\param ctrl : the control
+\param eng_num : engine index for power and prop pitch, 0 otherwise
+\param pos : the value
+\param when : MC_Timer::Now() of the write
 */
-bool C_DeviceLink::Init()
+void C_DeviceLink::ctrl_write(DLControl ctrl, const int eng_num, float pos, double when)
 {
-	return Init(NULL);
+	++m_ctrl_writes;
+	struct m_ctrl_type* slot = &m_ctrl[ctrl][eng_num];
+	slot->value = pos;
+	if (slot->pending == FALSE)
+	{
+		slot->pending = TRUE;
+		slot->written = when;
+	}
 }
 
-/*! \brief Initialize the DeviceLink object. 
-\param output : a file type parameter. If NULL then defaults to stdout
-\return \b boolean
-\note IP and port are read from a config.ini file incoming parameter is the 
-debug output file. defaults to stderr. DEBUG_OUTPUT must be defined for 
-messages to be written.  This is the first method to call when using this library.
-It abstracts out the network code for setting up a UDP client and only needs the
-config file with the IP address and port number of the server.
-\note If Init is called with a FILE parameter and DEBUG_OUTPUT has been defined then
-it will output the debug and error messages 
+/*! \brief Moves the control writes queued by other threads into their slots, oldest first.
+\note The session lock makes whichever thread drains the queue its only consumer.
+*/
+void C_DeviceLink::drain_controls(void)
+{
+	DLRecord recs[DL_QUEUE_BATCH];
+	DL_Lock m_Lock(&m_critsec);
+	unsigned int cnt = 0;
+	while ((cnt = m_ctrl_queue.PopBatch(recs, DL_QUEUE_BATCH)) > 0)
+	{
+		for (unsigned int i = 0; i < cnt; ++i)
+		{
+			ctrl_write(static_cast<DLControl>(recs[i].key), recs[i].eng, recs[i].value, recs[i].stamp);
+		}
+	}
+}
 
+/*! \brief Finds the DLParam whose get code matches the passed in code.
+\param code : a devicelink get code without any engine index, i.e. "64"
+\return \b DLParam : the matching parameter or DLP_COUNT if the code isn't cached
 */
-bool C_DeviceLink::Init(FILE *output)
+DLParam C_DeviceLink::find_param(const char* code)
 {
-	//if the calling program passed in file name then log
-	//to that file. Otherwise log to the console.
-	if (output == NULL)
+	if (code == NULL)
 	{
-		dl_output = stderr;
-	} else
+		return DLP_COUNT;
+	}
+	for (int i = 0; i < DLP_COUNT; ++i)
 	{
-		dl_output = output;
+		if (strcmp(dl_params[i].code, code) == 0)
+		{
+			return static_cast<DLParam>(i);
+		}
 	}
+	return DLP_COUNT;
+}
 
-	if (ReadConfig() == FALSE)
+/*! \brief Records the time a cached value was received from the game.
+\param param : the cached value that was just updated
+\param eng_num : engine index for engine values, 0 otherwise
+*/
+void C_DeviceLink::stamp_param(DLParam param, const int eng_num)
+{
+	if ((param < 0) || (param >= DLP_COUNT) || (eng_num < 0) || (eng_num >= DL_MAX_ENGINES))
 	{
-		errmsg("Failed to read config file\n");
-		m_initialized = FALSE;
-		return FALSE;
+		return;
 	}
-	
-	//setup the UDP client 
-	m_this_end.sin_port=htons(0);
-	m_this_end.sin_addr.s_addr=htons(INADDR_ANY);
-	m_this_end.sin_family=AF_INET;
-	memset(&m_this_end.sin_zero, 0, sizeof(m_this_end.sin_zero));
+	DL_Lock m_Lock(&m_critsec);
+	m_stamp[param][eng_num] = MC_Timer::Now();
+	if (m_att_enabled == TRUE)
+	{
+		push_attitude(param, m_stamp[param][eng_num]);
+	}
+	for (int i = 0; i < DLS_COUNT; ++i)
+	{
+		if (dl_switches[i] == param)
+		{
+			unsigned long bit = 1UL << i;
+			if (param_value(param, 0) != 0.00)
+			{
+				m_switches |= bit;
+			} else
+			{
+				m_switches &= ~bit;
+			}
+			m_switches_valid |= bit;
+			break;
+		}
+	}
+	if (m_shm != NULL)
+	{
+		shm_begin();
+		m_shm->value[param][eng_num] = param_value(param, eng_num);
+		m_shm->stamp[param][eng_num] = m_stamp[param][eng_num];
+		shm_end();
+	}
+}
+
+/*! \brief Converts the string value returned by the game and stores it in the matching private var.
+\param param : the cached value to update
+\param eng_num : engine index for engine values, 0 otherwise
+\param strval : the value as it appeared in the A packet
+\return \b boolean : FALSE if the value is out of the range in dl_params
+\note Also stamps the value so the max-age getters know how old it is.
+*/
+bool C_DeviceLink::store_param(DLParam param, const int eng_num, const char* strval)
+{
+	if ((param < 0) || (param >= DLP_COUNT) || (eng_num < 0) || (eng_num >= DL_MAX_ENGINES) || (strval == NULL))
+	{
+		errmsg("store_param called with an invalid parameter.\n");
+		return FALSE;
+	}
+	float fval = static_cast<float>(atof(strval));
+	if ((dl_params[param].min_val > fval) || (dl_params[param].max_val < fval))
+	{
+		errmsg("store_param received a value out of range.\n");
+		return FALSE;
+	}
+	int ival = atoi(strval);
+	DL_Lock m_Lock(&m_critsec);
+	switch (param)
+	{
+		case DLP_IAS: m_ias = fval; break;
+		case DLP_VARIO: m_vario = fval; break;
+		case DLP_SLIP: m_slip = fval; break;
+		case DLP_TURN: m_turn = fval; break;
+		case DLP_ANG_SPD: m_ang_spd = fval; break;
+		case DLP_ALT: m_alt = fval; break;
+		case DLP_AZI: m_azimuth = fval; break;
+		case DLP_BEACON_AZI: m_beacon_azimuth = fval; break;
+		case DLP_ROLL: m_roll = fval; break;
+		case DLP_PITCH: m_pitch = fval; break;
+		case DLP_FUEL: m_fuel = fval; break;
+		case DLP_FLAPS: m_flaps = fval; break;
+		case DLP_AILERON: m_aileron = fval; break;
+		case DLP_ELEVATOR: m_elevator = fval; break;
+		case DLP_RUDDER: m_rudder = fval; break;
+		case DLP_BRAKES: m_brakes = fval; break;
+		case DLP_AIL_TRIM: m_ail_trim = fval; break;
+		case DLP_ELV_TRIM: m_elv_trim = fval; break;
+		case DLP_RUDDER_TRIM: m_rudder_trim = fval; break;
+		case DLP_LVL_STAB: m_lvlstab = ival; break;
+		case DLP_AIRBRAKES: m_airbrakes = ival; break;
+		case DLP_TAILWHEEL: m_tailwheel = ival; break;
+		case DLP_WING_FOLD: m_wingfold = ival; break;
+		case DLP_CANOPY: m_canopy = ival; break;
+		case DLP_HOOK: m_tailhook = ival; break;
+		case DLP_CHOCKS: m_chocks = ival; break;
+		case DLP_GUNNER: m_gunner = ival; break;
+		case DLP_GUNPOD: m_gunpod = ival; break;
+		case DLP_WEAP1:
+		case DLP_WEAP2:
+		case DLP_WEAP3:
+		case DLP_WEAP4:
+		case DLP_WEAP1_2:
+			m_weap[param - DLP_WEAP1] = ival;
+			break;
+		case DLP_RPM: m_engine.rpm[eng_num] = fval; break;
+		case DLP_MANIFOLD: m_engine.manifold[eng_num] = fval; break;
+		case DLP_TEMP_OILIN: m_engine.temp_oilin[eng_num] = fval; break;
+		case DLP_TEMP_OILOUT: m_engine.temp_oilout[eng_num] = fval; break;
+		case DLP_TEMP_WATER: m_engine.temp_water[eng_num] = fval; break;
+		case DLP_TEMP_CYL: m_engine.temp_cylinders[eng_num] = fval; break;
+		case DLP_POWER: m_engine.power[eng_num] = fval; break;
+		case DLP_PROP_PITCH: m_engine.prop_pitch[eng_num] = fval; break;
+		case DLP_MAGNETO: m_engine.magneto[eng_num] = ival; break;
+		case DLP_OVERLOAD: m_overload = fval; break;
+		case DLP_SHAKE: m_shake = fval; break;
+		case DLP_WEP: m_wep = ival; break;
+		case DLP_FEATHER: m_feather = ival; break;
+		case DLP_GEAR_STATUS: m_gear_status = fval; break;
+		case DLP_GEAR_LEFT: m_gear_left = fval; break;
+		case DLP_GEAR_RIGHT: m_gear_right = fval; break;
+		case DLP_GEAR_CENTER: m_gear_center = fval; break;
+		default:
+			return FALSE;
+	}
+	stamp_param(param, eng_num);
+	if (m_update_queue_on == TRUE)
+	{
+		DLRecord rec;
+		rec.key = static_cast<unsigned short>(param);
+		rec.eng = static_cast<unsigned char>(eng_num);
+		rec.flags = 0;
+		rec.value = (dl_params[param].is_int == true) ? static_cast<float>(ival) : fval;
+		rec.stamp = m_stamp[param][eng_num];
+		if (m_updates.Push(rec) == FALSE)
+		{
+			++m_updates_dropped;
+		}
+	}
+	return TRUE;
+}
+
+/*! \brief Returns the cached value of a parameter as a float for the shared memory export.
+\param param : the cached value
+\param eng_num : engine index for engine values, 0 otherwise
+\return \b float : the cached value. Integer values are converted.
+*/
+float C_DeviceLink::param_value(DLParam param, const int eng_num)
+{
+	switch (param)
+	{
+		case DLP_IAS: return m_ias;
+		case DLP_VARIO: return m_vario;
+		case DLP_SLIP: return m_slip;
+		case DLP_TURN: return m_turn;
+		case DLP_ANG_SPD: return m_ang_spd;
+		case DLP_ALT: return m_alt;
+		case DLP_AZI: return m_azimuth;
+		case DLP_BEACON_AZI: return m_beacon_azimuth;
+		case DLP_ROLL: return m_roll;
+		case DLP_PITCH: return m_pitch;
+		case DLP_FUEL: return m_fuel;
+		case DLP_FLAPS: return m_flaps;
+		case DLP_AILERON: return m_aileron;
+		case DLP_ELEVATOR: return m_elevator;
+		case DLP_RUDDER: return m_rudder;
+		case DLP_BRAKES: return m_brakes;
+		case DLP_AIL_TRIM: return m_ail_trim;
+		case DLP_ELV_TRIM: return m_elv_trim;
+		case DLP_RUDDER_TRIM: return m_rudder_trim;
+		case DLP_LVL_STAB: return static_cast<float>(m_lvlstab);
+		case DLP_AIRBRAKES: return static_cast<float>(m_airbrakes);
+		case DLP_TAILWHEEL: return static_cast<float>(m_tailwheel);
+		case DLP_WING_FOLD: return static_cast<float>(m_wingfold);
+		case DLP_CANOPY: return static_cast<float>(m_canopy);
+		case DLP_HOOK: return static_cast<float>(m_tailhook);
+		case DLP_CHOCKS: return static_cast<float>(m_chocks);
+		case DLP_GUNNER: return static_cast<float>(m_gunner);
+		case DLP_GUNPOD: return static_cast<float>(m_gunpod);
+		case DLP_WEAP1:
+		case DLP_WEAP2:
+		case DLP_WEAP3:
+		case DLP_WEAP4:
+		case DLP_WEAP1_2:
+			return static_cast<float>(m_weap[param - DLP_WEAP1]);
+		case DLP_RPM: return m_engine.rpm[eng_num];
+		case DLP_MANIFOLD: return m_engine.manifold[eng_num];
+		case DLP_TEMP_OILIN: return m_engine.temp_oilin[eng_num];
+		case DLP_TEMP_OILOUT: return m_engine.temp_oilout[eng_num];
+		case DLP_TEMP_WATER: return m_engine.temp_water[eng_num];
+		case DLP_TEMP_CYL: return m_engine.temp_cylinders[eng_num];
+		case DLP_POWER: return m_engine.power[eng_num];
+		case DLP_PROP_PITCH: return m_engine.prop_pitch[eng_num];
+		case DLP_MAGNETO: return static_cast<float>(m_engine.magneto[eng_num]);
+		case DLP_OVERLOAD: return m_overload;
+		case DLP_SHAKE: return m_shake;
+		case DLP_WEP: return static_cast<float>(m_wep);
+		case DLP_FEATHER: return static_cast<float>(m_feather);
+		case DLP_GEAR_STATUS: return m_gear_status;
+		case DLP_GEAR_LEFT: return m_gear_left;
+		case DLP_GEAR_RIGHT: return m_gear_right;
+		case DLP_GEAR_CENTER: return m_gear_center;
+		default:
+			return 0.00;
+	}
+}
+
+/*! \brief Marks the start of an update to the shared memory segment.
+\note Nested calls only bump the sequence counter once, so parse_reply() can publish a
+whole A packet as one update while stamp_param() still works on its own.
+*/
+void C_DeviceLink::shm_begin(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	if (m_shm == NULL)
+	{
+		return;
+	}
+	if (m_shm_depth++ == 0)
+	{
+		DL_SHM_INC(&m_shm->seq);
+	}
+}
+
+/*! \brief Marks the end of an update started with shm_begin() and lets readers back in.
+*/
+void C_DeviceLink::shm_end(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	if ((m_shm == NULL) || (m_shm_depth <= 0))
+	{
+		return;
+	}
+	if (--m_shm_depth == 0)
+	{
+		m_shm->num_engines = m_num_engines;
+		m_shm->published = MC_Timer::Now();
+		DL_SHM_INC(&m_shm->seq);
+	}
+}
+
+/*! \brief Queues the value for refresh if it is stale and then flushes every pending refresh.
+\param param : the cached value the caller is about to read
+\param max_age : oldest acceptable value in milliseconds
+\param eng_num : engine index for engine values, 0 otherwise
+\sa Prefetch()
+\sa RefreshPending()
+*/
+void C_DeviceLink::refresh_if_stale(DLParam param, double max_age, const int eng_num)
+{
+	if (Prefetch(param, max_age, eng_num) == TRUE)
+	{
+		RefreshPending();
+	}
+}
+
+/*! \brief Copies the next record of a packet into rec.
+\param ptr : current position in the packet, i.e. a QueryRaw() reply or an R packet past the "R"
+\param rec : receives the record, i.e. "64\\0"
+\param size : size of rec
+\return \b const \b char* : position after the record or NULL when there are no more
+\note A '\\' followed by a delimiter is an escaped character and doesn't end the record.
+*/
+const char* C_DeviceLink::NextRecord(const char* ptr, char* rec, unsigned int size)
+{
+	while (ptr[0] == DELIM_1)
+	{
+		++ptr;
+	}
+	if (ptr[0] == '\0')
+	{
+		return NULL;
+	}
+	unsigned int j = 0;
+	while ((ptr[0] != '\0') && (ptr[0] != DELIM_1))
+	{
+		if ((ptr[0] == DELIM_2) && ((ptr[1] == DELIM_1) || (ptr[1] == DELIM_2)))
+		{
+			if (j < (size - 2))
+			{
+				rec[j++] = ptr[0];
+				rec[j++] = ptr[1];
+			}
+			ptr += 2;
+			continue;
+		}
+		if (j < (size - 1))
+		{
+			rec[j++] = ptr[0];
+		}
+		++ptr;
+	}
+	rec[j] = '\0';
+	return ptr;
+}
+
+/*! \brief Walks every key/value pair of an A packet and stores the ones the cache knows about.
+\param buff : the A packet as read from the socket
+\return \b unsigned \b int : the number of key/value pairs found, cached or not
+\note Engine codes answer with the engine index as the first value and the reading as
+the second, i.e. "A/64\\0\\2400.0". A '\\' followed by a delimiter is an escaped character
+inside a value, per the DeviceLink spec.
+*/
+unsigned int C_DeviceLink::parse_reply(const char* buff)
+{
+	if ((buff == NULL) || (buff[0] != ANSWER))
+	{
+		errmsg("Not a valid response code in parse_reply.\n");
+		return 0;
+	}
+	unsigned int cnt = 0;
+	const char* ptr = buff + 1;
+	char key[16];
+	char vals[2][64];
+	shm_begin();
+	while (ptr[0] != '\0')
+	{
+		if (ptr[0] != DELIM_1)
+		{
+			++ptr;
+			continue;
+		}
+		++ptr;
+		memset(key, 0, sizeof(key));
+		memset(vals, 0, sizeof(vals));
+		unsigned int j = 0;
+		while ((ptr[0] != '\0') && (ptr[0] != DELIM_1) && (ptr[0] != DELIM_2))
+		{
+			if (j < (sizeof(key) - 1))
+			{
+				key[j++] = ptr[0];
+			}
+			++ptr;
+		}
+		unsigned int nvals = 0;
+		while (ptr[0] == DELIM_2)
+		{
+			++ptr;
+			j = 0;
+			while ((ptr[0] != '\0') && (ptr[0] != DELIM_1))
+			{
+				if (ptr[0] == DELIM_2)
+				{
+					if ((ptr[1] != DELIM_1) && (ptr[1] != DELIM_2))
+					{
+						break; //start of the next value
+					}
+					++ptr; //escaped delimiter. keep the character that follows
+				}
+				if ((nvals < 2) && (j < (sizeof(vals[0]) - 1)))
+				{
+					vals[nvals][j++] = ptr[0];
+				}
+				++ptr;
+			}
+			++nvals;
+		}
+		++cnt;
+		DLParam param = find_param(key);
+		if (param == DLP_COUNT)
+		{
+			continue;
+		}
+		if (dl_params[param].engine == true)
+		{
+			if (nvals >= 2)
+			{
+				int eng = atoi(vals[0]);
+				DL_Lock m_Lock(&m_critsec);
+				if ((m_num_engines > 0) && (eng >= m_num_engines))
+				{
+					m_profile_checked = 0.00; //more engines than the profile says. recheck the plane
+				}
+				store_param(param, eng, vals[1]);
+			} else if (nvals == 1)
+			{
+				//answered without the engine index, as DeviceLink.txt documents 80 and 92.
+				//the game has one value for every engine then
+				int engines = 1;
+				{
+				DL_Lock m_Lock(&m_critsec);
+				engines = (m_num_engines > 0) ? m_num_engines : 1;
+				}
+				for (int eng = 0; eng < engines; ++eng)
+				{
+					store_param(param, eng, vals[0]);
+				}
+			}
+		} else if (nvals >= 1)
+		{
+			store_param(param, 0, vals[0]);
+		}
+	}
+	shm_end();
+	return cnt;
+}
+
+/*! \brief Sends a batch of get codes in one R packet and caches every answer.
+\param keys : the get codes separated by DELIM_1 without the leading "R/"
+\param expected : the number of key/value pairs the game should answer with
+\return \b unsigned \b int : the number of key/value pairs actually received
+\note The game may split a long answer over several packets, so this keeps reading
+until all expected pairs have arrived or DL_READ_TIMEOUT passes without any.
+*/
+unsigned int C_DeviceLink::querybatch(const char* keys, unsigned int expected)
+{
+	return QueryRaw(keys, expected, NULL, 0);
+}
+
+/*! \brief Returns the end of the answer record starting at rec, skipping escaped delimiters.
+\param rec : the first character after a record's DELIM_1
+\return \b const \b char* : the DELIM_1 of the next record or the terminator
+*/
+static const char* record_end(const char* rec)
+{
+	while ((rec[0] != '\0') && (rec[0] != DELIM_1))
+	{
+		if ((rec[0] == DELIM_2) && ((rec[1] == DELIM_1) || (rec[1] == DELIM_2)))
+		{
+			++rec;
+		}
+		++rec;
+	}
+	return rec;
+}
+
+/*! \brief Says if an answer record carries a single value, i.e. "80\\0.5" rather than "80\\1\\0.5".
+\param rec : the answer record without its leading DELIM_1
+\return \b boolean
+*/
+static bool single_value(const char* rec)
+{
+	const char* val = strchr(rec, DELIM_2);
+	const char* end = record_end(rec);
+	if ((val == NULL) || (val >= end))
+	{
+		return FALSE;
+	}
+	for (++val; val < end; ++val)
+	{
+		if ((val[0] == DELIM_2) && (val[1] != DELIM_1) && (val[1] != DELIM_2))
+		{
+			return FALSE;
+		}
+		if (val[0] == DELIM_2)
+		{
+			++val; //escaped delimiter
+		}
+	}
+	return TRUE;
+}
+
+/*! \brief Finds the code of a query that an answer record answers.
+\param keys : the codes of the query separated by DELIM_1, i.e. "30/64\\2"
+\param answered : nonzero for each code of keys that already has its answer
+\param rec : the answer record without its leading DELIM_1, i.e. "64\\2\\2400.0"
+\return \b integer : index of the first unanswered code, engine index included, that starts
+the record. -1 if none
+\note A code asked with an engine index also takes an answer without one, i.e. "80\\1" is
+answered by "80\\0.5", in case the game ignores the index. DeviceLink.txt documents 80 and 92
+without one.
+*/
+static int record_matches(const char* keys, const unsigned char* answered, const char* rec)
+{
+	const char* key = keys;
+	for (int idx = 0; (key[0] != '\0') && (idx < (DL_MAX_QUERY / 2)); ++idx)
+	{
+		const char* end = strchr(key, DELIM_1);
+		size_t klen = (end != NULL) ? static_cast<size_t>(end - key) : strlen(key);
+		if ((answered[idx] == 0) && (klen > 0) && (strncmp(rec, key, klen) == 0) && (rec[klen] == DELIM_2))
+		{
+			return idx;
+		}
+		const char* sep = static_cast<const char*>(memchr(key, DELIM_2, klen));
+		size_t clen = (sep != NULL) ? static_cast<size_t>(sep - key) : 0;
+		if ((answered[idx] == 0) && (clen > 0) && (strncmp(rec, key, clen) == 0) && (rec[clen] == DELIM_2)
+			&& (single_value(rec) == TRUE))
+		{
+			return idx; //the game ignored the engine index
+		}
+		if (end == NULL)
+		{
+			break;
+		}
+		key = end + 1;
+	}
+	return -1;
+}
+
+/*! \brief Sends "R/" and the passed codes to the game.
+\param code : one or more codes separated by DELIM_1, without the leading "R/"
+\return \b boolean
+\note Builds the packet on the stack so concurrent callers never share a command buffer.
+*/
+bool C_DeviceLink::send_packet(const char* code)
+{
+	if (IsInitialized() == FALSE)
+	{
+		init_err();
+		return FALSE;
+	}
+	if (code == NULL)
+	{
+		errmsg("Invalid code passed to send_packet.\n");
+		return FALSE;
+	}
+	char temp_cmd[DL_MAX_QUERY];
+	if ((strlen(code) + 2) >= sizeof(temp_cmd))
+	{
+		errmsg("code too large for a packet in send_packet.\n");
+		return FALSE;
+	}
+	memset(temp_cmd, 0, sizeof(temp_cmd));
+#if _MSC_VER >= 1400
+	_snprintf_s(temp_cmd,sizeof(temp_cmd),_TRUNCATE,"%c%c%s",REQUEST,DELIM_1,code);
+#else
+	_snprintf(temp_cmd,sizeof(temp_cmd),"%c%c%s",REQUEST,DELIM_1,code);
+#endif
+	int len = static_cast<int>(strlen(temp_cmd));
+	if (send(m_sock, temp_cmd, len, 0) == SOCKET_ERROR)
+	{
+#ifdef DEBUG_OUTPUT
+		fprintf(dl_output, "error in send_packet. Error %d\n",WSAGetLastError());
+#endif
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*! \brief Hands each record of an A packet to the oldest query in flight that asked for it.
+\param buff : the A packet as read from the socket
+\note Records nobody asked for, i.e. late answers to a query that already timed out, are
+only cached by parse_reply().
+*/
+void C_DeviceLink::route_reply(const char* buff)
+{
+	if ((buff == NULL) || (buff[0] != ANSWER))
+	{
+		return;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	if (m_requests == NULL)
+	{
+		return;
+	}
+	const char* rec = strchr(buff, DELIM_1);
+	while (rec != NULL)
+	{
+		const char* end = record_end(rec + 1);
+		struct m_request_type* req = m_requests;
+		int idx = -1;
+		while (req != NULL)
+		{
+			if ((req->got < req->expected) && ((idx = record_matches(req->keys, req->answered, rec + 1)) >= 0))
+			{
+				break;
+			}
+			req = req->next;
+		}
+		if (req != NULL)
+		{
+			req->answered[idx] = 1;
+			++req->got;
+			if (req->reply != NULL)
+			{
+				unsigned int add = static_cast<unsigned int>(end - rec);
+				if ((req->len + add) < req->size)
+				{
+					memcpy(req->reply + req->len, rec, add);
+					req->len += add;
+					req->reply[req->len] = '\0';
+				} else
+				{
+					errmsg("reply buffer too small in route_reply.\n");
+				}
+			}
+		}
+		rec = (end[0] == DELIM_1) ? end : NULL;
+	}
+}
+
+/*! \brief Waits for one packet from the game, routes it to the queries in flight and caches it.
+\param wait_ms : longest time to wait in milliseconds
+\return \b integer : 1 if a packet was read, 0 if nothing arrived or another thread read it first,
+-1 on a socket error
+\note Any waiting thread may read the socket. The socket is non-blocking, so when several
+threads wake for the same packet the ones that lose the race just return 0. With
+EnableBusyPoll() on it first spins on recv() for up to the spin budget and only then sleeps
+in select() for what is left of wait_ms.
+*/
+int C_DeviceLink::recv_route(double wait_ms)
+{
+	if (wait_ms < 0.00)
+	{
+		wait_ms = 0.00;
+	}
+	bool busy = FALSE;
+	double budget = 0.00;
+	{
+	DL_Lock m_Lock(&m_critsec);
+	busy = m_busy;
+	budget = m_busy_budget;
+	}
+	if (busy == TRUE)
+	{
+		double start = MC_Timer::Now();
+		double stop = start + ((budget < wait_ms) ? budget : wait_ms);
+		double now = start;
+		int chk = 0;
+		do
+		{
+			chk = read_route();
+			now = MC_Timer::Now();
+		} while ((chk == 0) && (now < stop));
+		{
+		DL_Lock m_Lock(&m_critsec);
+		m_rtt.spin_time += now - start;
+		if (chk > 0)
+		{
+			++m_rtt.spin_hits;
+		} else if (chk == 0)
+		{
+			++m_rtt.spin_misses;
+		}
+		}
+		if (chk != 0)
+		{
+			return chk;
+		}
+		wait_ms -= now - start;
+		if (wait_ms <= 0.00)
+		{
+			return 0;
+		}
+	}
+	fd_set read_fds;
+	FD_ZERO(&read_fds);
+#pragma warning( disable : 4127) //supressing compiler warning about this macro. Not my macro so can't fix it.
+	FD_SET(m_sock, &read_fds);
+	struct timeval tv;
+	tv.tv_sec = static_cast<long>(wait_ms / 1000.00);
+	tv.tv_usec = static_cast<long>((wait_ms - (tv.tv_sec * 1000.00)) * 1000.00);
+	int chk = select(static_cast<int>(m_sock) + 1, &read_fds, NULL, NULL, &tv); //first arg is ignored by Winsock
+	if (chk <= 0)
+	{
+		return (chk < 0) ? -1 : 0;
+	}
+	return read_route();
+}
+
+/*! \brief Reads one packet if one is waiting, routes it to the queries in flight and caches it.
+\return \b integer : 1 if a packet was read, 0 if none was waiting, -1 on a socket error
+\note Never blocks; the socket is non-blocking.
+*/
+int C_DeviceLink::read_route(void)
+{
+	char temp_buff[DL_MAX_REPLY];
+	int len = static_cast<int>(recv(m_sock, temp_buff, sizeof(temp_buff) - 1, 0));
+	if (len == SOCKET_ERROR)
+	{
+		if (WSAGetLastError() == WSAEWOULDBLOCK)
+		{
+			return 0;
+		}
+#ifdef DEBUG_OUTPUT
+		fprintf(dl_output,"Client: Error receiving from socket: Error %d\n",WSAGetLastError());
+#endif
+		return -1;
+	}
+	temp_buff[len] = '\0';
+	if (temp_buff[0] == '\0')
+	{
+		return 0;
+	}
+	set_read_buff(temp_buff, static_cast<unsigned int>(strlen(temp_buff)));
+	set_has_read_data(TRUE);
+	route_reply(temp_buff);
+	parse_reply(temp_buff);
+	exec_kick();
+	return 1;
+}
+
+/*! \brief Sends one query and waits until all of its answer has been routed to it.
+\param req : the query. keys, reply, size and expected must be filled in
+\return \b unsigned \b int : the number of key/value pairs routed to the query
+\note The query is linked into m_requests while it waits, so packets read by any thread
+reach it. While it is the only query in flight it waits in one select(). With company it
+waits DL_ROUTE_SLICE at a time, because another thread may route its answer while it sleeps.
+Every packet that adds to the answer restarts the DL_READ_TIMEOUT.
+*/
+unsigned int C_DeviceLink::request(struct m_request_type* req)
+{
+	req->len = 0;
+	req->got = 0;
+	req->next = NULL;
+	memset(req->answered, 0, sizeof(req->answered));
+	{
+	DL_Lock m_Lock(&m_critsec);
+	struct m_request_type** tail = &m_requests;
+	while (*tail != NULL)
+	{
+		tail = &(*tail)->next;
+	}
+	*tail = req;
+	}
+	double start = MC_Timer::Now();
+	bool sent = send_packet(req->keys);
+	double deadline = start + DL_READ_TIMEOUT;
+	unsigned int seen = 0;
+	while (sent == TRUE)
+	{
+		unsigned int got = 0;
+		bool alone = FALSE;
+		{
+		DL_Lock m_Lock(&m_critsec);
+		got = req->got;
+		alone = ((m_requests == req) && (req->next == NULL));
+		}
+		double now = MC_Timer::Now();
+		if (got >= req->expected)
+		{
+			rtt_record(now - start);
+			break;
+		}
+		if (got > seen)
+		{
+			seen = got;
+			deadline = now + DL_READ_TIMEOUT;
+		}
+		double left = deadline - now;
+		if (left <= 0.00)
+		{
+			errmsg("Read timed out. Server may not be up\n");
+			set_has_read_data(FALSE);
+			rtt_record(-1.00);
+			break;
+		}
+		if ((alone == FALSE) && (left > DL_ROUTE_SLICE))
+		{
+			left = DL_ROUTE_SLICE;
+		}
+		if (recv_route(left) < 0)
+		{
+			set_has_read_data(FALSE);
+			break;
+		}
+	}
+	DL_Lock m_Lock(&m_critsec);
+	struct m_request_type** link = &m_requests;
+	while ((*link != NULL) && (*link != req))
+	{
+		link = &(*link)->next;
+	}
+	if (*link != NULL)
+	{
+		*link = req->next;
+	}
+	return req->got;
+}
+
+/*! \brief Makes sure the cached aircraft profile is loaded and still belongs to the current plane.
+\return \b boolean : FALSE if the profile had to be reloaded and that failed
+\note Costs nothing between checks. When a check is due only DL_GET_PLANE is queried, and
+the whole profile is reloaded only if the answer changed.
+*/
+bool C_DeviceLink::check_profile(void)
+{
+	double now = MC_Timer::Now();
+	{
+	DL_Lock m_Lock(&m_critsec);
+	if (m_profile_stamp == 0.00)
+	{
+		now = 0.00; //never loaded or invalidated
+	} else if ((m_profile_checked != 0.00) && ((m_profile_check <= 0.00) || ((now - m_profile_checked) < m_profile_check)))
+	{
+		return TRUE;
+	}
+	}
+	if (now != 0.00)
+	{
+		char reply[256];
+		char plane[64];
+		memset(plane, 0, sizeof(plane));
+		if ((QueryRaw(DL_GET_PLANE, 1, reply, sizeof(reply)) == 1) && (find_answer(reply, DL_GET_PLANE, plane, sizeof(plane)) == TRUE))
+		{
+			DL_Lock m_Lock(&m_critsec);
+			if (strcmp(plane, m_plane) == 0)
+			{
+				m_profile_checked = now;
+				return TRUE;
+			}
+		}
+	}
+	return RefreshProfile();
+}
+
+/*! \brief Wraps an angle difference into the -180 to +180 range.
+\param diff : difference between two angles in degrees
+\return \b float : the shortest way round
+*/
+static float wrap_angle_diff(float diff)
+{
+	while (diff > 180.00f)
+	{
+		diff -= 360.00f;
+	}
+	while (diff <= -180.00f)
+	{
+		diff += 360.00f;
+	}
+	return diff;
+}
+
+/*! \brief Adds the current pitch, roll or azimuth to the attitude history.
+\param param : DLP_PITCH, DLP_ROLL or DLP_AZI. Anything else is ignored
+\param stamp : the receive time of the value
+\note Called with m_critsec held from stamp_param().
+*/
+void C_DeviceLink::push_attitude(DLParam param, double stamp)
+{
+	int chan = 0;
+	float val = 0.00;
+	switch (param)
+	{
+		case DLP_PITCH: chan = 0; val = m_pitch; break;
+		case DLP_ROLL: chan = 1; val = m_roll; break;
+		case DLP_AZI: chan = 2; val = m_azimuth; break;
+		default:
+			return;
+	}
+	m_att_type* att = &m_att[chan];
+	att->t[att->head] = stamp;
+	att->val[att->head] = val;
+	att->head = (att->head + 1) % DL_ATT_HISTORY;
+	if (att->count < DL_ATT_HISTORY)
+	{
+		++att->count;
+	}
+}
+
+/*! \brief Interpolates or extrapolates one attitude angle to time t.
+\param chan : 0 pitch, 1 roll, 2 azimuth
+\param t : MC_Timer::Now() style time to estimate the angle for
+\param rate_hint : a measured rate in deg/s to use instead of the sample difference
+\param use_hint : TRUE if rate_hint is valid
+\return \b float : the estimated angle, wrapped or clamped to the range of the channel
+\note Between samples the angle is interpolated. Past the newest sample it is
+extrapolated from the rate of the last two samples for at most m_att_max_extrap ms and then
+held, which bounds the error to rate * m_att_max_extrap. A new sample replaces the
+extrapolation outright so the estimate snaps back to the game's value.
+Called with m_critsec held.
+*/
+float C_DeviceLink::estimate_angle(int chan, double t, float rate_hint, bool use_hint)
+{
+	const m_att_type* att = &m_att[chan];
+	unsigned int newest = (att->head + DL_ATT_HISTORY - 1) % DL_ATT_HISTORY;
+	float est = att->val[newest];
+	if (t >= att->t[newest])
+	{
+		unsigned int prev = (newest + DL_ATT_HISTORY - 1) % DL_ATT_HISTORY;
+		float rate = 0.00; //degrees per ms
+		if (use_hint == TRUE)
+		{
+			rate = rate_hint / 1000.00f;
+		} else if ((att->count >= 2) && (att->t[newest] > att->t[prev]))
+		{
+			float diff = att->val[newest] - att->val[prev];
+			if (chan != 0)
+			{
+				diff = wrap_angle_diff(diff);
+			}
+			rate = diff / static_cast<float>(att->t[newest] - att->t[prev]);
+		}
+		double dt = t - att->t[newest];
+		if (dt > m_att_max_extrap)
+		{
+			dt = m_att_max_extrap;
+		}
+		est += rate * static_cast<float>(dt);
+	} else
+	{
+		//walk back to the pair of samples either side of t
+		unsigned int newer = newest;
+		unsigned int i = 1;
+		for (; i < att->count; ++i)
+		{
+			unsigned int older = (newer + DL_ATT_HISTORY - 1) % DL_ATT_HISTORY;
+			if (att->t[older] <= t)
+			{
+				float diff = att->val[newer] - att->val[older];
+				if (chan != 0)
+				{
+					diff = wrap_angle_diff(diff);
+				}
+				double span = att->t[newer] - att->t[older];
+				float frac = (span > 0.00) ? static_cast<float>((t - att->t[older]) / span) : 1.00f;
+				est = att->val[older] + (diff * frac);
+				break;
+			}
+			newer = older;
+		}
+		if (i >= att->count)
+		{
+			est = att->val[newer]; //older than the history. oldest is the best we have
+		}
+	}
+	switch (chan)
+	{
+		case 0:
+			if (est > 90.00f)
+			{
+				est = 90.00f;
+			} else if (est < -90.00f)
+			{
+				est = -90.00f;
+			}
+			break;
+		case 1:
+			est = wrap_angle_diff(est);
+			break;
+		default:
+			while (est >= 360.00f)
+			{
+				est -= 360.00f;
+			}
+			while (est < 0.00f)
+			{
+				est += 360.00f;
+			}
+			break;
+	}
+	return est;
+}
+
+/************************/
+/* Public Method Section */
+/************************/
+
+/*! \brief Overload for Init(FILE *output) with no file pointer passed in. Just calls Init with a NULL.
+
+*/
+bool C_DeviceLink::Init()
+{
+	return Init(NULL);
+}
+
+/*! \brief Initialize the DeviceLink object. 
+\param output : a file type parameter. If NULL then defaults to stdout
+\return \b boolean
+\note IP and port are read from a config.ini file incoming parameter is the 
+debug output file. defaults to stderr. DEBUG_OUTPUT must be defined for 
+messages to be written.  This is the first method to call when using this library.
+It abstracts out the network code for setting up a UDP client and only needs the
+config file with the IP address and port number of the server.
+\note If Init is called with a FILE parameter and DEBUG_OUTPUT has been defined then
+it will output the debug and error messages 
+
+*/
+bool C_DeviceLink::Init(FILE *output)
+{
+	//if the calling program passed in file name then log
+	//to that file. Otherwise log to the console.
+	if (output == NULL)
+	{
+		dl_output = stderr;
+	} else
+	{
+		dl_output = output;
+	}
+
+	if (ReadConfig() == FALSE)
+	{
+		errmsg("Failed to read config file\n");
+		m_initialized = FALSE;
+		return FALSE;
+	}
+	
+	//setup the UDP client 
+	m_this_end.sin_port=htons(0);
+	m_this_end.sin_addr.s_addr=htons(INADDR_ANY);
+	m_this_end.sin_family=AF_INET;
+	memset(&m_this_end.sin_zero, 0, sizeof(m_this_end.sin_zero));
 	m_other_end.sin_port = htons(m_port);
 	m_other_end.sin_addr.s_addr = inet_addr(m_game_ip);
 	m_other_end.sin_family = AF_INET;
@@ -635,454 +1858,2127 @@ bool C_DeviceLink::Init(FILE *output)
 	int retval = 0;
 	retval = WSAStartup(0x202,&wsaData);
 
-	if (retval != 0) 
+	if (retval != 0) 
+	{
+#ifdef DEBUG_OUTPUT
+		fprintf(output,"WSAStartup failed with error %d\n",retval);
+#endif
+        WSACleanup();
+        return FALSE;
+    }
+
+	//create the UDP socket.
+	m_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (m_sock == INVALID_SOCKET)
+	{
+#ifdef DEBUG_OUTPUT
+		fprintf(dl_output,"Error in socket call in Init(). Error :%d\n", WSAGetLastError());
+#endif
+		WSACleanup();
+		return FALSE;
+	}
+	//bail if socket creation fails
+	if (m_sock < 0)
+	{
+#ifdef DEBUG_OUTPUT
+		fprintf(dl_output,"Client: Error Opening socket: Error %d\n",WSAGetLastError());
+#endif
+        WSACleanup();
+		return FALSE;
+	} 
+	
+	//bind the socket. bail if fails	
+	if (bind(m_sock, reinterpret_cast<struct sockaddr*>(&m_this_end), sizeof(m_this_end)) == SOCKET_ERROR)
+    {
+#ifdef DEBUG_OUTPUT
+		fprintf(dl_output,"Client: Error binding socket: Error %d\n",WSAGetLastError());
+#endif
+        WSACleanup();
+		return FALSE;
+	} 
+
+	if ( connect( m_sock, reinterpret_cast<struct sockaddr*>(&m_other_end), sizeof(m_other_end) ) == SOCKET_ERROR)
+	{
+#ifdef DEBUG_OUTPUT
+		fprintf(dl_output,"Failed to connect. Error %d\n",WSAGetLastError());
+#endif
+		WSACleanup();
+		return FALSE;
+	}
+
+	//non-blocking so a thread that loses the race for a packet in recv_route() doesn't hang
+#ifdef _WIN32
+	u_long nonblock = 1;
+	if (ioctlsocket(m_sock, FIONBIO, &nonblock) == SOCKET_ERROR)
+#else
+	if (fcntl(m_sock, F_SETFL, fcntl(m_sock, F_GETFL, 0) | O_NONBLOCK) < 0)
+#endif
+	{
+#ifdef DEBUG_OUTPUT
+		fprintf(dl_output,"Failed to make the socket non-blocking. Error %d\n",WSAGetLastError());
+#endif
+		WSACleanup();
+		return FALSE;
+	}
+	if ((m_busy_sock_us > 0) && (set_busy_sock() == FALSE))
+	{
+		errmsg("Unable to set SO_BUSY_POLL on the socket. Spinning without it.\n");
+	}
+
+	m_initialized = TRUE;
+	return TRUE;
+}
+
+/*! \brief Send the string stored in m_buff to the game server. 
+\return \b boolean
+\sa IsIntialized()
+\sa get_cmd_buffer()
+
+\note Started to make this method private but opted to keep it public so that any command/query string could be 
+built and use this method to transmit.  It will fail on IsInitialized() fail or socket error. 
+
+*/
+bool C_DeviceLink::SendMsg()
+{	
+	if (IsInitialized() == FALSE)
+	{
+		init_err();
+		return FALSE;
+	}
+
+	int err = 0;
+	char temp_cmd[DL_MAX_QUERY];
+	memset(temp_cmd, NULL,sizeof(temp_cmd));
+	if (get_cmd_buff(temp_cmd, sizeof(temp_cmd)) == FALSE)
+	{
+		errmsg("get_cmd_buff returned FALSE in SendMsg.\n");
+		return FALSE;
+     }
+	int len = static_cast<int>(strlen(temp_cmd));
+	err = send(m_sock, temp_cmd, len, 0);
+	if (err == SOCKET_ERROR)
+	{
+#ifdef DEBUG_OUTPUT
+		fprintf(dl_output, "error in SendMSg. Error %d\n",WSAGetLastError());
+#endif
+        WSACleanup();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*! \brief Read response to the query and store it in the private m_buff. 
+\return \b boolean
+
+\note This fails if IsInitialized() fails, on socket error or if nothing arrives within
+DL_READ_TIMEOUT.  If it succeeds HasData() is set and m_buff holds the packet. The packet
+is also routed to any query in flight and cached, so it is never lost to another thread.
+\warning Calling routine must parse out the buffer for actual values.  
+
+*/
+
+bool C_DeviceLink::ReadMsg()
+{
+	if (IsInitialized() == FALSE)
+	{
+		init_err();
+		return FALSE;
+	}
+	if (recv_route(DL_READ_TIMEOUT) <= 0)
+	{
+#ifdef DEBUG_OUTPUT
+		fprintf(dl_output,"no data to read in ReadMSg()\n");
+#endif
+		set_has_read_data(FALSE);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*! \brief Returns true if the gear is already up and false if it isn't.
+\return \b boolean
+
+\note Fails if the query fails or the gear is actually up. The status is cached only
+when the game actually answered.
+
+*/
+bool C_DeviceLink::Gear_Is_Up()
+{
+	Prefetch(DLP_GEAR_STATUS, 0.00);
+	if (RefreshPending() == FALSE)
+	{
+		errmsg("RefreshPending returned FALSE in Gear_Is_Up.\n");
+		return FALSE;
+	}
+	float fval = 0.00;
+	{
+	DL_Lock m_Lock(&m_critsec);
+	fval = m_gear_status;
+	}
+	if (fval > 0.00)
+	{
+		return FALSE;
+	} else
+	{
+		errmsg("Gear already up in Gear_Is_Up\n");
+		return TRUE;		
+	}
+}
+
+/*! \brief Toggles the state of the landing gear
+\return \b boolean
+
+\note Toggles the gear setting and utilizes the toggleswitch() function.
+
+*/
+bool C_DeviceLink::ToggleGear()
+{	
+	{
+	DL_Lock m_Lock(&m_critsec);
+	m_stamp[DLP_GEAR_STATUS][0] = 0.00; //the gear is about to move so the cached status is no good
+	}
+	CancelToggle(DLT_GEAR);
+	return toggleswitch(DL_SET_GEAR_STATUS);
+}
+
+/*! \brief Sets the landing gear to be up.
+\return \b boolean
+\note Fails only if the gear status can't be read or the toggle can't be sent. Hands the
+wanted state to the toggle layer and runs one ToggleTick(), which decides from a gear
+status younger than DL_GEAR_MAX_AGE or refreshes it in the same query as anything else due.
+The gear is toggled at most once. Later ToggleTick() calls confirm it and retry a lost toggle.
+*/
+bool C_DeviceLink::SetGearUp()
+{
+	SetToggle(DLT_GEAR, FALSE);
+	if (ToggleTick() == FALSE)
+	{
+		errmsg("ToggleTick failed in SetGearUp\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*! \brief Sets the gear to be down
+\return \b boolean
+\note Works through the toggle layer the same way SetGearUp() does.
+*/
+bool C_DeviceLink::SetGearDown()
+{
+	SetToggle(DLT_GEAR, TRUE);
+	if (ToggleTick() == FALSE)
+	{
+		errmsg("ToggleTick failed in SetGearDown\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*! \brief Takes the passed in code for querying a gear position and returns a float.
+\param gearcode : the specific gear code to query the server about
+\return \b float : the float position ranging from 0.0 to 1.0 of the current position of the gear
+\note This is for checking each individual wheel versus just an overall status. 
+Return of -1 means an error occurred in queryfloat().
+
+*/
+float C_DeviceLink::GetGearPos(char* gearcode)
+{
+	float gearpos = 0.00;
+	gearpos = queryfloat(gearcode);
+	if (gearpos >= 0.00)
+	{
+		return gearpos;
+	}
+	errmsg("GetGearPos:queryfloat returned a -1 to GetGearPos\n");
+	return -1.00;
+}
+
+/*! \brief Returns the cached position of one gear leg, refreshing the gear bundle first if it is older than max_age.
+\param gearcode : DL_GET_LEFT_GEAR_POS, DL_GET_RIGHT_GEAR_POS, DL_GET_CENTER_GEAR_POS or DL_GET_GEAR_STATUS
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : the position ranging from 0.0 to 1.0. -1 on an invalid code or if it has never been received.
+*/
+float C_DeviceLink::GetGearPos(char* gearcode, double max_age)
+{
+	DLParam param = find_param(gearcode);
+	if ((param < DLP_GEAR_STATUS) || (param > DLP_GEAR_CENTER))
+	{
+		errmsg("GetGearPos called with an invalid gear code.\n");
+		return -1.00;
+	}
+	float vals[4];
+	if (Get_Gear(&vals[0], &vals[1], &vals[2], &vals[3], max_age) == FALSE)
+	{
+		return -1.00;
+	}
+	return vals[param - DLP_GEAR_STATUS];
+}
+
+/*! \brief Queries the gear status and the three leg positions in a single packet.
+\return \b boolean : FALSE if any of them didn't come back
+*/
+bool C_DeviceLink::SetAllGear(void)
+{
+	if (QueryRaw(DL_ALL_GEAR, 4, NULL, 0) < 4)
+	{
+		errmsg("QueryRaw did not return the whole gear bundle in SetAllGear.\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*! \brief Returns the gear bundle, refreshing all of it in one query if any part is older than max_age.
+\param status : receives the gear status. 0.00 is up. May be NULL
+\param left : receives the left leg position. May be NULL
+\param right : receives the right leg position. May be NULL
+\param center : receives the center leg position. May be NULL
+\param max_age : oldest acceptable value in milliseconds
+\return \b boolean : FALSE if a part has never been received
+\note All four values come from the same packet unless a lost reply left some of them behind.
+*/
+bool C_DeviceLink::Get_Gear(float* status, float* left, float* right, float* center, double max_age)
+{
+	bool stale = FALSE;
+	for (int i = DLP_GEAR_STATUS; i <= DLP_GEAR_CENTER; ++i)
+	{
+		if (Prefetch(static_cast<DLParam>(i), max_age) == TRUE)
+		{
+			stale = TRUE;
+		}
+	}
+	if (stale == TRUE)
+	{
+		//one part is stale so refresh the rest along with it
+		for (int i = DLP_GEAR_STATUS; i <= DLP_GEAR_CENTER; ++i)
+		{
+			Prefetch(static_cast<DLParam>(i), 0.00);
+		}
+		RefreshPending();
+	}
+	DL_Lock m_Lock(&m_critsec);
+	for (int i = DLP_GEAR_STATUS; i <= DLP_GEAR_CENTER; ++i)
+	{
+		if (m_stamp[i][0] == 0.00)
+		{
+			errmsg("Gear bundle incomplete in Get_Gear.\n");
+			return FALSE;
+		}
+	}
+	if (status != NULL)
+	{
+		*status = m_gear_status;
+	}
+	if (left != NULL)
+	{
+		*left = m_gear_left;
+	}
+	if (right != NULL)
+	{
+		*right = m_gear_right;
+	}
+	if (center != NULL)
+	{
+		*center = m_gear_center;
+	}
+	return TRUE;
+}
+
+/*! \brief Returns the cached gear status, refreshing the gear bundle first if it is older than max_age.
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : 0.00 is up. -1 if it has never been received
+*/
+float C_DeviceLink::Get_GearStatus(double max_age)
+{
+	float status = 0.00;
+	if (Get_Gear(&status, NULL, NULL, NULL, max_age) == FALSE)
+	{
+		return -1.00;
+	}
+	return status;
+}
+
+/*! \brief send manual lower gear command
+\return \b boolean
+*/
+bool C_DeviceLink::ManualGearDown(void)
+{
+	return toggleswitch(DL_LOWER_GEAR_MAN);
+}
+
+/*! \brief send manual raise gear command
+\return \b boolean
+*/
+bool C_DeviceLink::ManualGearUp(void)
+{
+	return toggleswitch(DL_RAISE_GEAR_MAN);
+}
+/*! \brief This reads in the config.ini file.
+\return \b boolean
+\todo I'm likely to rewrite this in the future. It's been written piecemeal 
+so it's sloppy. 
+\note It reads the config.ini file for the settings.
+
+*/
+bool C_DeviceLink::ReadConfig()
+{
+#if _MSC_VER >= 1400
+	FILE *fp = NULL;
+	errno_t err = 0;
+	err = fopen_s(&fp, "config.ini", "r");
+	if (err != 0)
+	{
+		errmsg("Cannot open config file.\n");
+		exit(1);
+	}
+#else
+	FILE *fp = NULL;
+	fp = fopen("config.ini", "r");
+	if (fp == NULL)
+	{
+		errmsg("Cannot open config file.\n");
+		exit(1);
+	}
+#endif
+	char temp[80];
+	memset(temp, NULL, sizeof(temp));
+	fgets(temp, 19,fp);
+	if (temp[1] != 'D')
+	{
+		errmsg("Invalid config file\n");
+		fclose(fp);
+		return FALSE;
+	}
+
+	fgets(temp, 19, fp);
+	if (temp[0] == 'P')
+	{
+		char* pdest = strstr(temp,"=") + 1;
+		if (pdest == NULL)
+		{
+			errmsg("Invalid IP address in config file.\n");
+			fclose(fp);
+			return FALSE;
+		}
+		m_port = static_cast<u_short>(atoi(pdest));
+		if ((m_port == 0) )
+		{
+			errmsg("Invalid port number in config file.\n");
+			fclose(fp);
+			return FALSE;
+		}
+	} else
+	{
+		errmsg("Invalid config file\n");
+		fclose(fp);
+		return FALSE;
+	}
+
+	fgets(temp,19,fp);
+	if (temp[0] == 'I')
+	{
+		char* pdest = strstr(temp,"=") + 1;
+		if (pdest == NULL)
+		{
+			errmsg("Invalid IP address in config file.\n");
+			fclose(fp);
+			return FALSE;
+		}
+		dl_strncpy(m_game_ip,pdest,sizeof(m_game_ip));
+		if (m_game_ip[0] == NULL)
+		{
+			errmsg("Invalid IP address in config file.\n");
+			fclose(fp);
+			return FALSE;
+		}
+	} else
+	{
+		errmsg("Invalid config file\n");
+		fclose(fp);
+		return FALSE;
+	}	
+
+	fclose(fp);
+	return TRUE;
+}
+
+/*! \brief Returns the Initialized state in a bool. Utilizes DL_Lock for thread safety.
+\return \b boolean
+
+*/
+bool C_DeviceLink::IsInitialized()
+{
+	DL_Lock m_Lock(&m_critsec);
+	return m_initialized;
+}
+
+/*! \brief This is the public method for querying the devicelink server and reading a response.
+\param code : devicelink defined code to send the server and expect a response
+\return \b boolean
+\note Sends the 'R' query and waits for the first answer record. Every value that comes back is
+cached. Safe to call from several threads at once. Use QueryRaw() to get the answer itself.
+*/
+bool C_DeviceLink::QueryMsg(const char* code)
+{
+	if (QueryRaw(code, 1, NULL, 0) == 0)
+	{
+		errmsg("No data read from socket. Server may not be up\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*! \brief Sends a command string to the game without waiting for an answer.
+\param code : one or more set codes with their parameters, separated by DELIM_1, without the leading "R/"
+\return \b boolean
+\note For forwarding commands built elsewhere, e.g. by a proxy. Nothing is cached.
+*/
+bool C_DeviceLink::SendCmd(const char* code)
+{
+	return toggleswitch(code);
+}
+
+/*! \brief Sends a query string to the game and collects the raw answer.
+\param keys : one or more get codes with their parameters, separated by DELIM_1, without the leading "R/"
+\param expected : the number of key/value pairs the game should answer with
+\param reply : receives the key/value pairs of every A packet that came back, without the leading 'A'.
+May be NULL if only the cache is wanted.
+\param buff_size : size of reply
+\return \b unsigned \b int : the number of key/value pairs actually received
+\note The game may split a long answer over several packets, so this keeps reading until all
+expected pairs have arrived or DL_READ_TIMEOUT passes without any. Every known value is cached
+on the way through.
+\note Each call owns its command and reply buffers and only receives the records that answer
+its own codes, so any number of threads can query one C_DeviceLink at the same time.
+*/
+unsigned int C_DeviceLink::QueryRaw(const char* keys, unsigned int expected, char* reply, unsigned int buff_size)
+{
+	if (reply != NULL)
+	{
+		memset(reply, 0, buff_size);
+	}
+	if (keys == NULL)
+	{
+		errmsg("Invalid keys passed to QueryRaw.\n");
+		return 0;
+	}
+	struct m_request_type req;
+	if (strlen(keys) >= sizeof(req.keys))
+	{
+		errmsg("keys too large in QueryRaw.\n");
+		return 0;
+	}
+	dl_strncpy(req.keys, const_cast<char*>(keys), sizeof(req.keys));
+	req.reply = reply;
+	req.size = (reply != NULL) ? buff_size : 0;
+	req.expected = expected;
+	return request(&req);
+}
+
+/*! \brief Return a flag status set when data has actually been received from the game.
+\return \b boolean
+*/
+bool C_DeviceLink::HasData()
+{
+	DL_Lock m_Lock(&m_critsec);
+	return m_readdata;
+}
+
+/*! \brief Get the version of DeviceLink you are running from the game.
+\param verstr : is where you are going to store the result
+\param buff_size : is the size of verstr to be passed in
+\return \b boolean
+\warning verstr must be allocated by calling routine and must be at least 64 bytes!
+\warning buff_size must be passed in and be sizeof(verstr) in calling routine!
+
+*/
+bool C_DeviceLink::GetDLVersion(char* verstr, unsigned int buff_size)
+{
+	if (buff_size < sizeof(m_dl_ver))
+	{
+		errmsg("Calling routine allocated insuffcient buffer. Must be at least 64 bytes!\n");
+		return FALSE;
+	}
+	if (check_profile() == TRUE)
+	{
+		DL_Lock m_Lock(&m_critsec);
+		dl_strncpy(verstr, m_dl_ver, buff_size);
+		return TRUE;
+	}
+	errmsg("check_profile returned FALSE to GetDLVersion.\n");
+	return FALSE;
+}
+
+/*! \brief Verifies that a Get command exists for the associated code.
+\param code : the command code you are checking to see if it has a Get equivalent
+\return \b boolean
+
+*/
+bool C_DeviceLink::ValidGet(const char* code)
+{
+	char newcode[64];
+	char temp[64];
+	memset(temp, NULL,sizeof(temp));
+	memset(newcode, NULL,sizeof(newcode));
+#if _MSC_VER >= 1400
+	_snprintf_s(newcode,sizeof(newcode),_TRUNCATE,"%s%c%s",DL_ACCESS_GET,DELIM_2,code);
+#else
+	_snprintf(newcode,sizeof(newcode),"%s%c%s",DL_ACCESS_GET,DELIM_2,code);
+#endif
+
+	if (querystring(newcode, temp, sizeof(temp)) == TRUE)
+	{
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/*! \brief Queues a cached value for the next RefreshPending() if it is older than max_age.
+\param param : the cached value to check
+\param max_age : oldest acceptable value in milliseconds. 0 always queues.
+\param eng_num : engine index for engine values, 0 otherwise
+\return \b boolean : TRUE if the value was stale and has been queued
+\note Call this for everything a frame is going to read and then call RefreshPending()
+once so all the stale values come back in a single query.
+*/
+bool C_DeviceLink::Prefetch(DLParam param, double max_age, const int eng_num)
+{
+	if ((param < 0) || (param >= DLP_COUNT))
+	{
+		errmsg("Prefetch called with an invalid parameter.\n");
+		return FALSE;
+	}
+	if ((eng_num < 0) || (eng_num >= DL_MAX_ENGINES) || ((dl_params[param].engine == false) && (eng_num != 0)))
+	{
+		errmsg("Prefetch called with invalid engine number.\n");
+		return FALSE;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	double stamp = m_stamp[param][eng_num];
+	if ((stamp != 0.00) && ((MC_Timer::Now() - stamp) <= max_age))
+	{
+		return FALSE;
+	}
+	m_pending[param] |= static_cast<unsigned char>(1 << eng_num);
+	return TRUE;
+}
+
+/*! \brief Queries the game for every value queued by Prefetch() in as few packets as possible.
+\return \b boolean : FALSE if any queued value didn't come back
+\note The queue is cleared as the packets are built. A value that is lost stays stale
+and is simply queued again by the next getter that needs it.
+*/
+bool C_DeviceLink::RefreshPending(void)
+{
+	char keys[DL_MAX_QUERY - 2];
+	char item[16];
+	memset(keys, 0, sizeof(keys));
+	unsigned int len = 0;
+	unsigned int expected = 0;
+	bool flag = TRUE;
+	for (int i = 0; i < DLP_COUNT; ++i)
 	{
-#ifdef DEBUG_OUTPUT
-		fprintf(output,"WSAStartup failed with error %d\n",retval);
+		unsigned char mask = 0;
+		{
+		DL_Lock m_Lock(&m_critsec);
+		mask = m_pending[i];
+		m_pending[i] = 0;
+		}
+		for (int eng = 0; (mask != 0) && (eng < DL_MAX_ENGINES); ++eng)
+		{
+			if ((mask & (1 << eng)) == 0)
+			{
+				continue;
+			}
+			mask &= static_cast<unsigned char>(~(1 << eng));
+			memset(item, 0, sizeof(item));
+			if (dl_params[i].engine == true)
+			{
+#if _MSC_VER >= 1400
+				_snprintf_s(item,sizeof(item),_TRUNCATE,"%s%c%d",dl_params[i].code,DELIM_2,eng);
+#else
+				_snprintf(item,sizeof(item),"%s%c%d",dl_params[i].code,DELIM_2,eng);
 #endif
-        WSACleanup();
-        return FALSE;
-    }
+			} else
+			{
+				dl_strncpy(item, const_cast<char *>(dl_params[i].code), sizeof(item));
+			}
+			//send what we have if this code won't fit in the packet
+			if ((len + strlen(item) + 1) >= sizeof(keys))
+			{
+				if (querybatch(keys, expected) < expected)
+				{
+					flag = FALSE;
+				}
+				memset(keys, 0, sizeof(keys));
+				len = 0;
+				expected = 0;
+			}
+			if (len > 0)
+			{
+				keys[len++] = DELIM_1;
+			}
+			dl_strncpy(keys + len, item, sizeof(keys) - len);
+			len += static_cast<unsigned int>(strlen(item));
+			++expected;
+		}
+	}
+	if (expected > 0)
+	{
+		bool piggy = FALSE;
+		{
+		DL_Lock m_Lock(&m_critsec);
+		piggy = m_piggy;
+		}
+		if (piggy == TRUE)
+		{
+			//pending controls ride along, the game doesn't answer set codes
+			int next = 0;
+			unsigned int carried = pack_controls(keys, sizeof(keys), &len, &next, MC_Timer::Now());
+			DL_Lock m_Lock(&m_critsec);
+			m_ctrl_piggybacked += carried;
+		}
+		if (querybatch(keys, expected) < expected)
+		{
+			flag = FALSE;
+		}
+	}
+	if (flag == FALSE)
+	{
+		errmsg("RefreshPending did not receive every queued value.\n");
+	}
+	return flag;
+}
 
-	//create the UDP socket.
-	m_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	if (m_sock == INVALID_SOCKET)
+/*! \brief Returns how long ago a cached value was received from the game.
+\param param : the cached value
+\param eng_num : engine index for engine values, 0 otherwise
+\return \b double : age in milliseconds or -1 if the value has never been received
+*/
+double C_DeviceLink::GetAge(DLParam param, const int eng_num)
+{
+	if ((param < 0) || (param >= DLP_COUNT) || (eng_num < 0) || (eng_num >= DL_MAX_ENGINES))
 	{
-#ifdef DEBUG_OUTPUT
-		fprintf(dl_output,"Error in socket call in Init(). Error :%d\n", WSAGetLastError());
-#endif
-		WSACleanup();
+		errmsg("GetAge called with an invalid parameter.\n");
+		return -1.00;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	if (m_stamp[param][eng_num] == 0.00)
+	{
+		return -1.00;
+	}
+	return MC_Timer::Now() - m_stamp[param][eng_num];
+}
+
+/*! \brief Schedules a value to be refreshed by PollTick() every period milliseconds.
+\param param : the cached value to poll
+\param period : poll period in milliseconds. 0 removes the value from the schedule.
+\param eng_num : engine index for engine values, 0 otherwise
+\return \b boolean
+\note Example for a motion platform:
+*	- SetPollRate(DLP_PITCH, 1000.0/60.0);\n
+*	- SetPollRate(DLP_IAS, 50.0);\n
+*	- SetPollRate(DLP_TEMP_WATER, 1000.0, ENGINE_ONE);\n
+*	.
+*/
+bool C_DeviceLink::SetPollRate(DLParam param, double period, const int eng_num)
+{
+	if ((param < 0) || (param >= DLP_COUNT) || (period < 0.00))
+	{
+		errmsg("SetPollRate called with an invalid parameter.\n");
 		return FALSE;
 	}
-#pragma warning( push, 3 ) //Microsoft's FD_SET macro causes a Lvl 4 warning. Choosing to ignore it.
-	FD_SET(m_sock, &ActiveReadFds);
-#pragma warning( pop ) // pop back to lvl 4 warning.
-	//bail if socket creation fails
-	if (m_sock < 0)
+	if ((eng_num < 0) || (eng_num >= DL_MAX_ENGINES) || ((dl_params[param].engine == false) && (eng_num != 0)))
 	{
-#ifdef DEBUG_OUTPUT
-		fprintf(dl_output,"Client: Error Opening socket: Error %d\n",WSAGetLastError());
+		errmsg("SetPollRate called with invalid engine number.\n");
+		return FALSE;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	memset(&m_poll[param][eng_num], 0, sizeof(m_poll[param][eng_num]));
+	m_poll[param][eng_num].period = period;
+	m_poll[param][eng_num].due = MC_Timer::Now();
+	return TRUE;
+}
+
+/*! \brief Refreshes every scheduled value that is due in as few packets as possible.
+\return \b boolean : FALSE if any value that was due didn't come back
+\note Call this from the application loop as often as the fastest rate needs. Values
+queued with Prefetch() ride along in the same packets, and so do pending controls when
+EnablePiggyback() is on. The schedule advances by whole periods so a late tick doesn't drift
+the rate, but a tick that falls more than a period behind restarts the schedule from now
+rather than bursting to catch up.
+\sa NextPollDue()
+*/
+bool C_DeviceLink::PollTick(void)
+{
+	unsigned char due_mask[DLP_COUNT];
+	memset(due_mask, 0, sizeof(due_mask));
+	bool any = FALSE;
+	bool piggy = FALSE;
+	double now = MC_Timer::Now();
+	{
+	DL_Lock m_Lock(&m_critsec);
+	piggy = m_piggy;
+	for (int i = 0; i < DLP_COUNT; ++i)
+	{
+		for (int eng = 0; eng < DL_MAX_ENGINES; ++eng)
+		{
+			m_poll_type* poll = &m_poll[i][eng];
+			if ((poll->period <= 0.00) || (now < poll->due))
+			{
+				continue;
+			}
+			due_mask[i] |= static_cast<unsigned char>(1 << eng);
+			m_pending[i] |= static_cast<unsigned char>(1 << eng);
+			poll->due += poll->period;
+			if (poll->due <= now)
+			{
+				poll->due = now + poll->period;
+			}
+			any = TRUE;
+		}
+	}
+	}
+	if (any == FALSE)
+	{
+		if (piggy == TRUE)
+		{
+			return FlushControls();
+		}
+		return TRUE;
+	}
+	bool flag = RefreshPending();
+	if ((piggy == TRUE) && (FlushControls() == FALSE))
+	{
+		flag = FALSE;
+	}
+
+	DL_Lock m_Lock(&m_critsec);
+	for (int i = 0; i < DLP_COUNT; ++i)
+	{
+		for (int eng = 0; (due_mask[i] != 0) && (eng < DL_MAX_ENGINES); ++eng)
+		{
+			if ((due_mask[i] & (1 << eng)) == 0)
+			{
+				continue;
+			}
+			m_poll_type* poll = &m_poll[i][eng];
+			double stamp = m_stamp[i][eng];
+			if (stamp < now)
+			{
+				++poll->misses;
+				continue;
+			}
+			++poll->polls;
+			if (poll->last != 0.00)
+			{
+				double interval = stamp - poll->last;
+				double jitter = interval - poll->period;
+				if (jitter < 0.00)
+				{
+					jitter = -jitter;
+				}
+				++poll->intervals;
+				poll->sum_interval += interval;
+				poll->sum_jitter += jitter;
+				if (jitter > poll->max_jitter)
+				{
+					poll->max_jitter = jitter;
+				}
+			}
+			poll->last = stamp;
+		}
+	}
+	return flag;
+}
+
+/*! \brief Returns how long until the next scheduled value is due.
+\return \b double : milliseconds until the next PollTick() has work to do. 0 if something
+is already due and -1 if nothing is scheduled.
+\note Handy for sleeping the polling thread for exactly as long as it can.
+*/
+double C_DeviceLink::NextPollDue(void)
+{
+	double next = -1.00;
+	DL_Lock m_Lock(&m_critsec);
+	for (int i = 0; i < DLP_COUNT; ++i)
+	{
+		for (int eng = 0; eng < DL_MAX_ENGINES; ++eng)
+		{
+			if ((m_poll[i][eng].period > 0.00) && ((next < 0.00) || (m_poll[i][eng].due < next)))
+			{
+				next = m_poll[i][eng].due;
+			}
+		}
+	}
+	if (next < 0.00)
+	{
+		return -1.00;
+	}
+	next -= MC_Timer::Now();
+	return (next > 0.00) ? next : 0.00;
+}
+
+/*! \brief Starts a thread that calls PollTick() at a fixed rate.
+\param period : tick period in milliseconds
+\param priority : SCHED_FIFO priority for the thread, 1 to 99. 0 leaves it at normal priority.
+Any value above 0 means THREAD_PRIORITY_TIME_CRITICAL on Win32
+\param cpu : processor to pin the thread to. -1 lets it run anywhere
+\return \b boolean : FALSE if the thread is already running, the period is invalid or the thread
+couldn't be created
+\note Ticks are paced against absolute deadlines, so a slow tick doesn't push the ones after it
+back: on Linux a timerfd armed with TFD_TIMER_ABSTIME, clock_nanosleep(TIMER_ABSTIME) on other
+POSIX systems, and a waitable timer on Win32. A wake that finds deadlines already passed counts
+them as missed and skips them rather than firing a burst to catch up. Schedule values with
+SetPollRate() as usual; read them from the cache or the update queue. If the priority or CPU
+can't be granted the thread still runs and GetPollThreadStats() says so. SCHED_FIFO usually
+needs root or CAP_SYS_NICE. On Win32 the timer only wakes as finely as the system timer, so
+call timeBeginPeriod(1) for periods under about 15 ms.
+*/
+bool C_DeviceLink::StartPollThread(double period, int priority, int cpu)
+{
+	if ((period <= 0.00) || (priority < 0) || (cpu < -1))
+	{
+		errmsg("StartPollThread called with an invalid parameter.\n");
+		return FALSE;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	if (m_pt_started == TRUE)
+	{
+		errmsg("StartPollThread called while the polling thread is running.\n");
+		return FALSE;
+	}
+	m_pt_period = period;
+	m_pt_priority = priority;
+	m_pt_cpu = cpu;
+	m_pt_run = TRUE;
+	m_pt_stats.period = period;
+	m_pt_stats.realtime = FALSE;
+	m_pt_stats.pinned = FALSE;
+#ifdef _WIN32
+	m_pt_handle = CreateThread(NULL, 0, poll_thread_entry, this, 0, NULL);
+	if (m_pt_handle == NULL)
+#else
+	if (pthread_create(&m_pt_handle, NULL, poll_thread_entry, this) != 0)
 #endif
-        WSACleanup();
+	{
+		m_pt_run = FALSE;
+		errmsg("Unable to create the polling thread.\n");
 		return FALSE;
-	} 
-	
-	//bind the socket. bail if fails	
-	if (bind(m_sock, reinterpret_cast<struct sockaddr*>(&m_this_end), sizeof(m_this_end)) == SOCKET_ERROR)
-    {
-#ifdef DEBUG_OUTPUT
-		fprintf(dl_output,"Client: Error binding socket: Error %d\n",WSAGetLastError());
+	}
+	m_pt_started = TRUE;
+	return TRUE;
+}
+
+/*! \brief Stops the thread started by StartPollThread() and waits for it to end.
+\note Returns within one period plus the time of the tick in progress. Safe to call when
+the thread isn't running. Must not be called from the polling thread itself.
+*/
+void C_DeviceLink::StopPollThread(void)
+{
+	{
+	DL_Lock m_Lock(&m_critsec);
+	if (m_pt_started == FALSE)
+	{
+		return;
+	}
+	m_pt_run = FALSE;
+	}
+	//join without the lock, the thread needs it to finish its tick
+#ifdef _WIN32
+	WaitForSingleObject(m_pt_handle, INFINITE);
+	CloseHandle(m_pt_handle);
+	m_pt_handle = NULL;
+#else
+	pthread_join(m_pt_handle, NULL);
 #endif
-        WSACleanup();
+	DL_Lock m_Lock(&m_critsec);
+	m_pt_started = FALSE;
+}
+
+/*! \brief Returns whether the polling thread is running.
+\return \b boolean
+*/
+bool C_DeviceLink::IsPollThreadRunning(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	return m_pt_started;
+}
+
+/*! \brief Copies the timing statistics of the polling thread.
+\param stats : receives the tick counts, jitter and missed deadline histograms
+*/
+void C_DeviceLink::GetPollThreadStats(DLPollThreadStats* stats)
+{
+	if (stats == NULL)
+	{
+		return;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	memcpy(stats, &m_pt_stats, sizeof(m_pt_stats));
+	stats->mean_jitter = (m_pt_intervals > 0) ? (m_pt_sum_jitter / m_pt_intervals) : 0.00;
+	stats->mean_work = (m_pt_stats.ticks > 0) ? (m_pt_sum_work / m_pt_stats.ticks) : 0.00;
+}
+
+/*! \brief Zeroes the timing statistics of the polling thread. The period and granted flags are kept.
+*/
+void C_DeviceLink::ResetPollThreadStats(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	double period = m_pt_stats.period;
+	bool realtime = m_pt_stats.realtime;
+	bool pinned = m_pt_stats.pinned;
+	memset(&m_pt_stats, 0, sizeof(m_pt_stats));
+	m_pt_stats.period = period;
+	m_pt_stats.realtime = realtime;
+	m_pt_stats.pinned = pinned;
+	m_pt_sum_jitter = 0.00;
+	m_pt_sum_work = 0.00;
+	m_pt_intervals = 0;
+}
+
+/*! \brief Makes receives spin on the socket for a while before they sleep in select().
+\param enable : TRUE to spin first. FALSE to go back to select() only
+\param budget : longest spin in milliseconds each time a query waits for a packet
+\param sock_us : SO_BUSY_POLL for the socket in microseconds, so the kernel polls the network
+device too. 0 leaves the socket alone
+\return \b boolean : FALSE on an invalid setting, or if the socket refused SO_BUSY_POLL. Spinning
+is on in that case too
+\note Meant for a game and bridge on one machine, where waking from select() is a large part of
+a round trip. Spinning burns a core for up to budget on every wait, so it only pays with a core
+to spare; on a single core it takes time from the game instead. SO_BUSY_POLL is Linux only, needs
+CAP_NET_ADMIN above net.core.busy_read and does nothing for loopback, which has no device queue
+to poll. Compare GetRttStats() with it on and off to see what it buys.
+*/
+bool C_DeviceLink::EnableBusyPoll(bool enable, double budget, int sock_us)
+{
+	if ((budget < 0.00) || (sock_us < 0))
+	{
+		errmsg("EnableBusyPoll called with an invalid parameter.\n");
 		return FALSE;
-	} 
+	}
+	DL_Lock m_Lock(&m_critsec);
+	m_busy = enable;
+	m_busy_budget = budget;
+	if ((enable == FALSE) || (sock_us == m_busy_sock_us))
+	{
+		return TRUE;
+	}
+	m_busy_sock_us = sock_us;
+	if ((m_initialized == TRUE) && (set_busy_sock() == FALSE))
+	{
+		errmsg("Unable to set SO_BUSY_POLL on the socket. Spinning without it.\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*! \brief Copies the round-trip time distribution and the busy-poll counters.
+\param stats : receives the statistics
+\note Every query is measured whether busy polling is on or not.
+*/
+void C_DeviceLink::GetRttStats(DLRttStats* stats)
+{
+	if (stats == NULL)
+	{
+		return;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	memcpy(stats, &m_rtt, sizeof(m_rtt));
+	stats->mean_rtt = (m_rtt.samples > 0) ? (m_rtt_sum / m_rtt.samples) : 0.00;
+}
+
+/*! \brief Zeroes the round-trip time distribution and the busy-poll counters.
+*/
+void C_DeviceLink::ResetRttStats(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	memset(&m_rtt, 0, sizeof(m_rtt));
+	m_rtt_sum = 0.00;
+}
+
+/*! \brief Sets SO_BUSY_POLL on the socket to m_busy_sock_us.
+\return \b boolean : FALSE if the option was refused or this system doesn't have it
+*/
+bool C_DeviceLink::set_busy_sock(void)
+{
+#ifdef SO_BUSY_POLL
+	int us = m_busy_sock_us;
+	return (setsockopt(m_sock, SOL_SOCKET, SO_BUSY_POLL, reinterpret_cast<const char*>(&us), sizeof(us)) == 0);
+#else
+	return FALSE;
+#endif
+}
+
+/*! \brief Adds one query to the round-trip statistics.
+\param rtt : send to last answer packet in ms. Below 0 for a timeout
+*/
+void C_DeviceLink::rtt_record(double rtt)
+{
+	DL_Lock m_Lock(&m_critsec);
+	if (rtt < 0.00)
+	{
+		++m_rtt.timeouts;
+		return;
+	}
+	if ((m_rtt.samples == 0) || (rtt < m_rtt.min_rtt))
+	{
+		m_rtt.min_rtt = rtt;
+	}
+	if (rtt > m_rtt.max_rtt)
+	{
+		m_rtt.max_rtt = rtt;
+	}
+	++m_rtt.samples;
+	m_rtt_sum += rtt;
+	int bin = 0;
+	for (double edge = DL_RTT_BIN0; (rtt >= edge) && (bin < (DL_RTT_BINS - 1)); edge *= 2.00)
+	{
+		++bin;
+	}
+	++m_rtt.hist[bin];
+}
+
+#ifdef _WIN32
+DWORD WINAPI C_DeviceLink::poll_thread_entry(LPVOID arg)
+#else
+void* C_DeviceLink::poll_thread_entry(void* arg)
+#endif
+{
+	static_cast<C_DeviceLink*>(arg)->poll_thread();
+	return 0;
+}
+
+/*! \brief Applies the priority and CPU asked for in StartPollThread() to the calling thread.
+*/
+void C_DeviceLink::pt_schedule(void)
+{
+	bool realtime = FALSE;
+	bool pinned = FALSE;
+#ifdef _WIN32
+	if (m_pt_priority > 0)
+	{
+		realtime = (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0);
+	}
+	if ((m_pt_cpu >= 0) && (m_pt_cpu < static_cast<int>(sizeof(DWORD_PTR) * 8)))
+	{
+		pinned = (SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << m_pt_cpu) != 0);
+	}
+#else
+	if (m_pt_priority > 0)
+	{
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = m_pt_priority;
+		if (param.sched_priority > sched_get_priority_max(SCHED_FIFO))
+		{
+			param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+		}
+		realtime = (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0);
+	}
+#ifdef __linux__
+	if ((m_pt_cpu >= 0) && (m_pt_cpu < CPU_SETSIZE))
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(m_pt_cpu, &set);
+		pinned = (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+	}
+#endif
+#endif
+	if ((m_pt_priority > 0) && (realtime == FALSE))
+	{
+		errmsg("Unable to give the polling thread real-time priority. Running at normal priority.\n");
+	}
+	if ((m_pt_cpu >= 0) && (pinned == FALSE))
+	{
+		errmsg("Unable to pin the polling thread to the requested CPU.\n");
+	}
+	DL_Lock m_Lock(&m_critsec);
+	m_pt_stats.realtime = realtime;
+	m_pt_stats.pinned = pinned;
+}
+
+/*! \brief Adds one wake of the polling thread to its statistics.
+\param wake : MC_Timer::Now() of this wake
+\param last : MC_Timer::Now() of the previous wake. 0 on the first
+\param missed : deadlines that passed unserved before this wake
+\param work : time the tick spent in PollTick()
+*/
+void C_DeviceLink::pt_record(double wake, double last, unsigned long missed, double work)
+{
+	DL_Lock m_Lock(&m_critsec);
+	++m_pt_stats.ticks;
+	m_pt_sum_work += work;
+	if (work > m_pt_stats.max_work)
+	{
+		m_pt_stats.max_work = work;
+	}
+	if (missed > 0)
+	{
+		m_pt_stats.missed += missed;
+		++m_pt_stats.missed_hist[(missed < DL_MISS_BINS) ? (missed - 1) : (DL_MISS_BINS - 1)];
+	}
+	if (last == 0.00)
+	{
+		return;
+	}
+	double jitter = fabs((wake - last) - (m_pt_period * (missed + 1)));
+	int bin = 0;
+	for (double edge = DL_JITTER_BIN0; (jitter >= edge) && (bin < (DL_JITTER_BINS - 1)); edge *= 2.00)
+	{
+		++bin;
+	}
+	++m_pt_stats.jitter_hist[bin];
+	++m_pt_intervals;
+	m_pt_sum_jitter += jitter;
+	if (jitter > m_pt_stats.max_jitter)
+	{
+		m_pt_stats.max_jitter = jitter;
+	}
+}
+
+/*! \brief Body of the polling thread. Waits for each absolute deadline and runs PollTick().
+*/
+void C_DeviceLink::poll_thread(void)
+{
+	pt_schedule();
+	double period = m_pt_period;
+	double deadline = MC_Timer::Now() + period; //MC_Timer reads CLOCK_MONOTONIC, the clock the timers use
+	double last = 0.00;
+#ifdef __linux__
+	int tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (tfd < 0)
+	{
+		errmsg("Unable to create the polling thread timer.\n");
+		return;
+	}
+	struct itimerspec spec;
+	spec.it_value.tv_sec = static_cast<time_t>(deadline / 1000.00);
+	spec.it_value.tv_nsec = static_cast<long>(fmod(deadline, 1000.00) * 1000000.00);
+	spec.it_interval.tv_sec = static_cast<time_t>(period / 1000.00);
+	spec.it_interval.tv_nsec = static_cast<long>(fmod(period, 1000.00) * 1000000.00);
+	if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &spec, NULL) != 0)
+	{
+		errmsg("Unable to start the polling thread timer.\n");
+		close(tfd);
+		return;
+	}
+#elif defined(_WIN32)
+	HANDLE timer = CreateWaitableTimer(NULL, TRUE, NULL);
+	if (timer == NULL)
+	{
+		errmsg("Unable to create the polling thread timer.\n");
+		return;
+	}
+#endif
+	while (m_pt_run == TRUE)
+	{
+		unsigned long missed = 0;
+#ifdef __linux__
+		unsigned long long expirations = 0;
+		if (read(tfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			errmsg("Polling thread timer failed.\n");
+			break;
+		}
+		missed = static_cast<unsigned long>(expirations - 1);
+		deadline += period * static_cast<double>(expirations - 1);
+#else
+		double remain = deadline - MC_Timer::Now();
+		if (remain > 0.00)
+		{
+#ifdef _WIN32
+			LARGE_INTEGER due;
+			due.QuadPart = -static_cast<LONGLONG>(remain * 10000.00); //negative is relative, in 100 ns units
+			SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE);
+			WaitForSingleObject(timer, INFINITE);
+#else
+			struct timespec until;
+			until.tv_sec = static_cast<time_t>(deadline / 1000.00);
+			until.tv_nsec = static_cast<long>(fmod(deadline, 1000.00) * 1000000.00);
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+			{
+			}
+#endif
+		}
+		missed = static_cast<unsigned long>((MC_Timer::Now() - deadline) / period);
+		deadline += period * static_cast<double>(missed);
+#endif
+		double wake = MC_Timer::Now();
+		if (m_pt_run == FALSE)
+		{
+			break;
+		}
+		PollTick();
+		pt_record(wake, last, missed, MC_Timer::Now() - wake);
+		last = wake;
+		deadline += period;
+	}
+#ifdef __linux__
+	close(tfd);
+#elif defined(_WIN32)
+	CloseHandle(timer);
+#endif
+}
 
-	if ( connect( m_sock, reinterpret_cast<struct sockaddr*>(&m_other_end), sizeof(m_other_end) ) == SOCKET_ERROR)
+/*! \brief Copies the poll timing statistics of a scheduled value.
+\param param : the scheduled value
+\param stats : where to store the statistics
+\param eng_num : engine index for engine values, 0 otherwise
+\return \b boolean
+\warning stats must be allocated by the calling routine.
+*/
+bool C_DeviceLink::GetPollStats(DLParam param, DLPollStats* stats, const int eng_num)
+{
+	if ((param < 0) || (param >= DLP_COUNT) || (stats == NULL) || (eng_num < 0) || (eng_num >= DL_MAX_ENGINES))
 	{
-#ifdef DEBUG_OUTPUT
-		fprintf(dl_output,"Failed to connect. Error %d\n",WSAGetLastError());
-#endif
-		WSACleanup();
+		errmsg("GetPollStats called with an invalid parameter.\n");
 		return FALSE;
 	}
-
-	m_initialized = TRUE;
+	DL_Lock m_Lock(&m_critsec);
+	const m_poll_type* poll = &m_poll[param][eng_num];
+	stats->period = poll->period;
+	stats->polls = poll->polls;
+	stats->misses = poll->misses;
+	stats->mean_interval = (poll->intervals > 0) ? (poll->sum_interval / poll->intervals) : 0.00;
+	stats->mean_jitter = (poll->intervals > 0) ? (poll->sum_jitter / poll->intervals) : 0.00;
+	stats->max_jitter = poll->max_jitter;
 	return TRUE;
 }
 
-/*! \brief Send the string stored in m_buff to the game server. 
-\return \b boolean
-\sa IsIntialized()
-\sa get_cmd_buffer()
+/*! \brief Clears the poll timing statistics without changing the schedule.
+*/
+void C_DeviceLink::ResetPollStats(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	for (int i = 0; i < DLP_COUNT; ++i)
+	{
+		for (int eng = 0; eng < DL_MAX_ENGINES; ++eng)
+		{
+			m_poll_type* poll = &m_poll[i][eng];
+			poll->last = 0.00;
+			poll->polls = 0;
+			poll->misses = 0;
+			poll->intervals = 0;
+			poll->sum_interval = 0.00;
+			poll->sum_jitter = 0.00;
+			poll->max_jitter = 0.00;
+		}
+	}
+}
 
-\note Started to make this method private but opted to keep it public so that any command/query string could be 
-built and use this method to transmit.  It will fail on IsInitialized() fail or socket error. 
+/*! \brief Turns recording of the pitch, roll and azimuth history on or off.
+\param enable : TRUE to record every received attitude value for EstimateAttitude()
+\param max_extrap : longest time in ms to extrapolate past the newest sample before holding
+\note Turning it on clears the history.
+*/
+void C_DeviceLink::EnableAttitudeEstimator(bool enable, double max_extrap)
+{
+	DL_Lock m_Lock(&m_critsec);
+	memset(m_att, 0, sizeof(m_att));
+	m_att_enabled = enable;
+	m_att_max_extrap = (max_extrap > 0.00) ? max_extrap : 0.00;
+}
 
+/*! \brief Estimates the attitude at an arbitrary time from the recent history.
+\param t : the time to estimate for, in MC_Timer::Now() milliseconds
+\param pitch : where to store the pitch in degrees
+\param roll : where to store the roll in degrees
+\param azimuth : where to store the azimuth in degrees
+\return \b boolean : FALSE if the estimator is off or has no history yet. The cached
+values are returned in that case.
+\note For a servo loop faster than the poll rate call this with MC_Timer::Now() to
+extrapolate, or with a time a poll period in the past to interpolate between real samples.
+The azimuth rate comes from the angular speed when it was received after the azimuth sample
+before the newest one, i.e. in the same poll as the newest azimuth or later, and agrees in sign
+with the samples; otherwise from the samples themselves. The newest azimuth itself isn't the
+bound because both arrive in one packet and may be stored in either order.
+The turn indicator isn't used since DeviceLink gives it no defined units.
+\warning pitch, roll and azimuth must be allocated by the calling routine.
 */
-bool C_DeviceLink::SendMsg()
-{	
-	if (IsInitialized() == FALSE)
+bool C_DeviceLink::EstimateAttitude(double t, float* pitch, float* roll, float* azimuth)
+{
+	if ((pitch == NULL) || (roll == NULL) || (azimuth == NULL))
 	{
-		init_err();
+		errmsg("EstimateAttitude called with a NULL pointer.\n");
 		return FALSE;
 	}
-
-	int err = 0;
-	char temp_cmd[80];
-	memset(temp_cmd, NULL,sizeof(temp_cmd));
-	if (get_cmd_buff(temp_cmd, sizeof(temp_cmd)) == FALSE)
+	DL_Lock m_Lock(&m_critsec);
+	if ((m_att_enabled == FALSE) || (m_att[0].count == 0) || (m_att[1].count == 0) || (m_att[2].count == 0))
 	{
-		errmsg("get_cmd_buff returned FALSE in SendMsg.\n");
+		*pitch = m_pitch;
+		*roll = m_roll;
+		*azimuth = m_azimuth;
 		return FALSE;
-     }
-	int len = static_cast<int>(strlen(temp_cmd));
-	err = send(m_sock, temp_cmd, len, 0);
-	if (err == SOCKET_ERROR)
+	}
+	*pitch = estimate_angle(0, t, 0.00, FALSE);
+	*roll = estimate_angle(1, t, 0.00, FALSE);
+	//only trust the angular speed if it came with the newest azimuth or later and turns the same way
+	bool use_hint = FALSE;
+	const m_att_type* att = &m_att[2];
+	unsigned int newest = (att->head + DL_ATT_HISTORY - 1) % DL_ATT_HISTORY;
+	unsigned int prev = (newest + DL_ATT_HISTORY - 1) % DL_ATT_HISTORY;
+	if ((att->count >= 2) && (m_stamp[DLP_ANG_SPD][0] >= att->t[prev]))
+	{
+		float diff = wrap_angle_diff(att->val[newest] - att->val[prev]);
+		use_hint = ((diff * m_ang_spd) > 0.00f) ? TRUE : FALSE;
+	}
+	*azimuth = estimate_angle(2, t, m_ang_spd, use_hint);
+	return TRUE;
+}
+
+/*! \brief Queries every discrete switch state in a single packet.
+\return \b boolean : FALSE if any state didn't come back
+\note Updates the individual private vars, i.e. Get_Canopy(), as well as the packed state
+returned by Get_Switches(). A state that didn't come back keeps its old value.
+\sa Get_Switches()
+\sa Get_SwitchesValid()
+*/
+bool C_DeviceLink::SetAllSwitches(void)
+{
+	if (QueryRaw(DL_ALL_SWITCHES, DLS_COUNT, NULL, 0) < DLS_COUNT)
 	{
-#ifdef DEBUG_OUTPUT
-		fprintf(dl_output, "error in SendMSg. Error %d\n",WSAGetLastError());
-#endif
-        WSACleanup();
+		errmsg("QueryRaw did not return every switch in SetAllSwitches.\n");
 		return FALSE;
 	}
 	return TRUE;
 }
 
-/*! \brief Read response to the query and store it in the private m_buff. 
-\return \b boolean
-
-\note This fails if IsInitialized() fails and on socket error.  If it succeeds
-it calls set_has_read_data(bool flag) to set the HasData() properly. It also
-loads the in the internal m_buff with the data read from the socket via the 
-set_read_buff(char* temp_buff) function.
-\warning Calling routine must parse out the buffer for actual values.  
+/*! \brief Returns every discrete state packed one bit per DLSwitch.
+\return \b unsigned \b long : bit (1 << DLS_x) is set when that switch is on
+\note Kept up to date by every query that returns a switch, not just SetAllSwitches().
+*/
+unsigned long C_DeviceLink::Get_Switches(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	return m_switches;
+}
 
+/*! \brief Returns which bits of Get_Switches() have been received from the game.
+\return \b unsigned \b long : bit (1 << DLS_x) is set once that switch has been received
 */
+unsigned long C_DeviceLink::Get_SwitchesValid(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	return m_switches_valid;
+}
 
-bool C_DeviceLink::ReadMsg()
+/*! \brief Asks the toggle layer to bring a subsystem to a state.
+\param toggle : the subsystem
+\param on : TRUE for gear down, canopy open, hook down and so on
+\return \b boolean : FALSE on an invalid subsystem
+\note Nothing is sent here. ToggleTick() sends the toggle at most once, confirms it through the
+matching get code and only tries again when a later reading still shows the old state. Asking
+again for the state already in progress doesn't restart it.
+*/
+bool C_DeviceLink::SetToggle(DLToggle toggle, bool on)
 {
-	if (IsInitialized() == FALSE)
+	if ((toggle < 0) || (toggle >= DLT_COUNT))
 	{
-		init_err();
+		errmsg("SetToggle called with an invalid subsystem.\n");
 		return FALSE;
 	}
-	size_t len = 0;
-	size_t buff_len = 0;
-	char temp_buff[256];
-	memset(temp_buff, NULL, sizeof(temp_buff));
-	buff_len = sizeof(temp_buff);
-	memset(&ActiveReadFds, 0x0, sizeof(fd_set));
-#pragma warning( disable : 4127) //supressing compiler warning about this macro. Not my macro so can't fix it.
-	FD_SET(m_sock, &ActiveReadFds);
-	struct timeval tv;
-	memset(&tv, 0x0, sizeof(struct timeval));
-	tv.tv_usec = 250000; //wait no more than .25 of a second.
-	int chk = select(0, &ActiveReadFds, NULL, NULL, &tv);
-	if (chk <= 0)
-	{
-#ifdef DEBUG_OUTPUT
-		fprintf(dl_output,"no data to read in ReadMSg()\n");
-#endif
-		set_has_read_data(FALSE);
-		return FALSE;
-	} 
-	len = recv(m_sock, temp_buff, buff_len, 0);
-	if (len == SOCKET_ERROR)
-    {
-#ifdef DEBUG_OUTPUT
-		fprintf(dl_output,"Client: Error receiving from socket: Error %d\n",WSAGetLastError());
-#endif
-		set_has_read_data(FALSE);
-        WSACleanup();
-		return FALSE;
-	} 
-	temp_buff[len] = '\0';
-	buff_len = strlen(temp_buff);
-	if ((set_read_buff(temp_buff, buff_len) == FALSE) | (buff_len == 0) | (len == SOCKET_ERROR))
+	DL_Lock m_Lock(&m_critsec);
+	struct m_toggle_type* tog = &m_toggle[toggle];
+	if ((tog->state == DLTS_PENDING) && (tog->on == on))
 	{
-		errmsg("set_read_buff returned FALSE in ReadMsg,\nor no data was read from the socket");
-		set_has_read_data(FALSE);
-		return FALSE;
+		return TRUE;
 	}
-	set_has_read_data(TRUE);
+	tog->state = DLTS_PENDING;
+	tog->on = on;
+	tog->sent = 0.00;
+	tog->tries = 0;
 	return TRUE;
 }
 
-/*! \brief Returns true if the gear is already up and false if it isn't.
-\return \b boolean
+/*! \brief Stops the toggle layer from driving a subsystem.
+\param toggle : the subsystem
+\note ToggleGear(), ToggleHook() and ToggleWEP() call this so a direct toggle isn't undone.
+*/
+void C_DeviceLink::CancelToggle(DLToggle toggle)
+{
+	if ((toggle < 0) || (toggle >= DLT_COUNT))
+	{
+		errmsg("CancelToggle called with an invalid subsystem.\n");
+		return;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	m_toggle[toggle].state = DLTS_IDLE;
+}
 
-\note Fails if queryfloat() fails or the gear is actually up.
+/*! \brief Moves every subsystem asked for with SetToggle() one step closer to its state.
+\return \b boolean : FALSE if a reading or the toggle packet failed. Call again next tick.
+\note Costs at most one query, for every subsystem that needs a newer reading, and one packet
+with every toggle that is due. Neither waits on a toggle to take effect. Only 0 and 1 count as
+a state; a subsystem reading in between, like the gear during travel, is left alone until it
+settles, however long that takes, so it is never toggled back mid-travel.
+*/
+bool C_DeviceLink::ToggleTick(void)
+{
+	bool flag = TRUE;
+	bool any = FALSE;
+	double now = MC_Timer::Now();
+	{
+	DL_Lock m_Lock(&m_critsec);
+	for (int t = 0; t < DLT_COUNT; ++t)
+	{
+		if (toggle_read_due(static_cast<DLToggle>(t), now) == TRUE)
+		{
+			m_pending[dl_toggles[t].param] |= 1;
+			any = TRUE;
+		}
+	}
+	}
+	if ((any == TRUE) && (RefreshPending() == FALSE))
+	{
+		flag = FALSE;
+	}
+	char keys[DL_MAX_QUERY - 2];
+	unsigned int len = 0;
+	memset(keys, 0, sizeof(keys));
+	now = MC_Timer::Now();
+	{
+	DL_Lock m_Lock(&m_critsec);
+	for (int t = 0; t < DLT_COUNT; ++t)
+	{
+		struct m_toggle_type* tog = &m_toggle[t];
+		DLParam param = dl_toggles[t].param;
+		double stamp = m_stamp[param][0];
+		if ((tog->state != DLTS_PENDING) || (stamp == 0.00))
+		{
+			continue;
+		}
+		float val = param_value(param, 0);
+		if (toggle_settled(val) == FALSE)
+		{
+			continue; //still moving. a toggle now would reverse it, so wait for it to settle
+		}
+		bool on = (val == 1.00f);
+		if (tog->sent == 0.00)
+		{
+			if ((now - stamp) > DL_GEAR_MAX_AGE)
+			{
+				continue;
+			}
+		} else if (stamp <= tog->sent)
+		{
+			continue;
+		} else if ((on != tog->on) && (((now - tog->sent) < m_toggle_timeout) || (stamp < (tog->sent + m_toggle_timeout))))
+		{
+			continue; //too early to call it lost
+		}
+		if (on == tog->on)
+		{
+			tog->state = DLTS_CONFIRMED;
+			continue;
+		}
+		if (tog->tries >= m_toggle_tries)
+		{
+			tog->state = DLTS_FAILED;
+			errmsg("ToggleTick gave up on a toggle that never took effect.\n");
+			continue;
+		}
+		if ((len + strlen(dl_toggles[t].code) + 1) >= sizeof(keys))
+		{
+			continue;
+		}
+		if (len > 0)
+		{
+			keys[len++] = DELIM_1;
+		}
+		dl_strncpy(keys + len, const_cast<char *>(dl_toggles[t].code), sizeof(keys) - len);
+		len += static_cast<unsigned int>(strlen(dl_toggles[t].code));
+		tog->sent = now;
+		++tog->tries;
+	}
+	}
+	if ((len > 0) && (SendCmd(keys) == FALSE))
+	{
+		errmsg("SendCmd failed in ToggleTick.\n");
+		flag = FALSE;
+	}
+	return flag;
+}
 
+/*! \brief Returns where the toggle layer is with a subsystem.
+\param toggle : the subsystem
+\return \b DLToggleState : DLTS_IDLE on an invalid subsystem
 */
-bool C_DeviceLink::Gear_Is_Up()
+DLToggleState C_DeviceLink::GetToggleState(DLToggle toggle)
 {
-	float fval = 0.00;
-	fval = queryfloat(DL_GET_GEAR_STATUS);
-	if (fval > 0.00)
+	if ((toggle < 0) || (toggle >= DLT_COUNT))
 	{
-		return FALSE;
-	} else if (fval < 0.00)
+		errmsg("GetToggleState called with an invalid subsystem.\n");
+		return DLTS_IDLE;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	return m_toggle[toggle].state;
+}
+
+/*! \brief Sets how patient the toggle layer is.
+\param timeout : ms a toggle has to show up in its get code before it counts as lost. Default DL_TOGGLE_TIMEOUT
+\param tries : most toggles sent for one SetToggle(). Default DL_TOGGLE_TRIES
+\note Make the timeout longer than the game's round trip or a slow toggle is sent twice.
+*/
+void C_DeviceLink::SetToggleTimeout(double timeout, int tries)
+{
+	DL_Lock m_Lock(&m_critsec);
+	if (timeout > 0.00)
 	{
-		errmsg("queryfloat returned an error. -1 was returned.\n");
-		return FALSE; 
-	} else
+		m_toggle_timeout = timeout;
+	}
+	if (tries > 0)
 	{
-		errmsg("Gear already up in Gear_Is_Up\n");
-		return TRUE;		
+		m_toggle_tries = tries;
 	}
 }
 
-/*! \brief Toggles the state of the landing gear
-\return \b boolean
+/*! \brief Loads the aircraft profile, i.e. DeviceLink version, plane id, cockpits and engines, in one query.
+\return \b boolean : FALSE if any of them didn't come back or is out of range
+\note GetDLVersion(), GetAircraftID(), GetNumOfCockpits() and GetNumEngines() answer from this
+profile and only call this when it isn't loaded or the plane has changed. Call it directly after
+a mission change if you don't want to wait for the next check. If the plane id differs from the
+previous profile every cached value, including the shared memory export and the switch bits, is
+marked as never received and anything queued by Prefetch() is dropped.
+\sa SetProfileCheck()
+*/
+bool C_DeviceLink::RefreshProfile(void)
+{
+	char reply[DL_MAX_REPLY];
+	char ver[sizeof(m_dl_ver)];
+	char plane[sizeof(m_plane)];
+	char val[16];
+	memset(ver, 0, sizeof(ver));
+	memset(plane, 0, sizeof(plane));
+	if (QueryRaw(DL_PROFILE, 4, reply, sizeof(reply)) < 4)
+	{
+		errmsg("QueryRaw did not return the whole profile in RefreshProfile.\n");
+		return FALSE;
+	}
+	if ((find_answer(reply, DL_GET_VERSION, ver, sizeof(ver)) == FALSE) || (find_answer(reply, DL_GET_PLANE, plane, sizeof(plane)) == FALSE))
+	{
+		errmsg("Version or plane missing from the reply in RefreshProfile.\n");
+		return FALSE;
+	}
+	memset(val, 0, sizeof(val));
+	find_answer(reply, DL_GET_COCKPITS, val, sizeof(val));
+	int cockpits = atoi(val);
+	memset(val, 0, sizeof(val));
+	find_answer(reply, DL_GET_ENGINES, val, sizeof(val));
+	int engines = atoi(val);
+	if ((cockpits <= 0) || (engines <= 0) || (engines > DL_MAX_ENGINES))
+	{
+		errmsg("Invalid number of cockpits or engines in RefreshProfile.\n");
+		return FALSE;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	shm_begin();
+	if ((m_plane[0] != '\0') && (strcmp(m_plane, plane) != 0))
+	{
+		//a different aircraft. nothing cached or queued for the old one applies
+		memset(m_stamp, 0, sizeof(m_stamp));
+		memset(m_pending, 0, sizeof(m_pending));
+		memset(m_att, 0, sizeof(m_att));
+		m_switches = 0;
+		m_switches_valid = 0;
+		if (m_shm != NULL)
+		{
+			memset(m_shm->stamp, 0, sizeof(m_shm->stamp));
+		}
+	}
+	dl_strncpy(m_dl_ver, ver, sizeof(m_dl_ver));
+	dl_strncpy(m_plane, plane, sizeof(m_plane));
+	m_num_cockpits = cockpits;
+	m_num_engines = engines;
+	m_profile_stamp = MC_Timer::Now();
+	m_profile_checked = m_profile_stamp;
+	shm_end();
+	return TRUE;
+}
 
-\note Toggles the gear setting and utilizes the toggleswitch() function.
+/*! \brief Forces the next profile getter to reload the whole aircraft profile.
+*/
+void C_DeviceLink::InvalidateProfile(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	m_profile_stamp = 0.00;
+}
 
+/*! \brief Sets how often the profile getters confirm the plane id with the game.
+\param period : ms between DL_GET_PLANE checks. Defaults to 1000. 0 turns the periodic check
+off so the profile only reloads on InvalidateProfile() or when an answer doesn't fit it.
 */
-bool C_DeviceLink::ToggleGear()
-{	
-	return toggleswitch(DL_SET_GEAR_STATUS);
+void C_DeviceLink::SetProfileCheck(double period)
+{
+	DL_Lock m_Lock(&m_critsec);
+	m_profile_check = period;
 }
 
-/*! \brief Sets the landing gear to be up.
-\return \b boolean
-\note Only fails when IsIntialized() fails. Executes ToggleGear()
-if Gear_Is_Up() returns a false.  
+/*! \brief Turns the control frame on or off.
+\param enable : TRUE to hold control writes until FlushControls(), FALSE to send each one straight away
+\note With the frame on, Set_Aileron(), Set_Elevator(), Set_Rudder(), Set_Brakes(), the trim setters,
+Set_Flaps(), Set_Power() and Set_PropPitch() only store the value and return TRUE. Call FlushControls()
+once per tick to send every changed control in one packet. Turning the frame off flushes anything pending.
+*/
+void C_DeviceLink::EnableControlFrame(bool enable)
+{
+	{
+	DL_Lock m_Lock(&m_critsec);
+	m_ctrl_frame = enable;
+	}
+	if (enable == FALSE)
+	{
+		FlushControls();
+	}
+}
 
+/*! \brief Sends every control written since the last flush in as few packets as possible, normally one.
+\return \b boolean : FALSE if a packet couldn't be sent. The values are dropped either way.
+\note Only the last value written to each control is sent. With EnablePiggyback() on, nothing is
+sent while the next PollTick() can still carry the pending controls inside the latency budget.
 */
-bool C_DeviceLink::SetGearUp()
+bool C_DeviceLink::FlushControls(void)
 {
-	if (Gear_Is_Up() == TRUE)
+	char keys[DL_MAX_QUERY - 2];
+	bool flag = TRUE;
+	double now = MC_Timer::Now();
+	bool piggy = FALSE;
+	double budget = 0.00;
+	drain_controls();
 	{
-		errmsg("Gear already up in SetGearUp\n");
-	} else
+	DL_Lock m_Lock(&m_critsec);
+	piggy = m_piggy;
+	budget = m_piggy_budget;
+	}
+	if (piggy == TRUE)
 	{
-		ToggleGear();
+		double due = NextPollDue();
+		double oldest = 0.00;
+		{
+		DL_Lock m_Lock(&m_critsec);
+		for (int c = 0; c < DLC_COUNT; ++c)
+		{
+			for (int eng = 0; eng < DL_MAX_ENGINES; ++eng)
+			{
+				if ((m_ctrl[c][eng].pending == TRUE) && ((oldest == 0.00) || (m_ctrl[c][eng].written < oldest)))
+				{
+					oldest = m_ctrl[c][eng].written;
+				}
+			}
+		}
+		}
+		if ((due >= 0.00) && (oldest != 0.00) && (((now - oldest) + due) <= budget))
+		{
+			return TRUE;
+		}
 	}
-	return TRUE;
+	int next = 0;
+	while (next < (DLC_COUNT * DL_MAX_ENGINES))
+	{
+		unsigned int len = 0;
+		memset(keys, 0, sizeof(keys));
+		if (pack_controls(keys, sizeof(keys), &len, &next, now) == 0)
+		{
+			break;
+		}
+		if (SendCmd(keys) == FALSE)
+		{
+			flag = FALSE;
+		}
+		DL_Lock m_Lock(&m_critsec);
+		++m_ctrl_packets;
+	}
+	if (flag == FALSE)
+	{
+		errmsg("SendCmd failed in FlushControls.\n");
+	}
+	return flag;
 }
 
-/*! \brief Sets the gear to be down
-\return \b boolean
+/*! \brief Reports how many control packets have been sent and how long values waited for them.
+\param stats : receives the statistics since the last ResetControlStats()
 */
-bool C_DeviceLink::SetGearDown()
+void C_DeviceLink::GetControlStats(DLControlStats* stats)
 {
-	if (Gear_Is_Up() == TRUE)
+	if (stats == NULL)
 	{
-		ToggleGear();
-	} else
+		errmsg("GetControlStats called with a NULL pointer.\n");
+		return;
+	}
+	memset(stats, 0, sizeof(DLControlStats));
+	double now = MC_Timer::Now();
+	DL_Lock m_Lock(&m_critsec);
+	stats->writes = m_ctrl_writes;
+	stats->packets = m_ctrl_packets;
+	stats->sent = m_ctrl_sent;
+	if (now > m_ctrl_since)
+	{
+		stats->send_rate = (static_cast<double>(m_ctrl_packets) * 1000.00) / (now - m_ctrl_since);
+	}
+	if (m_ctrl_sent > 0)
 	{
-		errmsg("Gear already down in SetGearDown\n");
+		stats->mean_latency = m_ctrl_sum_latency / static_cast<double>(m_ctrl_sent);
 	}
-	return TRUE;
+	stats->max_latency = m_ctrl_max_latency;
+	stats->filtered = m_ctrl_filtered;
+	stats->held = m_ctrl_held;
+	stats->refreshed = m_ctrl_refreshed;
+	stats->piggybacked = m_ctrl_piggybacked;
 }
 
-/*! \brief Takes the passed in code for querying a gear position and returns a float.
-\param gearcode : the specific gear code to query the server about
-\return \b float : the float position ranging from 0.0 to 1.0 of the current position of the gear
-\note This is for checking each individual wheel versus just an overall status. 
-Return of -1 means an error occurred in queryfloat().
+/*! \brief Clears the control statistics and restarts the send rate clock.
+*/
+void C_DeviceLink::ResetControlStats(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	m_ctrl_writes = 0;
+	m_ctrl_packets = 0;
+	m_ctrl_sent = 0;
+	m_ctrl_since = MC_Timer::Now();
+	m_ctrl_sum_latency = 0.00;
+	m_ctrl_max_latency = 0.00;
+	m_ctrl_filtered = 0;
+	m_ctrl_held = 0;
+	m_ctrl_refreshed = 0;
+	m_ctrl_piggybacked = 0;
+}
 
+/*! \brief Starts or stops copying every received value to the update queue.
+\param enable : TRUE to start queueing. FALSE stops; values already queued can still be read
+\note The receive path only pushes; it never waits for the application. Read the queue
+with PopUpdates() or DispatchUpdates() from one thread. Values that find it full are
+counted by GetDroppedUpdates() and lost, but still cached as usual.
 */
-float C_DeviceLink::GetGearPos(char* gearcode)
+void C_DeviceLink::EnableUpdateQueue(bool enable)
 {
-	float gearpos = 0.00;
-	gearpos = queryfloat(gearcode);
-	if (gearpos >= 0.00)
+	DL_Lock m_Lock(&m_critsec);
+	m_update_queue_on = enable;
+}
+
+/*! \brief Takes received values off the update queue, oldest first, without locking.
+\param recs : receives the values. key is the DLParam
+\param max : size of recs
+\return \b unsigned \b int : values returned. 0 when none are waiting
+\warning Only one thread may read the queue, through this or DispatchUpdates().
+*/
+unsigned int C_DeviceLink::PopUpdates(DLRecord* recs, unsigned int max)
+{
+	if (recs == NULL)
 	{
-		return gearpos;
+		return 0;
 	}
-	errmsg("GetGearPos:queryfloat returned a -1 to GetGearPos\n");
-	return -1.00;
+	return m_updates.PopBatch(recs, max);
 }
 
-/*! \brief send manual lower gear command
-\return \b boolean
+/*! \brief Sets the function DispatchUpdates() calls for each received value.
+\param callback : the function. NULL to stop calling one
+\param user : passed back to the callback
 */
-bool C_DeviceLink::ManualGearDown(void)
+void C_DeviceLink::SetUpdateCallback(DLUpdateCallback callback, void* user)
 {
-	return toggleswitch(DL_LOWER_GEAR_MAN);
+	DL_Lock m_Lock(&m_critsec);
+	m_update_cb = callback;
+	m_update_user = user;
 }
 
-/*! \brief send manual raise gear command
-\return \b boolean
+/*! \brief Empties the update queue into the callback set by SetUpdateCallback().
+\return \b unsigned \b int : values dispatched
+\note Runs the callback on the calling thread with no lock held, so it may call back
+into the library and take as long as it likes without holding up the receive path.
+\warning Only one thread may read the queue, through this or PopUpdates().
 */
-bool C_DeviceLink::ManualGearUp(void)
+unsigned int C_DeviceLink::DispatchUpdates(void)
 {
-	return toggleswitch(DL_RAISE_GEAR_MAN);
+	DLUpdateCallback callback = NULL;
+	void* user = NULL;
+	{
+	DL_Lock m_Lock(&m_critsec);
+	callback = m_update_cb;
+	user = m_update_user;
+	}
+	DLRecord recs[DL_QUEUE_BATCH];
+	unsigned int total = 0;
+	unsigned int cnt = 0;
+	while ((cnt = m_updates.PopBatch(recs, DL_QUEUE_BATCH)) > 0)
+	{
+		for (unsigned int i = 0; (i < cnt) && (callback != NULL); ++i)
+		{
+			callback(user, &recs[i]);
+		}
+		total += cnt;
+	}
+	return total;
+}
+
+/*! \brief Returns how many received values were lost because the update queue was full.
+\return \b unsigned \b long
+*/
+unsigned long C_DeviceLink::GetDroppedUpdates(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	return m_updates_dropped;
+}
+
+/*! \brief Lets control Set_ methods hand their values over without taking the session lock.
+\param enable : TRUE to queue control writes
+\note Only has an effect while EnableControlFrame() is on. Writes go into a lock-free queue
+that FlushControls() and PollTick() drain into the control frame, so an input thread never
+waits for a thread that is busy talking to the game. A write that finds the queue full
+drains it first, so values always reach the frame in the order they were written.
+*/
+void C_DeviceLink::EnableControlQueue(bool enable)
+{
+	if (enable == FALSE)
+	{
+		m_ctrl_queue_on = FALSE;
+		drain_controls();
+		return;
+	}
+	m_ctrl_queue_on = TRUE;
 }
-/*! \brief This reads in the config.ini file.
-\return \b boolean
-\todo I'm likely to rewrite this in the future. It's been written piecemeal 
-so it's sloppy. 
-\note It reads the config.ini file for the settings.
 
+/*! \brief Hands this session's update dispatch to a thread pool.
+\param exec : a started C_DLExecutor, shared by any number of sessions. NULL to stop using one
+\note While an executor is set, every packet that brings values queues one DispatchUpdates()
+on the pool, unless one is already waiting, so the update callback runs there instead of on
+the thread that read the socket. Needs EnableUpdateQueue() and SetUpdateCallback(). The
+session's work runs on a strand: in order and never on two workers at once, so the callback
+needs no locking of its own, while the sessions themselves spread over all the workers.
+Setting NULL, or another executor, first waits for the work already queued to finish.
 */
-bool C_DeviceLink::ReadConfig()
+void C_DeviceLink::SetExecutor(C_DLExecutor* exec)
 {
-#if _MSC_VER >= 1400
-	FILE *fp = NULL;
-	errno_t err = 0;
-	err = fopen_s(&fp, "config.ini", "r");
-	if (err != 0)
 	{
-		errmsg("Cannot open config file.\n");
-		exit(1);
+	DL_Lock m_Lock(&m_critsec);
+	if (exec == m_exec)
+	{
+		return;
 	}
-#else
-	FILE *fp = NULL;
-	fp = fopen("config.ini", "r");
-	if (fp == NULL)
+	m_exec = NULL;
+	}
+	m_strand.Wait();
+	DL_Lock m_Lock(&m_critsec);
+	m_exec = exec;
+	m_exec_pending = FALSE;
+}
+
+/*! \brief Queues a task on this session's strand of the executor set by SetExecutor().
+\param fn : the task, e.g. a derived computation over the cached values
+\param arg : passed to fn
+\return \b boolean : FALSE if no executor is set or the strand is full
+\note The task runs after every dispatch and task this session queued before it, and never
+alongside them.
+*/
+bool C_DeviceLink::Submit(DLTaskFunc fn, void* arg)
+{
+	C_DLExecutor* exec = NULL;
 	{
-		errmsg("Cannot open config file.\n");
-		exit(1);
+	DL_Lock m_Lock(&m_critsec);
+	exec = m_exec;
 	}
-#endif
-	char temp[80];
-	memset(temp, NULL, sizeof(temp));
-	fgets(temp, 19,fp);
-	if (temp[1] != 'D')
+	if (exec == NULL)
 	{
-		errmsg("Invalid config file\n");
-		fclose(fp);
+		errmsg("Submit called without an executor.\n");
 		return FALSE;
 	}
+	return exec->Submit(&m_strand, fn, arg);
+}
 
-	fgets(temp, 19, fp);
-	if (temp[0] == 'P')
+/*! \brief Queues a DispatchUpdates() on the executor if values are waiting and none is queued.
+*/
+void C_DeviceLink::exec_kick(void)
+{
+	C_DLExecutor* exec = NULL;
 	{
-		char* pdest = strstr(temp,"=") + 1;
-		if (pdest == NULL)
-		{
-			errmsg("Invalid IP address in config file.\n");
-			fclose(fp);
-			return FALSE;
-		}
-		m_port = static_cast<u_short>(atoi(pdest));
-		if ((m_port == 0) )
-		{
-			errmsg("Invalid port number in config file.\n");
-			fclose(fp);
-			return FALSE;
-		}
-	} else
+	DL_Lock m_Lock(&m_critsec);
+	if ((m_exec == NULL) || (m_exec_pending == TRUE) || (m_update_queue_on == FALSE) || (m_update_cb == NULL))
 	{
-		errmsg("Invalid config file\n");
-		fclose(fp);
-		return FALSE;
+		return;
 	}
-
-	fgets(temp,19,fp);
-	if (temp[0] == 'I')
+	if (m_updates.Size() == 0)
 	{
-		char* pdest = strstr(temp,"=") + 1;
-		if (pdest == NULL)
-		{
-			errmsg("Invalid IP address in config file.\n");
-			fclose(fp);
-			return FALSE;
-		}
-		dl_strncpy(m_game_ip,pdest,sizeof(m_game_ip));
-		if (m_game_ip[0] == NULL)
-		{
-			errmsg("Invalid IP address in config file.\n");
-			fclose(fp);
-			return FALSE;
-		}
-	} else
+		return;
+	}
+	exec = m_exec;
+	m_exec_pending = TRUE;
+	}
+	if (exec->Submit(&m_strand, exec_dispatch, this) == FALSE)
 	{
-		errmsg("Invalid config file\n");
-		fclose(fp);
-		return FALSE;
-	}	
+		DL_Lock m_Lock(&m_critsec);
+		m_exec_pending = FALSE; //the next packet tries again
+	}
+}
 
-	fclose(fp);
-	return TRUE;
+/*! \brief Executor task that runs DispatchUpdates() for one session.
+\param arg : the C_DeviceLink
+*/
+void C_DeviceLink::exec_dispatch(void* arg)
+{
+	C_DeviceLink* dl = static_cast<C_DeviceLink*>(arg);
+	{
+	DL_Lock m_Lock(&dl->m_critsec);
+	dl->m_exec_pending = FALSE; //cleared first, so values arriving from here on queue another dispatch
+	}
+	dl->DispatchUpdates();
 }
 
-/*! \brief Returns the Initialized state in a bool. Utilizes MC_Lock for thread safety.
-\return \b boolean
+/*! \brief Turns the contention counters of this session's lock on or off.
+\param enable : TRUE to start counting
+\note Off by default. Shows how often threads sharing this session wait for each other.
+\sa GetLockStats()
+*/
+void C_DeviceLink::EnableLockStats(bool enable)
+{
+	m_critsec.EnableStats(enable);
+}
 
+/*! \brief Copies the contention counters of this session's lock.
+\param stats : receives the acquisitions, contended acquisitions and wait times
 */
-bool C_DeviceLink::IsInitialized()
+void C_DeviceLink::GetLockStats(MC_LockStats* stats)
 {
-	MC_Lock m_Lock(&my_critsec);
-	return m_initialized;
+	m_critsec.GetStats(stats);
 }
 
-/*! \brief This is the public method for querying the devicelink server and reading a response.
-\param code : devicelink defined code to send the server and expect a response
-\return \b boolean
-\note It takes the string passed in by code and calls SendMsg() to send the 'R' query and then a ReadMsg() to get the response. 
+/*! \brief Zeroes the contention counters of this session's lock.
 */
-bool C_DeviceLink::QueryMsg(const char* code)
+void C_DeviceLink::ResetLockStats(void)
+{
+	m_critsec.ResetStats();
+}
+
+/*! \brief Lets pending controls ride along on the next poll packet instead of their own.
+\param enable : TRUE to hold controls for the next poll packet, FALSE to send them from FlushControls() again
+\param budget : longest a control may wait for a poll packet in milliseconds
+\note The game takes get and set codes mixed in one R packet, so a tick that polls and steers costs
+one packet instead of two. FlushControls() only holds the controls when NextPollDue() says a poll comes
+within the budget; otherwise it sends them at once. PollTick() sends any that were held past the budget
+or didn't fit. Turning piggyback off flushes anything pending.
+*/
+void C_DeviceLink::EnablePiggyback(bool enable, double budget)
+{
+	{
+	DL_Lock m_Lock(&m_critsec);
+	m_piggy = enable;
+	if (budget >= 0.00)
+	{
+		m_piggy_budget = budget;
+	}
+	}
+	if (enable == FALSE)
+	{
+		FlushControls();
+	}
+}
+
+/*! \brief Sets the output policy FlushControls() applies to a control before sending it.
+\param ctrl : the control. Power and prop pitch apply it to every engine
+\param policy : the new policy. All zeros sends every write, which is the default
+\return \b boolean : FALSE on an invalid control or negative setting
+\note A held value is only sent by a later FlushControls(), so with min_interval, max_rate or
+refresh set, call FlushControls() every tick even when nothing new was written.
+*/
+bool C_DeviceLink::SetControlPolicy(DLControl ctrl, const DLControlPolicy* policy)
 {
-	//send the query string and read the subsequent response.
-	if (set_command_buff(code) == FALSE)
+	if ((ctrl < 0) || (ctrl >= DLC_COUNT) || (policy == NULL))
 	{
-		errmsg("set_command_buff returned FALSE in QueryMsg.\n");
+		errmsg("SetControlPolicy called with an invalid parameter.\n");
 		return FALSE;
 	}
-	if (SendMsg() == TRUE)
+	if ((policy->deadband < 0.00f) || (policy->min_interval < 0.00) || (policy->max_rate < 0.00) || (policy->refresh < 0.00))
 	{
-		if(ReadMsg() == TRUE)
-		{
-			if (HasData() == TRUE)
-			{
-				return TRUE;
-			} else
-			{
-				errmsg("No data read from socket. Server may not be up\n");
-				return FALSE;
-			}
-		} else
-		{
-			errmsg("Read failed. No data read from socket. Server may not be up\n");
-			return FALSE;
-		}
-	} else
-	{	
-		errmsg("Catastrophic socket failure. SendMsg failed.\n");
-		set_has_read_data(FALSE);
+		errmsg("SetControlPolicy called with a negative setting.\n");
 		return FALSE;
 	}
-
+	DL_Lock m_Lock(&m_critsec);
+	m_ctrl_policy[ctrl] = *policy;
+	return TRUE;
 }
 
-/*! \brief Return a flag status set when data has actually been received from the game.
-\return \b boolean
+/*! \brief Returns the output policy of a control.
+\param ctrl : the control
+\param policy : receives the policy
+\return \b boolean : FALSE on an invalid parameter
 */
-bool C_DeviceLink::HasData()
+bool C_DeviceLink::GetControlPolicy(DLControl ctrl, DLControlPolicy* policy)
 {
-	MC_Lock m_Lock(&my_critsec);
-	return m_readdata;
+	if ((ctrl < 0) || (ctrl >= DLC_COUNT) || (policy == NULL))
+	{
+		errmsg("GetControlPolicy called with an invalid parameter.\n");
+		return FALSE;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	*policy = m_ctrl_policy[ctrl];
+	return TRUE;
 }
 
-/*! \brief Get the version of DeviceLink you are running from the game.
-\param verstr : is where you are going to store the result
-\param buff_size : is the size of verstr to be passed in
-\return \b boolean
-\warning verstr must be allocated by calling routine and must be at least 64 bytes!
-\warning buff_size must be passed in and be sizeof(verstr) in calling routine!
-
+/*! \brief Publishes the cache to a shared memory segment so other processes can read it.
+\param name : segment name. Defaults to DL_SHM_NAME
+\return \b boolean : FALSE if the segment can't be created
+\note Once exporting, every value received from the game is copied into the segment
+as it is cached, and a whole A packet is published as one update. Other processes open
+it with C_DeviceLinkShm and never send anything to the game themselves, so only this
+process should poll.
+\sa CloseShm()
 */
-bool C_DeviceLink::GetDLVersion(char* verstr, unsigned int buff_size)
+bool C_DeviceLink::ExportShm(const char* name)
 {
-	if (buff_size < sizeof(m_dl_ver))
+	if ((name == NULL) || (strlen(name) >= sizeof(m_shm_name)))
 	{
-		errmsg("Calling routine allocated insuffcient buffer. Must be at least 64 bytes!\n");
+		errmsg("ExportShm called with an invalid name.\n");
 		return FALSE;
 	}
-	if (querystring(DL_GET_VERSION, m_dl_ver, sizeof(m_dl_ver)) == TRUE)
+	CloseShm();
+	void* handle = NULL;
+	DL_ShmSnapshot* shm = dl_shm_create(name, &handle);
+	if (shm == NULL)
 	{
-		dl_strncpy(verstr, m_dl_ver, buff_size);
-		return TRUE;
+		errmsg("dl_shm_create failed in ExportShm.\n");
+		return FALSE;
 	}
-	errmsg("querystring returned FALSE to GetDLVersion.\n");
-	return FALSE;
+	DL_Lock m_Lock(&m_critsec);
+	memset(shm, 0, sizeof(DL_ShmSnapshot));
+	shm->version = DL_SHM_VERSION;
+	shm->size = sizeof(DL_ShmSnapshot);
+	shm->num_params = DLP_COUNT;
+	shm->max_engines = DL_MAX_ENGINES;
+	m_shm = shm;
+	m_shm_handle = handle;
+	m_shm_depth = 0;
+	dl_strncpy(m_shm_name, const_cast<char *>(name), sizeof(m_shm_name));
+	shm_begin();
+	for (int i = 0; i < DLP_COUNT; ++i)
+	{
+		for (int eng = 0; eng < DL_MAX_ENGINES; ++eng)
+		{
+			m_shm->value[i][eng] = param_value(static_cast<DLParam>(i), eng);
+			m_shm->stamp[i][eng] = m_stamp[i][eng];
+		}
+	}
+	shm_end();
+	m_shm->magic = DL_SHM_MAGIC; //last, so a reader never sees a half initialized segment as valid
+	return TRUE;
 }
 
-/*! \brief Verifies that a Get command exists for the associated code.
-\param code : the command code you are checking to see if it has a Get equivalent
-\return \b boolean
-
+/*! \brief Stops exporting and removes the shared memory segment.
+\note Readers that still have it mapped keep the last values. Safe to call when not exporting.
 */
-bool C_DeviceLink::ValidGet(const char* code)
+void C_DeviceLink::CloseShm(void)
 {
-	char newcode[64];
-	char temp[64];
-	memset(temp, NULL,sizeof(temp));
-	memset(newcode, NULL,sizeof(newcode));
-#if _MSC_VER >= 1400
-	_snprintf_s(newcode,sizeof(newcode),_TRUNCATE,"%s%c%s",DL_ACCESS_GET,DELIM_2,code);
-#else
-	_snprintf(newcode,sizeof(newcode),"%s%c%s",DL_ACCESS_GET,DELIM_2,code);
-#endif
-
-	if (querystring(newcode, temp, sizeof(temp)) == TRUE)
+	DL_Lock m_Lock(&m_critsec);
+	if (m_shm == NULL)
 	{
-		return TRUE;
+		return;
 	}
-	return FALSE;
+	dl_shm_close(m_shm, m_shm_handle, m_shm_name, TRUE);
+	m_shm = NULL;
+	m_shm_handle = NULL;
+	m_shm_depth = 0;
+	memset(m_shm_name, 0, sizeof(m_shm_name));
 }
 
 /*! \brief Get the Time of Day
@@ -1109,18 +4005,17 @@ float C_DeviceLink::GetTOD()
 */
 bool C_DeviceLink::GetAircraftID(char *ac, unsigned int buff_size)
 {	
-	char temp[64];
-	memset(temp, NULL, sizeof(temp));
-	if (buff_size < sizeof(temp))
+	if (buff_size < sizeof(m_plane))
 	{	
 		errmsg("Insuffcient buffer allocated for aircraft type name.  Must be at least 64 bytes.\n");
 		return FALSE;
 	}
-	if (querystring(DL_GET_PLANE, temp, buff_size) == TRUE)
+	if (check_profile() == TRUE)
 	{
-		//copy temp into the buffer pointed to by ac but let's be safe and
+		//copy the cached id into the buffer pointed to by ac but let's be safe and
 		//do a sanity check on ac while we are at it.
-		dl_strncpy(ac, temp, buff_size);
+		DL_Lock m_Lock(&m_critsec);
+		dl_strncpy(ac, m_plane, buff_size);
 		return TRUE;
 	}
 	return FALSE;
@@ -1143,6 +4038,17 @@ float C_DeviceLink::Get_Overload(void)
 	return queryfloat(DL_GET_OVERLOAD);
 }
 
+/*! \brief Returns the cached overload value, refreshing it first if it is older than max_age.
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : range is MININT to MAXINT
+*/
+float C_DeviceLink::Get_Overload(double max_age)
+{
+	refresh_if_stale(DLP_OVERLOAD, max_age);
+	DL_Lock m_Lock(&m_critsec);
+	return m_overload;
+}
+
 /*! \brief returns the current shake float value
 /return \b float : range is 0 to 1
 
@@ -1159,12 +4065,29 @@ float C_DeviceLink::Get_ShakeLvl(void)
 	}
 	return fval;
 }
+
+/*! \brief Returns the cached shake level, refreshing it first if it is older than max_age.
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : range is 0 to 1
+*/
+float C_DeviceLink::Get_ShakeLvl(double max_age)
+{
+	refresh_if_stale(DLP_SHAKE, max_age);
+	DL_Lock m_Lock(&m_critsec);
+	return m_shake;
+}
 /*! \brief Returns the number of cockpits in the aircraft
 \return \b integer : number of cockpits in the aircraft
 */
 int C_DeviceLink::GetNumOfCockpits()
 {
-	return queryint(DL_GET_COCKPITS);
+	if (check_profile() == FALSE)
+	{
+		errmsg("check_profile failed in GetNumOfCockpits.\n");
+		return -1;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	return m_num_cockpits;
 }
 
 /*! \brief Toggle the state of the Nav lights.
@@ -1209,6 +4132,7 @@ bool C_DeviceLink::ToggleBombSight(void)
 */
 bool C_DeviceLink::ToggleHook(void)
 {
+	CancelToggle(DLT_HOOK);
 	return toggleswitch(DL_TOGGLE_HOOK);
 }
 /*! \brief increases the angle of the bombsight
@@ -1284,7 +4208,7 @@ bool C_DeviceLink::Query_GunPods(void)
 		errmsg("queryfloat returned an error in Query_GunPods.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_gunpod = ival;
 	return TRUE;
 }
@@ -1304,6 +4228,16 @@ int C_DeviceLink::GetGunPodsState(void)
 {
 	return m_gunpod;
 }
+
+/*! \brief returns the Gunpod state, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b integer : 0 is off and 1 is on
+*/
+int C_DeviceLink::GetGunPodsState(double max_age)
+{
+	refresh_if_stale(DLP_GUNPOD, max_age);
+	return GetGunPodsState();
+}
 /*! \brief Start Engine one. Actually, it selects the engine, toggles it, then selects all.
 \return \b boolean
 */
@@ -1342,7 +4276,7 @@ bool C_DeviceLink::StartEng4()
 */
 int C_DeviceLink::GetMags(const int eng_num)
 {
-	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_FOUR))
+	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_EIGHT))
 	{
 		errmsg("GetMags called with invalid engine number.\n");
 		return -1;
@@ -1364,6 +4298,22 @@ int C_DeviceLink::GetMags(const int eng_num)
 	return ival;
 }
 
+/*! \brief Returns the stored magneto setting of the indexed engine
+\param eng_num : the index of the engine
+\return \b integer : magneto setting 0-3 or -1 for an invalid engine
+\note This value is set by SetAllEngineData()
+*/
+int C_DeviceLink::Get_Magneto(const int eng_num)
+{
+	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_EIGHT))
+	{
+		errmsg("Get_Magneto called with invalid engine number.\n");
+		return -1;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	return m_engine.magneto[eng_num];
+}
+
 /*! \brief Feather the selected engine
 \return \b boolean
 \warning You must call the appropriate select engine prior to calling this. Otherwise
@@ -1388,14 +4338,13 @@ bool C_DeviceLink::FeatherEngine(void)
 */
 int C_DeviceLink::GetNumEngines(void)
 {
-	int ival = 0;
-	ival = queryint(DL_GET_ENGINES);
-	if ((ival <= 0) || (ival > 8))
+	if (check_profile() == FALSE)
 	{
-		errmsg("Invalid number of Mags returned from queryint(DL_GET_MAG).\n");
+		errmsg("check_profile failed in GetNumEngines.\n");
 		return -1;
 	}
-	return ival;
+	DL_Lock m_Lock(&m_critsec);
+	return m_num_engines;
 }
 
 /*! \brief Select/unselect Engine 1
@@ -1535,19 +4484,16 @@ bool C_DeviceLink::ToggleSelEng4(void)
 	return toggleswitch(DL_TOGGLE_ENG4_SELECT);
 }
 /*! \brief This function will populate the private engine data structure of the passed engine number. 
-\param eng_num : the engine index (0-3) you want to get data for
+\param eng_num : the engine index (0-7) you want to get data for
 \return \b boolean
 */
 bool C_DeviceLink::Set_Engine_Data(const int eng_num)
 {
-	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_FOUR))
+	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_EIGHT))
 	{
 		errmsg("Set_Engine_Data called with invalid engine number.\n");
 		return FALSE;
 	}
-	//since the response from the server will include engine num we need to set
-	//the parameter parser to 2.
-	m_ret_cnt = 2;
 	/********************************************************
 	* We are going to make a special call to devicelink to  *
 	* take advantage of the multiple query on a line aspect *
@@ -1561,20 +4507,44 @@ bool C_DeviceLink::Set_Engine_Data(const int eng_num)
 #else
 	_snprintf(temp_cmd,sizeof(temp_cmd),"64\\%d/66\\%d/68\\%d/70\\%d/72\\%d/74\\%d\0",eng_num,eng_num,eng_num,eng_num,eng_num,eng_num);
 #endif
-	if ( QueryMsg(temp_cmd) == FALSE )
+	//parse_reply() stores and stamps each of the six values as it arrives
+	if (QueryRaw(temp_cmd, 6, NULL, 0) < 6)
 	{
-		errmsg("QueryMsg returned false in Set_Engine_Data.\n");
+		errmsg("QueryRaw did not return all the engine data in Set_Engine_Data.\n");
 		return FALSE;
 	}
+	return TRUE;
+}
 
-	MC_Lock m_Lock(&my_critsec);
-	getval(DL_GET_MANIFOLD,&m_engine[eng_num].manifold);
-	getval(DL_GET_TEMP_WATER,&m_engine[eng_num].temp_water);
-	getval(DL_GET_TEMP_OILOUT,&m_engine[eng_num].temp_oilout);
-	getval(DL_GET_TEMP_OILIN,&m_engine[eng_num].temp_oilin);
-	getval(DL_GET_TEMP_CYL,&m_engine[eng_num].temp_cylinders);
-	getval(DL_GET_RPM,&m_engine[eng_num].rpm);
-	m_ret_cnt = 1;
+/*! \brief Populates the private engine data of every engine in the aircraft in one query.
+\return \b boolean : FALSE if any value didn't come back
+\note Fetches RPM, manifold, oil in/out, water and cylinder temperatures, power, prop pitch
+and magneto for each engine. The packet only holds as many engines as GetNumEngines() reports,
+which is asked once and remembered. Use the Get_ engine methods to read the results.
+\sa Set_Engine_Data()
+*/
+bool C_DeviceLink::SetAllEngineData(void)
+{
+	int num = GetNumEngines();
+	if (num <= 0)
+	{
+		errmsg("GetNumEngines failed in SetAllEngineData.\n");
+		return FALSE;
+	}
+	for (int eng = 0; eng < num; ++eng)
+	{
+		for (int i = DLP_RPM; i <= DLP_MAGNETO; ++i)
+		{
+			Prefetch(static_cast<DLParam>(i), 0.00, eng);
+		}
+	}
+	if (RefreshPending() == FALSE)
+	{
+		//fewer answers than engines may mean the plane changed. recheck it next time
+		DL_Lock m_Lock(&m_critsec);
+		m_profile_checked = 0.00;
+		return FALSE;
+	}
 	return TRUE;
 }
 
@@ -1584,7 +4554,7 @@ bool C_DeviceLink::Set_Engine_Data(const int eng_num)
 */
 bool C_DeviceLink::Set_RPM(const int eng_num)
 {
-	return setengfloats(eng_num, DL_GET_RPM, &m_engine[eng_num].rpm);
+	return setengfloats(eng_num, DL_GET_RPM, &m_engine.rpm[eng_num]);
 }
 /*! \brief Returns the stored RPMs in float from indexed engine
 \param eng_num : the index of the engine you want to query the server for
@@ -1592,7 +4562,18 @@ bool C_DeviceLink::Set_RPM(const int eng_num)
 */
 float C_DeviceLink::Get_RPM(const int eng_num)
 {
-	return getengfloats(eng_num, &m_engine[eng_num].rpm);
+	return getengfloats(eng_num, &m_engine.rpm[eng_num]);
+}
+
+/*! \brief Returns the stored RPM of the indexed engine, refreshing it first if it is older than max_age
+\param eng_num : the index of the engine
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : the stored RPM
+*/
+float C_DeviceLink::Get_RPM(const int eng_num, double max_age)
+{
+	refresh_if_stale(DLP_RPM, max_age, eng_num);
+	return Get_RPM(eng_num);
 }
 /*! \brief Sets the internal structure of the cylinder temp
 \param eng_num : the index of the engine you want to query the server for
@@ -1600,7 +4581,7 @@ float C_DeviceLink::Get_RPM(const int eng_num)
 */
 bool C_DeviceLink::Set_Temp_Cyl(const int eng_num)
 {
-	return setengfloats(eng_num, DL_GET_TEMP_CYL, &m_engine[eng_num].temp_cylinders);
+	return setengfloats(eng_num, DL_GET_TEMP_CYL, &m_engine.temp_cylinders[eng_num]);
 }
 
 /*! \brief Returns the stored Cylinder temperature (Celsius) in float from indexed engine
@@ -1609,7 +4590,18 @@ bool C_DeviceLink::Set_Temp_Cyl(const int eng_num)
 */
 float C_DeviceLink::Get_Temp_Cyl(const int eng_num)
 {
-	return getengfloats(eng_num,&m_engine[eng_num].temp_cylinders);
+	return getengfloats(eng_num,&m_engine.temp_cylinders[eng_num]);
+}
+
+/*! \brief Returns the stored cylinder temperature (Celsius) of the indexed engine, refreshing it first if it is older than max_age
+\param eng_num : the index of the engine
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : the stored cylinder temperature (Celsius)
+*/
+float C_DeviceLink::Get_Temp_Cyl(const int eng_num, double max_age)
+{
+	refresh_if_stale(DLP_TEMP_CYL, max_age, eng_num);
+	return Get_Temp_Cyl(eng_num);
 }
 
 /*! \brief Sets the Oil In temp in (Celsius) from the indexed engine.
@@ -1618,7 +4610,7 @@ float C_DeviceLink::Get_Temp_Cyl(const int eng_num)
 */
 bool C_DeviceLink::Set_Temp_Oilin(const int eng_num)
 {
-	return setengfloats(eng_num, DL_GET_TEMP_OILIN, &m_engine[eng_num].temp_oilin);
+	return setengfloats(eng_num, DL_GET_TEMP_OILIN, &m_engine.temp_oilin[eng_num]);
 }
 
 /*! \brief Returns the stored Oil in temperature (Celsius) in float from indexed engine
@@ -1629,7 +4621,18 @@ bool C_DeviceLink::Set_Temp_Oilin(const int eng_num)
 */
 float C_DeviceLink::Get_Temp_Oilin(const int eng_num)
 {
-	return getengfloats(eng_num,&m_engine[eng_num].temp_oilin);
+	return getengfloats(eng_num,&m_engine.temp_oilin[eng_num]);
+}
+
+/*! \brief Returns the stored oil in temperature (Celsius) of the indexed engine, refreshing it first if it is older than max_age
+\param eng_num : the index of the engine
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : the stored oil in temperature (Celsius)
+*/
+float C_DeviceLink::Get_Temp_Oilin(const int eng_num, double max_age)
+{
+	refresh_if_stale(DLP_TEMP_OILIN, max_age, eng_num);
+	return Get_Temp_Oilin(eng_num);
 }
 /*! \brief Sets the stored Oil Out temp (Celsius) from the indexed engine.
 \param eng_num : the index of the engine you want to query the server for
@@ -1638,7 +4641,7 @@ float C_DeviceLink::Get_Temp_Oilin(const int eng_num)
 */
 bool C_DeviceLink::Set_Temp_Oilout(const int eng_num)
 {
-	return setengfloats(eng_num, DL_GET_TEMP_OILOUT, &m_engine[eng_num].temp_oilout);
+	return setengfloats(eng_num, DL_GET_TEMP_OILOUT, &m_engine.temp_oilout[eng_num]);
 }
 
 /*! \brief Returns the stored Oil Out temperature (Celsius) in float from indexed engine
@@ -1650,7 +4653,18 @@ bool C_DeviceLink::Set_Temp_Oilout(const int eng_num)
 */
 float C_DeviceLink::Get_Temp_Oilout(const int eng_num)
 {
-	return getengfloats(eng_num,&m_engine[eng_num].temp_oilout);
+	return getengfloats(eng_num,&m_engine.temp_oilout[eng_num]);
+}
+
+/*! \brief Returns the stored oil out temperature (Celsius) of the indexed engine, refreshing it first if it is older than max_age
+\param eng_num : the index of the engine
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : the stored oil out temperature (Celsius)
+*/
+float C_DeviceLink::Get_Temp_Oilout(const int eng_num, double max_age)
+{
+	refresh_if_stale(DLP_TEMP_OILOUT, max_age, eng_num);
+	return Get_Temp_Oilout(eng_num);
 }
 /*! \brief Sets water temp in (Celsius) from the indexed engine.
 \param eng_num : the index of the engine you want to query the server for
@@ -1659,7 +4673,7 @@ float C_DeviceLink::Get_Temp_Oilout(const int eng_num)
 */
 bool C_DeviceLink::Set_Temp_Water(const int eng_num)
 {
-	return setengfloats(eng_num, DL_GET_TEMP_WATER, &m_engine[eng_num].temp_water);
+	return setengfloats(eng_num, DL_GET_TEMP_WATER, &m_engine.temp_water[eng_num]);
 }
 
 /*! \brief Returns the stored Water temperature (Celsius) in float from indexed engine
@@ -1669,7 +4683,18 @@ bool C_DeviceLink::Set_Temp_Water(const int eng_num)
 */
 float C_DeviceLink::Get_Temp_Water(const int eng_num)
 {
-	return getengfloats(eng_num,&m_engine[eng_num].temp_water);
+	return getengfloats(eng_num,&m_engine.temp_water[eng_num]);
+}
+
+/*! \brief Returns the stored water temperature (Celsius) of the indexed engine, refreshing it first if it is older than max_age
+\param eng_num : the index of the engine
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : the stored water temperature (Celsius)
+*/
+float C_DeviceLink::Get_Temp_Water(const int eng_num, double max_age)
+{
+	refresh_if_stale(DLP_TEMP_WATER, max_age, eng_num);
+	return Get_Temp_Water(eng_num);
 }
 
 /*! \brief Sets the stored manifold pressure from the indexed engine by querying the game.
@@ -1679,7 +4704,7 @@ float C_DeviceLink::Get_Temp_Water(const int eng_num)
 */
 bool C_DeviceLink::Set_Manifold(const int eng_num)
 {
-	return setengfloats(eng_num, DL_GET_MANIFOLD, &m_engine[eng_num].manifold);
+	return setengfloats(eng_num, DL_GET_MANIFOLD, &m_engine.manifold[eng_num]);
 }
 
 /*! \brief Returns the stored manifold pressure in float from indexed engine
@@ -1691,7 +4716,18 @@ bool C_DeviceLink::Set_Manifold(const int eng_num)
 */
 float C_DeviceLink::Get_Manifold(const int eng_num)
 {
-	return getengfloats(eng_num,&m_engine[eng_num].manifold);
+	return getengfloats(eng_num,&m_engine.manifold[eng_num]);
+}
+
+/*! \brief Returns the stored manifold pressure of the indexed engine, refreshing it first if it is older than max_age
+\param eng_num : the index of the engine
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : the stored manifold pressure
+*/
+float C_DeviceLink::Get_Manifold(const int eng_num, double max_age)
+{
+	refresh_if_stale(DLP_MANIFOLD, max_age, eng_num);
+	return Get_Manifold(eng_num);
 }
 
 /*! \brief increase super charger to next stage.
@@ -1701,18 +4737,13 @@ float C_DeviceLink::Get_Manifold(const int eng_num)
 */
 bool C_DeviceLink::SuperChgNxt(const int eng_num)
 {
-	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_FOUR))
+	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_EIGHT))
 	{
 		errmsg("SuperChgNxt called with invalid engine number.\n");
 		return FALSE;
 	}
 
-	if (set_command_buff(DL_SET_CHRG_NXT) == FALSE)
-	{
-		errmsg("set_command_buff returned FALSE in SuperChgNxt.\n");
-		return FALSE;
-	}	
-	return SendMsg();
+	return toggleswitch(DL_SET_CHRG_NXT);
 }
 
 /*! \brief increase super charger to prev stage.
@@ -1722,18 +4753,13 @@ bool C_DeviceLink::SuperChgNxt(const int eng_num)
 */
 bool C_DeviceLink::SuperChgPrv(const int eng_num)
 {
-	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_FOUR))
+	if ((eng_num < ENGINE_ONE) | (eng_num > ENGINE_EIGHT))
 	{
 		errmsg("SuperChgNxt called with invalid engine number.\n");
 		return FALSE;
 	}
 
-	if (set_command_buff(DL_SET_CHRG_PREV) == FALSE)
-	{
-		errmsg("set_command_buff returned FALSE in SuperChgPrev.\n");
-		return FALSE;
-	}	
-	return SendMsg();
+	return toggleswitch(DL_SET_CHRG_PREV);
 }
 
 /*! \brief Gets the current state of the WEP of selected engine
@@ -1744,20 +4770,33 @@ int C_DeviceLink::Get_WEP(void)
 {
 	int ival = 0;
 	ival = queryint(DL_GET_WEP);
-	if (ival <= 0)
+	if ((ival < 0) || (ival > 1))
 	{
-		errmsg("Invalid WEP state returned from queryint(DL_GET_MAG).\n");
+		errmsg("Invalid WEP state returned from queryint(DL_GET_WEP).\n");
 		return -1;
 	}
 	return ival;
 }
 
+/*! \brief Returns the stored WEP state of the selected engine, refreshing it first if it is older than max_age
+\param max_age : oldest acceptable value in milliseconds
+\return \b int : 0 is off, 1 is on
+\note must select engine first!
+*/
+int C_DeviceLink::Get_WEP(double max_age)
+{
+	refresh_if_stale(DLP_WEP, max_age);
+	DL_Lock m_Lock(&m_critsec);
+	return m_wep;
+}
+
 /*! \brief Toggle the WEP state
 
 \note must select engine first!
 */
 bool C_DeviceLink::ToggleWEP(void)
 {
+	CancelToggle(DLT_WEP);
 	return toggleswitch(DL_TOGGLE_WEP);
 }
 
@@ -1774,7 +4813,7 @@ bool C_DeviceLink::Set_Alt(void)
 		errmsg("queryfloat returned an error in Set_Alt.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_alt = fval;
 	return TRUE;
 }
@@ -1784,10 +4823,21 @@ bool C_DeviceLink::Set_Alt(void)
 */
 float C_DeviceLink::Get_Alt(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_alt;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : Altitude in meters
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Alt(double max_age)
+{
+	refresh_if_stale(DLP_ALT, max_age);
+	return Get_Alt();
+}
+
 /*! \brief Sets the angular speed
 \return \b boolean
 
@@ -1796,17 +4846,28 @@ void C_DeviceLink::Set_AngSpd(void)
 {
 	float fval = 0.00;
 	fval = queryfloat(DL_GET_ANG_SPD);
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_ang_spd = fval;
 }
 
-/*! \brief returns the angular speed
+/*! \brief returns the angular speed
+\return \b float : Angular Speed in degrees per second
+*/
+float C_DeviceLink::Get_AngSpd(void)
+{
+	DL_Lock m_Lock(&m_critsec);
+	return m_ang_spd;
+}
+
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
 \return \b float : Angular Speed in degrees per second
+\sa Prefetch()
 */
-float C_DeviceLink::Get_AngSpd(void)
+float C_DeviceLink::Get_AngSpd(double max_age)
 {
-	MC_Lock m_Lock(&my_critsec);
-	return m_ang_spd;
+	refresh_if_stale(DLP_ANG_SPD, max_age);
+	return Get_AngSpd();
 }
 
 /*! \brief Sets the Azimuth
@@ -1822,7 +4883,7 @@ bool C_DeviceLink::Set_Azimuth(void)
 		errmsg("queryfloat returned a bad value in Set_Azimuth.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_azimuth = fval;
 	return TRUE;
 }
@@ -1832,10 +4893,21 @@ bool C_DeviceLink::Set_Azimuth(void)
 */
 float C_DeviceLink::Get_Azimuth(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_azimuth;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : Azimuth in degrees 0-359.9
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Azimuth(double max_age)
+{
+	refresh_if_stale(DLP_AZI, max_age);
+	return Get_Azimuth();
+}
+
 /*! \brief Sets the beacon azimuth
 \return \b boolean
 
@@ -1849,7 +4921,7 @@ bool C_DeviceLink::Set_BeaconAzimuth(void)
 		errmsg("queryfloat returned a bad value in Set_BeaconAzimuth.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_beacon_azimuth = fval;
 	return TRUE;
 }
@@ -1859,10 +4931,21 @@ bool C_DeviceLink::Set_BeaconAzimuth(void)
 */
 float C_DeviceLink::Get_BeaconAzimuth(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_beacon_azimuth;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : Beacon Azimuth in degrees 0-359.9
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_BeaconAzimuth(double max_age)
+{
+	refresh_if_stale(DLP_BEACON_AZI, max_age);
+	return Get_BeaconAzimuth();
+}
+
 /*! \brief Sets the IAS
 \return \b boolean
 
@@ -1876,7 +4959,7 @@ bool C_DeviceLink::Set_IAS(void)
 		errmsg("queryfloat returned an error in Set_IAS.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_ias = fval;
 	return TRUE;
 }
@@ -1886,10 +4969,21 @@ bool C_DeviceLink::Set_IAS(void)
 */
 float C_DeviceLink::Get_IAS(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_ias;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : IAS in km/h
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_IAS(double max_age)
+{
+	refresh_if_stale(DLP_IAS, max_age);
+	return Get_IAS();
+}
+
 /*! \brief Sets the Pitch
 \return \b boolean
 
@@ -1903,7 +4997,7 @@ bool C_DeviceLink::Set_Pitch(void)
 		errmsg("queryfloat returned a bad value in Set_Pitch.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_pitch = fval;
 	return TRUE;
 }
@@ -1913,10 +5007,21 @@ bool C_DeviceLink::Set_Pitch(void)
 */
 float C_DeviceLink::Get_Pitch(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_pitch;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : Pitch in degrees -90 -- +90
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Pitch(double max_age)
+{
+	refresh_if_stale(DLP_PITCH, max_age);
+	return Get_Pitch();
+}
+
 /*! \brief Sets the roll
 \return \b boolean
 
@@ -1930,7 +5035,7 @@ bool C_DeviceLink::Set_Roll(void)
 		errmsg("Error in Set_Roll. Bad value in roll query\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_roll = fval;
 	return TRUE;
 }
@@ -1940,10 +5045,21 @@ bool C_DeviceLink::Set_Roll(void)
 */
 float C_DeviceLink::Get_Roll(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_roll;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : roll in degrees -180 -- +180
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Roll(double max_age)
+{
+	refresh_if_stale(DLP_ROLL, max_age);
+	return Get_Roll();
+}
+
 /*! \brief Sets the slip
 \return \b boolean
 
@@ -1958,7 +5074,7 @@ bool C_DeviceLink::Set_Slip(void)
 		errmsg("queryfloat returned a bad value in Set_Slip.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_slip = fval;
 	return TRUE;
 }
@@ -1968,10 +5084,21 @@ bool C_DeviceLink::Set_Slip(void)
 */
 float C_DeviceLink::Get_Slip(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_slip;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : slip in degrees -45 -- +45
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Slip(double max_age)
+{
+	refresh_if_stale(DLP_SLIP, max_age);
+	return Get_Slip();
+}
+
 /*! \brief Sets the variometer
 \return \b boolean
 
@@ -1980,7 +5107,7 @@ void C_DeviceLink::Set_Vario(void)
 {
 	float fval = 0.00;
 	fval = queryfloat(DL_GET_VARIO);
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_vario = fval;
 }
 
@@ -1989,10 +5116,21 @@ void C_DeviceLink::Set_Vario(void)
 */
 float C_DeviceLink::Get_Vario(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_vario;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : variometer in meters per second
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Vario(double max_age)
+{
+	refresh_if_stale(DLP_VARIO, max_age);
+	return Get_Vario();
+}
+
 /*! \brief Sets the variometer
 \return \b boolean
 
@@ -2006,7 +5144,7 @@ bool C_DeviceLink::Set_Fuel(void)
 		errmsg("queryfloat returned a bad value in Set_Fuel.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_fuel = fval;
 	return TRUE;
 }
@@ -2016,10 +5154,21 @@ bool C_DeviceLink::Set_Fuel(void)
 */
 float C_DeviceLink::Get_Fuel(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_fuel;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : fuel in kilograms
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Fuel(double max_age)
+{
+	refresh_if_stale(DLP_FUEL, max_age);
+	return Get_Fuel();
+}
+
 /*! \brief Sets the turn bank angle
 \return \b boolean
 \sa queryfloat()
@@ -2034,7 +5183,7 @@ bool C_DeviceLink::Set_Turn(void)
 		errmsg("queryfloat returned an error in Set_Alt.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_turn = fval;
 	return TRUE;
 }
@@ -2044,19 +5193,41 @@ bool C_DeviceLink::Set_Turn(void)
 */
 float C_DeviceLink::Get_Turn(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_turn;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : turn indicator -1 -- +1
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Turn(double max_age)
+{
+	refresh_if_stale(DLP_TURN, max_age);
+	return Get_Turn();
+}
+
 /*! \brief returns the aileron postion stored in private variable
 \return \b float : Altitude in meters
 */
 float C_DeviceLink::Get_Aileron(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_aileron;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : aileron position
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Aileron(double max_age)
+{
+	refresh_if_stale(DLP_AILERON, max_age);
+	return Get_Aileron();
+}
+
 /*! \brief queries the game for the current aileron position 
 and assigns that value to private var
 \return \b float : aileron position
@@ -2070,7 +5241,7 @@ bool C_DeviceLink::Query_Aileron(void)
 		errmsg("queryfloat returned an error in Set_Alt.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_aileron = fval;
 	return TRUE;
 }
@@ -2081,7 +5252,7 @@ bool C_DeviceLink::Query_Aileron(void)
 */
 bool C_DeviceLink::Set_Aileron(float pos)
 {
-	return setctrl(DL_SET_AILERON, pos);
+	return setctrl(DLC_AILERON, 0, pos);
 }
 
 /*! \brief returns the elevator postion stored in private variable
@@ -2089,10 +5260,21 @@ bool C_DeviceLink::Set_Aileron(float pos)
 */
 float C_DeviceLink::Get_Elevator(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_elevator;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : elevator position
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Elevator(double max_age)
+{
+	refresh_if_stale(DLP_ELEVATOR, max_age);
+	return Get_Elevator();
+}
+
 /*! \brief queries the game for the current elevator position 
 and assigns that value to private var
 \return \b float : Elevator position
@@ -2106,7 +5288,7 @@ bool C_DeviceLink::Query_Elevator(void)
 		errmsg("queryfloat returned an error in Query_Elevator.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_elevator = fval;
 	return TRUE;
 }
@@ -2117,7 +5299,7 @@ bool C_DeviceLink::Query_Elevator(void)
 */
 bool C_DeviceLink::Set_Elevator(float pos)
 {
-	return setctrl(DL_SET_ELV, pos);
+	return setctrl(DLC_ELEVATOR, 0, pos);
 }
 
 /*! \brief returns the aileron postion stored in private variable
@@ -2125,10 +5307,21 @@ bool C_DeviceLink::Set_Elevator(float pos)
 */
 float C_DeviceLink::Get_Rudder(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_rudder;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : rudder position
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Rudder(double max_age)
+{
+	refresh_if_stale(DLP_RUDDER, max_age);
+	return Get_Rudder();
+}
+
 /*! \brief queries the game for the current Rudder position 
 and assigns that value to private var
 \return \b float : Rudder position
@@ -2136,13 +5329,13 @@ and assigns that value to private var
 bool C_DeviceLink::Query_Rudder(void)
 {
 	float fval = 0.00;
-	fval = queryfloat(DL_GET_ELV);
+	fval = queryfloat(DL_GET_RUDDER);
 	if ((-1.00 > fval) || (1.00 < fval))
 	{
 		errmsg("queryfloat returned an error in Query_Rudder.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_rudder = fval;
 	return TRUE;
 }
@@ -2153,36 +5346,57 @@ bool C_DeviceLink::Query_Rudder(void)
 */
 bool C_DeviceLink::Set_Rudder(float pos)
 {
-	return setctrl(DL_SET_RUDDER, pos);
+	return setctrl(DLC_RUDDER, 0, pos);
 }
 
 /*! \brief returns the power postion stored in private variable
 \param const int : eng_idx -- the index of the engine 
-\return \b float : Power position of selected engine
+\return \b float : Power position of selected engine. 0.00 for an invalid engine
 
 */
 float C_DeviceLink::Get_Power(const int eng_idx)
 {
-	MC_Lock m_Lock(&my_critsec);
-	return m_engine[eng_idx].power;
+	if ((eng_idx < ENGINE_ONE) || (eng_idx > ENGINE_EIGHT))
+	{
+		errmsg("Get_Power called with invalid engine number.\n");
+		return 0.00;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	return m_engine.power[eng_idx];
+}
+
+/*! \brief returns the power position of an engine, refreshing it first if it is older than max_age
+\param eng_idx : the index of the engine
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : Power position of selected engine
+\note The value written by Set_Power() is not a reading, so it doesn't make the cache fresh.
+*/
+float C_DeviceLink::Get_Power(const int eng_idx, double max_age)
+{
+	refresh_if_stale(DLP_POWER, max_age, eng_idx);
+	return Get_Power(eng_idx);
 }
 
 /*! \brief queries the game for the current power position 
 and assigns that value to private var
 \param const int : eng_idx -- the index of the engine 
-\return \b float : power position
+\return \b boolean
+\note Asks for "80\\eng_idx" so each engine reads back its own lever. DeviceLink.txt documents
+80 without an index; if the game answers without one, that value is stored for every engine.
 */
 bool C_DeviceLink::Query_Power(const int eng_idx)
 {
-	float fval = 0.00;
-	fval = queryfloat(DL_GET_POWER);
-	if ((-1.00 > fval) || (1.00 < fval))
+	if ((eng_idx < ENGINE_ONE) || (eng_idx > ENGINE_EIGHT))
 	{
-		errmsg("queryfloat returned an error in Query_Power.\n");
+		errmsg("Query_Power called with invalid engine number.\n");
 		return FALSE;
-	} 
-	MC_Lock m_Lock(&my_critsec);
-	m_engine[eng_idx].power = fval;
+	}
+	Prefetch(DLP_POWER, 0.00, eng_idx);
+	if (RefreshPending() == FALSE)
+	{
+		errmsg("RefreshPending returned FALSE in Query_Power.\n");
+		return FALSE;
+	}
 	return TRUE;
 }
 
@@ -2193,50 +5407,148 @@ bool C_DeviceLink::Query_Power(const int eng_idx)
 */
 bool C_DeviceLink::Set_Power(const int eng_idx, float pos)
 {
-	char code[64];
-	memset(code,NULL,sizeof(code));
-#if _MSC_VER >= 1400
-	_snprintf_s(code,sizeof(code),_TRUNCATE,"%s%c%d",DL_SET_POWER,DELIM_2,eng_idx);
-#else
-	_snprintf(code,sizeof(code),"%s%c%d",DL_SET_POWER,DELIM_2,eng_idx);
-#endif	
+	if ((eng_idx < ENGINE_ONE) || (eng_idx > ENGINE_EIGHT))
+	{
+		errmsg("Set_Power called with invalid engine number.\n");
+		return FALSE;
+	}
 	bool flag = false;
-	flag = setctrl(code, pos);
-	MC_Lock m_Lock(&my_critsec);
-	m_engine[eng_idx].power = pos; //go ahead and store the new value
+	flag = setctrl(DLC_POWER, eng_idx, pos);
+	DL_Lock m_Lock(&m_critsec);
+	m_engine.power[eng_idx] = pos; //go ahead and store the new value
 	return flag;
 }
 
 /*! \brief returns the prop pitch postion stored in private variable
 \param const int : eng_idx -- the index of the engine 
-\return \b float : prop pitch position of selected engine
+\return \b float : prop pitch position of selected engine. 0.00 for an invalid engine
 
 */
 float C_DeviceLink::Get_PropPitch(const int eng_idx)
 {
-	MC_Lock m_Lock(&my_critsec);
-	return m_engine[eng_idx].prop_pitch;
+	if ((eng_idx < ENGINE_ONE) || (eng_idx > ENGINE_EIGHT))
+	{
+		errmsg("Get_PropPitch called with invalid engine number.\n");
+		return 0.00;
+	}
+	DL_Lock m_Lock(&m_critsec);
+	return m_engine.prop_pitch[eng_idx];
+}
+
+/*! \brief returns the prop pitch of an engine, refreshing it first if it is older than max_age
+\param eng_idx : the index of the engine
+\param max_age : oldest acceptable value in milliseconds
+\return \b float : prop pitch position of selected engine
+*/
+float C_DeviceLink::Get_PropPitch(const int eng_idx, double max_age)
+{
+	refresh_if_stale(DLP_PROP_PITCH, max_age, eng_idx);
+	return Get_PropPitch(eng_idx);
 }
 
 /*! \brief queries the game for the current prop pitch position 
 and assigns that value to private var
 \param const int : eng_idx -- the index of the engine 
-\return \b float : prop pitch position
+\return \b boolean
+\note Asks for "92\\eng_idx" so each engine reads back its own lever. DeviceLink.txt documents
+92 without an index; if the game answers without one, that value is stored for every engine.
 */
 bool C_DeviceLink::Query_PropPitch(const int eng_idx)
 {
-	float fval = 0.00;
-	fval = queryfloat(DL_GET_PROP_PITCH);
-	if ((-1.00 > fval) || (1.00 < fval))
+	if ((eng_idx < ENGINE_ONE) || (eng_idx > ENGINE_EIGHT))
 	{
-		errmsg("queryfloat returned an error in Query_PropPitch.\n");
+		errmsg("Query_PropPitch called with invalid engine number.\n");
 		return FALSE;
-	} 
-	MC_Lock m_Lock(&my_critsec);
-	m_engine[eng_idx].prop_pitch = fval;
+	}
+	Prefetch(DLP_PROP_PITCH, 0.00, eng_idx);
+	if (RefreshPending() == FALSE)
+	{
+		errmsg("RefreshPending returned FALSE in Query_PropPitch.\n");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*! \brief queries power and prop pitch of every engine in one packet
+\return \b boolean : FALSE if any value didn't come back
+\note Sized to GetNumEngines() like SetAllEngineData().
+*/
+bool C_DeviceLink::Query_EngineControls(void)
+{
+	int num = GetNumEngines();
+	if ((num < 1) || (num > DL_MAX_ENGINES))
+	{
+		errmsg("GetNumEngines failed in Query_EngineControls.\n");
+		return FALSE;
+	}
+	for (int eng = 0; eng < num; ++eng)
+	{
+		Prefetch(DLP_POWER, 0.00, eng);
+		Prefetch(DLP_PROP_PITCH, 0.00, eng);
+	}
+	if (RefreshPending() == FALSE)
+	{
+		errmsg("RefreshPending returned FALSE in Query_EngineControls.\n");
+		return FALSE;
+	}
 	return TRUE;
 }
 
+/*! \brief sets power and prop pitch for any set of engines in one packet
+\param eng_mask : bit n set for engine index n, i.e. 0x0F for the first four engines
+\param power : DL_MAX_ENGINES power positions indexed by engine, -1.00 -- +1.00. NULL leaves power alone
+\param pitch : DL_MAX_ENGINES prop pitch positions indexed by engine. NULL leaves pitch alone
+\return \b boolean
+\note Goes through the control frame. With the frame off everything written here is sent in one
+FlushControls(), with it on the values wait for the caller's FlushControls() as usual.
+*	- Example, all four throttles to full:
+*		- float pwr[DL_MAX_ENGINES] = {1.0f, 1.0f, 1.0f, 1.0f};\n
+*		- Set_EngineControls(0x0F, pwr, NULL);\n
+*		.
+*/
+bool C_DeviceLink::Set_EngineControls(unsigned char eng_mask, const float* power, const float* pitch)
+{
+	if ((eng_mask == 0) || ((power == NULL) && (pitch == NULL)))
+	{
+		errmsg("Set_EngineControls called with nothing to set.\n");
+		return FALSE;
+	}
+	for (int eng = 0; eng < DL_MAX_ENGINES; ++eng)
+	{
+		if ((eng_mask & (1 << eng)) == 0)
+		{
+			continue;
+		}
+		if (power != NULL)
+		{
+			setctrl(DLC_POWER, eng, power[eng], FALSE);
+		}
+		if (pitch != NULL)
+		{
+			setctrl(DLC_PROP_PITCH, eng, pitch[eng], FALSE);
+		}
+		DL_Lock m_Lock(&m_critsec);
+		if (power != NULL)
+		{
+			m_engine.power[eng] = power[eng];
+		}
+		if (pitch != NULL)
+		{
+			m_engine.prop_pitch[eng] = pitch[eng];
+		}
+	}
+	bool frame = FALSE;
+	{
+	DL_Lock m_Lock(&m_critsec);
+	frame = m_ctrl_frame;
+	}
+	if (frame == TRUE)
+	{
+		return TRUE;
+	}
+	return FlushControls();
+}
+
 /*! \brief set the game prop pitch to the passed in value.
 \param const int : eng_idx -- the index of the engine to set
 \param float : pos -- the position to set it too. -1.00 -- +1.00
@@ -2244,17 +5556,15 @@ bool C_DeviceLink::Query_PropPitch(const int eng_idx)
 */
 bool C_DeviceLink::Set_PropPitch(const int eng_idx, float pos)
 {
-	char code[64];
-	memset(code,NULL,sizeof(code));
-#if _MSC_VER >= 1400
-	_snprintf_s(code,sizeof(code),_TRUNCATE,"%s%c%d",DL_SET_PROP_PITCH,DELIM_2,eng_idx);
-#else
-	_snprintf(code,sizeof(code),"%s%c%d",DL_SET_PROP_PITCH,DELIM_2,eng_idx);
-#endif	
+	if ((eng_idx < ENGINE_ONE) || (eng_idx > ENGINE_EIGHT))
+	{
+		errmsg("Set_PropPitch called with invalid engine number.\n");
+		return FALSE;
+	}
 	bool flag = false;
-	flag = setctrl(code, pos);
-	MC_Lock m_Lock(&my_critsec);
-	m_engine[eng_idx].prop_pitch = pos; //go ahead and store the new value
+	flag = setctrl(DLC_PROP_PITCH, eng_idx, pos);
+	DL_Lock m_Lock(&m_critsec);
+	m_engine.prop_pitch[eng_idx] = pos; //go ahead and store the new value
 	return flag;
 }
 
@@ -2263,10 +5573,21 @@ bool C_DeviceLink::Set_PropPitch(const int eng_idx, float pos)
 */
 float C_DeviceLink::Get_Brakes(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_brakes;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : brakes position
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Brakes(double max_age)
+{
+	refresh_if_stale(DLP_BRAKES, max_age);
+	return Get_Brakes();
+}
+
 /*! \brief queries the game for the current brakes position 
 and assigns that value to private var
 \return \b float : brakes position
@@ -2280,7 +5601,7 @@ bool C_DeviceLink::Query_Brakes(void)
 		errmsg("queryfloat returned an error in Query_Brakes.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_brakes = fval;
 	return TRUE;
 }
@@ -2291,7 +5612,7 @@ bool C_DeviceLink::Query_Brakes(void)
 */
 bool C_DeviceLink::Set_Brakes(float pos)
 {
-	return setctrl(DL_SET_BRAKES, pos);
+	return setctrl(DLC_BRAKES, 0, pos);
 }
 
 /*! \brief returns the aileron trim postion stored in private variable
@@ -2299,10 +5620,21 @@ bool C_DeviceLink::Set_Brakes(float pos)
 */
 float C_DeviceLink::Get_AilTrim(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_ail_trim;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : aileron trim position
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_AilTrim(double max_age)
+{
+	refresh_if_stale(DLP_AIL_TRIM, max_age);
+	return Get_AilTrim();
+}
+
 /*! \brief queries the game for the current aileron trim position 
 and assigns that value to private var
 \return \b float : aileron trim position
@@ -2316,7 +5648,7 @@ bool C_DeviceLink::Query_AilTrim(void)
 		errmsg("queryfloat returned an error in Query_AilTrim.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_ail_trim = fval;
 	return TRUE;
 }
@@ -2327,7 +5659,7 @@ bool C_DeviceLink::Query_AilTrim(void)
 */
 bool C_DeviceLink::Set_AilTrim(float pos)
 {
-	return setctrl(DL_SET_AIL_TRIM, pos);
+	return setctrl(DLC_AIL_TRIM, 0, pos);
 }
 
 /*! \brief returns the elevator trim postion stored in private variable
@@ -2335,10 +5667,21 @@ bool C_DeviceLink::Set_AilTrim(float pos)
 */
 float C_DeviceLink::Get_ElvTrim(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_elv_trim;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : elevator trim position
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_ElvTrim(double max_age)
+{
+	refresh_if_stale(DLP_ELV_TRIM, max_age);
+	return Get_ElvTrim();
+}
+
 /*! \brief queries the game for the current elevator trim position 
 and assigns that value to private var
 \return \b float : elevator trim position
@@ -2352,7 +5695,7 @@ bool C_DeviceLink::Query_ElvTrim(void)
 		errmsg("queryfloat returned an error in Query_ElvTrim.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_elv_trim = fval;
 	return TRUE;
 }
@@ -2363,7 +5706,7 @@ bool C_DeviceLink::Query_ElvTrim(void)
 */
 bool C_DeviceLink::Set_ElvTrim(float pos)
 {
-	return setctrl(DL_SET_ELV_TRIM, pos);
+	return setctrl(DLC_ELV_TRIM, 0, pos);
 }
 
 /*! \brief returns the rudder trim postion stored in private variable
@@ -2371,10 +5714,21 @@ bool C_DeviceLink::Set_ElvTrim(float pos)
 */
 float C_DeviceLink::Get_RudTrim(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_rudder_trim;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : rudder trim position
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_RudTrim(double max_age)
+{
+	refresh_if_stale(DLP_RUDDER_TRIM, max_age);
+	return Get_RudTrim();
+}
+
 /*! \brief queries the game for the current rudder trim position 
 and assigns that value to private var
 \return \b float : rudder trim position
@@ -2388,7 +5742,7 @@ bool C_DeviceLink::Query_RudTrim(void)
 		errmsg("queryfloat returned an error in Query_RudTrim.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_rudder_trim = fval;
 	return TRUE;
 }
@@ -2399,7 +5753,7 @@ bool C_DeviceLink::Query_RudTrim(void)
 */
 bool C_DeviceLink::Set_RudTrim(float pos)
 {
-	return setctrl(DL_SET_RUDDER_TRIM, pos);
+	return setctrl(DLC_RUDDER_TRIM, 0, pos);
 }
 
 /*! \brief set the game flaps to the passed in value.
@@ -2408,7 +5762,7 @@ bool C_DeviceLink::Set_RudTrim(float pos)
 */
 bool C_DeviceLink::Set_Flaps(float pos)
 {
-	return setctrl(DL_SET_FLAPS_POS, pos);
+	return setctrl(DLC_FLAPS, 0, pos);
 }
 
 /*! \brief returns the flaps postion stored in private variable
@@ -2416,10 +5770,21 @@ bool C_DeviceLink::Set_Flaps(float pos)
 */
 float C_DeviceLink::Get_Flaps(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_flaps;
 }
 
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b float : flaps position
+\sa Prefetch()
+*/
+float C_DeviceLink::Get_Flaps(double max_age)
+{
+	refresh_if_stale(DLP_FLAPS, max_age);
+	return Get_Flaps();
+}
+
 /*! \brief queries the game for the current rudder trim position 
 and assigns that value to private var
 \return \b float : rudder trim position
@@ -2433,7 +5798,7 @@ bool C_DeviceLink::Query_Flaps(void)
 		errmsg("queryfloat returned an error in Query_Flaps.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_flaps = fval;
 	return TRUE;
 }
@@ -2443,96 +5808,12 @@ bool C_DeviceLink::Query_Flaps(void)
 */
 bool C_DeviceLink::SetAllInstruments(void)
 {
-	char cmd[80];
-	memset(cmd, NULL, sizeof(cmd));
-#if _MSC_VER >= 1400
-	_snprintf_s(cmd,sizeof(cmd),_TRUNCATE,"%s",DL_ALL_INST);
-#else
-	_snprintf(cmd,sizeof(cmd),"%s",DL_ALL_INST);
-#endif
-	if (FALSE == QueryMsg(cmd))
+	//parse_reply() stores and stamps each instrument as it arrives
+	if (QueryRaw(DL_ALL_INST, 11, NULL, 0) < 11)
 	{
 		errmsg("error in C_DeviceLink::SetAllInstruments.\n");
 		return FALSE;
 	} 	
-	// set IAS
-	float fval = 0.00;
-	getval(DL_GET_IAS, &fval);
-
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_ias = fval;
-	}
-	// set Vario
-	fval = 0.00;
-	getval(DL_GET_VARIO, &fval);
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_vario = fval;
-	}
-	// set Slip
-	fval = 0.00;
-	getval(DL_GET_SLIP, &fval);
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_slip = fval;
-	}
-	// set turn
-	fval = 0.00;
-	getval(DL_GET_TURN, &fval);
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_turn = fval;
-	}
-	// set Angular Speed
-	fval = 0.00;
-	getval(DL_GET_ANG_SPD, &fval);
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_ang_spd = fval;
-	}
-	// set Altimeter
-	fval = 0.00;
-	getval(DL_GET_ALT, &fval);
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_alt = fval;
-	}
-	// set Azimuth
-	fval = 0.00;
-	getval(DL_GET_AZI, &fval);
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_azimuth = fval;
-	}
-	// set Beacon Azimuth
-	fval = 0.00;
-	getval(DL_GET_BEACON_AZI, &fval);
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_beacon_azimuth = fval;
-	}
-	// set Roll
-	fval = 0.00;
-	getval(DL_GET_ROLL, &fval);
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_roll = fval;
-	}
-	// set Pitch
-	fval = 0.00;
-	getval(DL_GET_PITCH, &fval);
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_pitch = fval;
-	}
-	// set Fuel
-	fval = 0.00;
-	getval(DL_GET_FUEL, &fval);
-	{
-	MC_Lock m_Lock(&my_critsec);
-	m_fuel = fval;
-	} 
 	return TRUE;
 }
 
@@ -2572,7 +5853,7 @@ bool C_DeviceLink::Query_Weapon(WeapType weap)
 		errmsg("queryfloat returned an error in Query_Weapon.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_weap[weap] = ival;
 	return TRUE;
 }
@@ -2589,7 +5870,7 @@ bool C_DeviceLink::Query_Airbrakes(void)
 		errmsg("queryfloat returned an error in Query_Airbrakes.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_airbrakes = ival;
 	return TRUE;
 }
@@ -2598,9 +5879,20 @@ bool C_DeviceLink::Query_Airbrakes(void)
 */
 int C_DeviceLink::Get_Airbrakes(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_airbrakes;
 }
+
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b integer : 1 is deployed. 0 is not deployed
+\sa Prefetch()
+*/
+int C_DeviceLink::Get_Airbrakes(double max_age)
+{
+	refresh_if_stale(DLP_AIRBRAKES, max_age);
+	return Get_Airbrakes();
+}
 /*! \brief sets the airbrake on or off
 \return \b boolean
 */
@@ -2621,7 +5913,7 @@ bool C_DeviceLink::Query_WingFold(void)
 		errmsg("queryfloat returned an error in Query_WingFold.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_wingfold = ival;
 	return TRUE;
 }
@@ -2630,9 +5922,20 @@ bool C_DeviceLink::Query_WingFold(void)
 */
 int C_DeviceLink::Get_WingFold(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_wingfold;
 }
+
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b integer : 1 is folded. 0 is not folded
+\sa Prefetch()
+*/
+int C_DeviceLink::Get_WingFold(double max_age)
+{
+	refresh_if_stale(DLP_WING_FOLD, max_age);
+	return Get_WingFold();
+}
 /* \brief sets the wingfold on or off
 \return \b boolean
 */
@@ -2653,7 +5956,7 @@ bool C_DeviceLink::Query_TailHook(void)
 		errmsg("queryfloat returned an error in Query_TailHook.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_tailhook = ival;
 	return TRUE;
 }
@@ -2662,9 +5965,20 @@ bool C_DeviceLink::Query_TailHook(void)
 */
 int C_DeviceLink::Get_TailHook(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_tailhook;
 }
+
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b integer : 1 is deployed. 0 is not deployed
+\sa Prefetch()
+*/
+int C_DeviceLink::Get_TailHook(double max_age)
+{
+	refresh_if_stale(DLP_HOOK, max_age);
+	return Get_TailHook();
+}
 /*! \brief sets the tail hook on or off
 \return \b boolean
 */
@@ -2685,7 +5999,7 @@ bool C_DeviceLink::Query_Chocks(void)
 		errmsg("queryfloat returned an error in Query_Chocks.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_chocks = ival;
 	return TRUE;
 }
@@ -2694,9 +6008,20 @@ bool C_DeviceLink::Query_Chocks(void)
 */
 int C_DeviceLink::Get_Chocks(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_chocks;
 }
+
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b integer : 1 is deployed. 0 is not deployed
+\sa Prefetch()
+*/
+int C_DeviceLink::Get_Chocks(double max_age)
+{
+	refresh_if_stale(DLP_CHOCKS, max_age);
+	return Get_Chocks();
+}
 /* \brief sets the chocks on or off
 \return \b boolean
 */
@@ -2716,7 +6041,7 @@ bool C_DeviceLink::Query_Canopy(void)
 		errmsg("queryfloat returned an error in Query_Canopy.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_canopy = ival;
 	return TRUE;
 }
@@ -2725,9 +6050,20 @@ bool C_DeviceLink::Query_Canopy(void)
 */
 int C_DeviceLink::Get_Canopy(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_canopy;
 }
+
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b integer : 1 is open. 0 is closed
+\sa Prefetch()
+*/
+int C_DeviceLink::Get_Canopy(double max_age)
+{
+	refresh_if_stale(DLP_CANOPY, max_age);
+	return Get_Canopy();
+}
 /* \brief sets the canopy open or close
 \return \b boolean
 */
@@ -2751,7 +6087,7 @@ bool C_DeviceLink::Query_Gunner(void)
 		errmsg("queryfloat returned an error in Query_Gunner.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_gunner = ival;
 	return TRUE;
 }
@@ -2761,9 +6097,20 @@ bool C_DeviceLink::Query_Gunner(void)
 */
 int C_DeviceLink::Get_Gunner(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_gunner;
 }
+
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b integer : 0 mean not firing and 1 means firing
+\sa Prefetch()
+*/
+int C_DeviceLink::Get_Gunner(double max_age)
+{
+	refresh_if_stale(DLP_GUNNER, max_age);
+	return Get_Gunner();
+}
 /*! \brief set the gunner to fire or not fire
 \param const int code : code must be either DL_START_GUNNER or DL_STOP_GUNNER
 \return \b boolean
@@ -2829,7 +6176,7 @@ bool C_DeviceLink::Query_Tailwheel(void)
 		errmsg("queryfloat returned an error in Query_Tailwheel.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_tailwheel = ival;
 	return TRUE;
 }
@@ -2838,9 +6185,20 @@ bool C_DeviceLink::Query_Tailwheel(void)
 */
 int C_DeviceLink::Get_Tailwheel(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_tailwheel;
 }
+
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b integer : 1 is locked. 0 is not locked
+\sa Prefetch()
+*/
+int C_DeviceLink::Get_Tailwheel(double max_age)
+{
+	refresh_if_stale(DLP_TAILWHEEL, max_age);
+	return Get_Tailwheel();
+}
 /* \brief sets the tailwheel on or off
 \return \b boolean
 */
@@ -2855,10 +6213,21 @@ bool C_DeviceLink::Set_Tailwheel(void)
 */
 int C_DeviceLink::Get_Weapon(WeapType weap)
 {
-		MC_Lock m_Lock(&my_critsec);
+		DL_Lock m_Lock(&m_critsec);
 		return m_weap[weap];
 }
 
+/*! \brief returns the stored weapon state, refreshing it first if it is older than max_age
+\param \b WeapType weap : {MG, CANNON, ROCKETS, BOMBS, MGCANNON}
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b integer : status of the weapon. 1 means it is firing and 0 means it is not.
+*/
+int C_DeviceLink::Get_Weapon(WeapType weap, double max_age)
+{
+	refresh_if_stale(static_cast<DLParam>(DLP_WEAP1 + weap), max_age);
+	return Get_Weapon(weap);
+}
+
 /*! \brief increments the cowl flaps
 \return \b boolean
 \note There is no query or get for this because the game doesn't allow you to set
@@ -2905,18 +6274,7 @@ bool C_DeviceLink::Set_Weapon(WeapType weap, int ival)
 #else
 	_snprintf(tmp_cmd,sizeof(tmp_cmd),"%s%c%d",code,DELIM_2,ival);
 #endif
-	if (set_command_buff(tmp_cmd) == FALSE)
-	{
-		errmsg("set_command_buff returned FALSE in Set_Weapon.\n");
-		return FALSE;
-	}
-	if (SendMsg()== TRUE)
-	{
-		return TRUE;
-	} else
-	{
-		return FALSE;
-	}
+	return toggleswitch(tmp_cmd);
 }
 
 /*! \brief query the game for the state of the level stabilizer and set private var
@@ -2931,7 +6289,7 @@ bool C_DeviceLink::Query_LvlStab(void)
 		errmsg("queryfloat returned an error in Query_LvlStab.\n");
 		return FALSE;
 	} 
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	m_lvlstab = ival;
 	return TRUE;
 }
@@ -2940,9 +6298,20 @@ bool C_DeviceLink::Query_LvlStab(void)
 */
 int C_DeviceLink::Get_LvlStab(void)
 {
-	MC_Lock m_Lock(&my_critsec);
+	DL_Lock m_Lock(&m_critsec);
 	return m_lvlstab;
 }
+
+/*! \brief returns the stored value, refreshing it first if it is older than max_age
+\param double : max_age -- oldest acceptable value in milliseconds
+\return \b integer : 1 is engaged. 0 is not engaged
+\sa Prefetch()
+*/
+int C_DeviceLink::Get_LvlStab(double max_age)
+{
+	refresh_if_stale(DLP_LVL_STAB, max_age);
+	return Get_LvlStab();
+}
 /*! \brief sets the level stabilizer on or off
 \return \b boolean
 */
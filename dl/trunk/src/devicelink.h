@@ -1,7 +1,7 @@
 /*! \file devicelink.h
 \brief Main header file with the defines for the various devicelink codes
 \author Mike Couvillion
-\version 2.1.4
+\version 2.2.0
 \date Copyright 2004-2007
 \note This file predefines the various codes that are used to build queries
 	for sending to the IL2 game engine.
@@ -16,10 +16,59 @@ give proper credit.
 #endif
 
 #include <stdio.h>
+#ifdef _WIN32
 #include <winsock2.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include "mc_lock.h"
+#include "mc_timer.h"
+#include "devicelink_queue.h"
+#include "devicelink_exec.h"
+
+#define DL_LOCK_NULL 0 //!< no locking. For single threaded programs only
+#define DL_LOCK_MUTEX 1 //!< MC_CritSection. Spins briefly, then sleeps
+#define DL_LOCK_SPIN 2 //!< MC_SpinCritSection. Atomic instructions only, never sleeps in the kernel
+#ifndef DL_LOCK_POLICY
+#define DL_LOCK_POLICY DL_LOCK_MUTEX //!< lock policy of the library. Every file of a program must be built with the same one
+#endif
+#if DL_LOCK_POLICY == DL_LOCK_NULL
+typedef MC_NullCritSection DL_CritSection;
+#elif DL_LOCK_POLICY == DL_LOCK_SPIN
+typedef MC_SpinCritSection DL_CritSection;
+#else
+typedef MC_CritSection DL_CritSection;
+#endif
+typedef MC_LockT<DL_CritSection> DL_Lock; //!< the lock every thread safe method takes
+
+#ifndef _WIN32
+//Map the handful of Winsock names the class uses onto BSD sockets.
+typedef int SOCKET;
+typedef struct { int unused; } WSADATA; //!< placeholder so Init() compiles. Not used outside Win32
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define WSAStartup(ver, data) ((void)(data), 0)
+#define WSACleanup() ((void)0)
+#define WSAGetLastError() (errno)
+#define closesocket(s) close(s)
+#define WSAEWOULDBLOCK EWOULDBLOCK
+#define _snprintf snprintf
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+#endif
 
 #define DL_GET_VERSION   "2"   //!< When this code is sent the game returns the version of DeviceLink that is running.
 #define DL_ACCESS_GET  	"4"  
@@ -53,7 +102,14 @@ give proper credit.
 #define ENGINE_TWO   1 
 #define ENGINE_THREE   2 
 #define ENGINE_FOUR	  3 
+#define ENGINE_FIVE   4 
+#define ENGINE_SIX   5 
+#define ENGINE_SEVEN   6 
+#define ENGINE_EIGHT   7 
+#define DL_MAX_ENGINES	8 //!< number of engine slots held in the private engine cache. DL_GET_ENGINES never reports more.
 #define DL_ALL_INST "30/32/34/36/38/40/42/44/46/48/50"
+#define DL_ALL_SWITCHES "100/172/174/210/212/214/216/220/190/180/182/184/186/188/104/162" //!< every discrete state, in DLSwitch order
+#define DL_PROFILE "2/22/24/28" //!< version, plane, cockpits and engines. Everything RefreshProfile() caches
 
 // Command codes for landing gear
 
@@ -64,6 +120,10 @@ give proper credit.
 #define DL_SET_GEAR_STATUS   "165"  //!< sends command to set the gear status
 #define DL_RAISE_GEAR_MAN   "167"  //!< issue ONE command to raise gear manually
 #define DL_LOWER_GEAR_MAN   "169"  //!< issue ONE command to lower gear manually
+#define DL_ALL_GEAR "164/56/58/60" //!< gear status and the three leg positions in one query
+#define DL_GEAR_MAX_AGE 250.0 //!< oldest gear bundle in ms SetGearUp() and SetGearDown() decide from
+#define DL_TOGGLE_TIMEOUT 500.0 //!< ms a toggle has to show up in its get code before it is tried again
+#define DL_TOGGLE_TRIES 3 //!< toggles sent for one SetToggle() before giving up
 #define DL_GET_POWER   "80"  //!<  return float
 #define DL_SET_POWER   "81"  //!<  set(float)
 #define DL_GET_FLAPS_POS   "82"  //!<  returns float
@@ -283,13 +343,137 @@ give proper credit.
 #define DELIM_2 '\\'
 #define REQUEST 'R'
 #define ANSWER	'A'
+#define DL_MAX_QUERY 512 //!< largest R-packet built when several keys are batched into one query
+#define DL_MAX_REPLY 2048 //!< size of the receive buffer for A-packets
+#define DL_READ_TIMEOUT 250.0 //!< ms a query waits for the next packet of its answer
+#define DL_ROUTE_SLICE 1.0 //!< longest single wait in ms while other queries share the socket
+#define DL_UPDATE_QUEUE 1024 //!< received values EnableUpdateQueue() holds for PopUpdates(). power of two
+#define DL_CONTROL_QUEUE 256 //!< control writes EnableControlQueue() holds for FlushControls(). power of two
+#define DL_QUEUE_BATCH 64 //!< records moved per batch when a queue is drained
+#define DL_JITTER_BINS 12 //!< buckets in DLPollThreadStats::jitter_hist
+#define DL_JITTER_BIN0 0.01 //!< upper edge of the first jitter bucket in ms. Each bucket doubles it
+#define DL_MISS_BINS 8 //!< buckets in DLPollThreadStats::missed_hist
+#define DL_RTT_BINS 16 //!< buckets in DLRttStats::hist
+#define DL_RTT_BIN0 0.005 //!< upper edge of the first round-trip bucket in ms. Each bucket doubles it
+#define DL_ATT_HISTORY 8 //!< number of pitch/roll/azimuth samples kept for the attitude estimator
+#define DL_SHM_NAME "/devicelink" //!< default shared memory segment for ExportShm(). POSIX needs the leading slash
 enum Speed {KMH, KTS, MPH};
 enum WeapType {MG, CANNON, ROCKETS, BOMBS, MGCANNON};
 
+/*! \brief Identifies a cached value for the max-age getters and the refresh queue.
+	\note The order must match the dl_params table in devicelink.cpp. The weapon entries
+	follow the WeapType order so DLP_WEAP1 + weap gives the right one.
+*/
+enum DLParam {DLP_IAS, DLP_VARIO, DLP_SLIP, DLP_TURN, DLP_ANG_SPD, DLP_ALT, DLP_AZI, DLP_BEACON_AZI,
+	DLP_ROLL, DLP_PITCH, DLP_FUEL, DLP_FLAPS, DLP_AILERON, DLP_ELEVATOR, DLP_RUDDER, DLP_BRAKES,
+	DLP_AIL_TRIM, DLP_ELV_TRIM, DLP_RUDDER_TRIM, DLP_LVL_STAB, DLP_AIRBRAKES, DLP_TAILWHEEL,
+	DLP_WING_FOLD, DLP_CANOPY, DLP_HOOK, DLP_CHOCKS, DLP_GUNNER, DLP_GUNPOD, DLP_WEAP1, DLP_WEAP2,
+	DLP_WEAP3, DLP_WEAP4, DLP_WEAP1_2, DLP_RPM, DLP_MANIFOLD, DLP_TEMP_OILIN, DLP_TEMP_OILOUT,
+	DLP_TEMP_WATER, DLP_TEMP_CYL, DLP_POWER, DLP_PROP_PITCH, DLP_MAGNETO, DLP_OVERLOAD, DLP_SHAKE, DLP_WEP, DLP_FEATHER, DLP_GEAR_STATUS, DLP_GEAR_LEFT, DLP_GEAR_RIGHT, DLP_GEAR_CENTER, DLP_COUNT};
+
+/*! \brief Bit positions in the packed switch state returned by Get_Switches().
+	\note The order matches DL_ALL_SWITCHES. Test a switch with (Get_Switches() & (1 << DLS_CANOPY)).
+*/
+enum DLSwitch {DLS_LVL_STAB, DLS_AIRBRAKES, DLS_TAILWHEEL, DLS_WING_FOLD, DLS_CANOPY, DLS_HOOK,
+	DLS_CHOCKS, DLS_GUNNER, DLS_GUNPOD, DLS_WEAP1, DLS_WEAP2, DLS_WEAP3, DLS_WEAP4, DLS_WEAP1_2,
+	DLS_WEP, DLS_FEATHER, DLS_COUNT};
 
-/// Static vars for socket code
+/*! \brief Subsystems the toggle layer can drive to a wanted state.
+	\note The order must match the dl_toggles table in devicelink.cpp. On means gear down,
+	canopy open, hook down and so on, i.e. a non zero answer from the matching get code.
+*/
+enum DLToggle {DLT_GEAR, DLT_LVL_STAB, DLT_AIRBRAKES, DLT_TAILWHEEL, DLT_WING_FOLD, DLT_CANOPY,
+	DLT_HOOK, DLT_CHOCKS, DLT_WEP, DLT_FEATHER, DLT_COUNT};
 
-static fd_set    ActiveReadFds;
+/*! \brief Where the toggle layer is with one subsystem.
+*/
+enum DLToggleState {DLTS_IDLE, DLTS_PENDING, DLTS_CONFIRMED, DLTS_FAILED};
+
+/*! \brief Identifies a control axis for the control frame.
+	\note The order must match the dl_controls table in devicelink.cpp. Power and prop pitch
+	have a slot per engine, the others only use engine slot 0.
+*/
+enum DLControl {DLC_AILERON, DLC_ELEVATOR, DLC_RUDDER, DLC_BRAKES, DLC_AIL_TRIM, DLC_ELV_TRIM,
+	DLC_RUDDER_TRIM, DLC_FLAPS, DLC_POWER, DLC_PROP_PITCH, DLC_COUNT};
+
+/*! \brief Control output statistics. Times are in milliseconds.
+*/
+struct DLControlStats
+{
+	unsigned long writes; //!< calls to the control Set_ methods
+	unsigned long packets; //!< control packets sent to the game
+	unsigned long sent; //!< control values sent to the game
+	double send_rate; //!< control packets per second since the last reset
+	double mean_latency; //!< average time from the first unsent write of a control to its packet going out
+	double max_latency; //!< worst time from the first unsent write of a control to its packet going out
+	unsigned long filtered; //!< values dropped because they were inside the deadband
+	unsigned long held; //!< times a value was kept for a later flush by min_interval or max_rate
+	unsigned long refreshed; //!< unchanged values resent because of the refresh policy
+	unsigned long piggybacked; //!< values that rode along on a poll packet instead of their own
+};
+
+/*! \brief Called by DispatchUpdates() once for each received value.
+\param user : the pointer given to SetUpdateCallback()
+\param rec : the value. key is its DLParam
+*/
+typedef void (*DLUpdateCallback)(void* user, const DLRecord* rec);
+
+/*! \brief Output policy for one control. Times are in milliseconds. 0 turns a setting off.
+*/
+struct DLControlPolicy
+{
+	float deadband; //!< changes smaller than this from the last sent value are dropped. -1, 0 and +1 always go out
+	double min_interval; //!< shortest time between two sends of the control
+	double max_rate; //!< most sends of the control in any one second
+	double refresh; //!< resend the last value sent if nothing has been sent for this long
+};
+
+/*! \brief Poll timing statistics for one value scheduled with SetPollRate(). Times are in milliseconds.
+*/
+struct DLPollStats
+{
+	double period; //!< the requested poll period
+	unsigned long polls; //!< number of times the value was sent and came back
+	unsigned long misses; //!< number of times the value was sent but didn't come back
+	double mean_interval; //!< average time between two received values
+	double mean_jitter; //!< average absolute difference between the interval and the period
+	double max_jitter; //!< largest absolute difference between the interval and the period
+};
+
+/*! \brief Timing statistics of the thread started by StartPollThread(). Times are in milliseconds.
+*/
+struct DLPollThreadStats
+{
+	double period; //!< the requested tick period
+	bool realtime; //!< TRUE if the thread got the priority it asked for
+	bool pinned; //!< TRUE if the thread got the CPU it asked for
+	unsigned long ticks; //!< PollTick() calls made by the thread
+	unsigned long missed; //!< deadlines that passed while an earlier tick was still running
+	double mean_jitter; //!< average absolute difference between the wake interval and the period
+	double max_jitter; //!< largest absolute difference between the wake interval and the period
+	double mean_work; //!< average time spent in PollTick()
+	double max_work; //!< longest time spent in PollTick()
+	unsigned long jitter_hist[DL_JITTER_BINS]; //!< bucket i counts jitter below DL_JITTER_BIN0 * 2^i. The last also counts everything above
+	unsigned long missed_hist[DL_MISS_BINS]; //!< bucket i counts wakes that found i + 1 deadlines passed. The last also counts more
+};
+
+/*! \brief Round-trip times of queries and the cost of busy polling. Times are in milliseconds.
+*/
+struct DLRttStats
+{
+	unsigned long samples; //!< queries answered in full
+	unsigned long timeouts; //!< queries that timed out
+	double min_rtt; //!< fastest send to last answer packet
+	double mean_rtt; //!< average send to last answer packet
+	double max_rtt; //!< slowest send to last answer packet
+	unsigned long hist[DL_RTT_BINS]; //!< bucket i counts round trips below DL_RTT_BIN0 * 2^i. The last also counts everything above
+	unsigned long spin_hits; //!< packets caught while spinning
+	unsigned long spin_misses; //!< spins that used their budget and fell back to select()
+	double spin_time; //!< total time spent spinning. What busy polling costs in CPU
+};
+
+
+struct DL_ShmSnapshot;
 
 /*!	\brief The C++ wrapper class for devicelink
 
@@ -312,6 +496,9 @@ class C_DeviceLink
 		bool SendMsg(void);
 		bool ReadMsg(void);
 		bool QueryMsg(const char* code);
+		bool SendCmd(const char* code);
+		unsigned int QueryRaw(const char* keys, unsigned int expected, char* reply, unsigned int buff_size);
+		static const char* NextRecord(const char* ptr, char* rec, unsigned int size);
 //Lights and Smoke Toggles
 		bool ToggleSmoke(void);
 		bool ToggleLandLights(void);
@@ -323,23 +510,32 @@ class C_DeviceLink
 		bool ToggleHook(void);
 		bool Query_LvlStab(void);
 		int Get_LvlStab(void);
+		int Get_LvlStab(double max_age);
 		bool Set_LvlStab(void);
 		float Get_Overload(void);
+		float Get_Overload(double max_age);
 		float Get_ShakeLvl(void);
+		float Get_ShakeLvl(double max_age);
 
 //Cockpit/Gunner station functions
 		bool Query_Canopy(void);
 		bool Set_Canopy(void);
 		int Get_Canopy(void);
+		int Get_Canopy(double max_age);
 		int GetNumOfCockpits(void);
 		int GetCurCockpit(void);
 		bool Query_Gunner(void);
 		bool Set_Gunner(const char* code);
 		int Get_Gunner(void);
+		int Get_Gunner(double max_age);
 		bool JumpToCockpit(const int pitnum);
 //Landing Gear methods
 		bool Gear_Is_Up(void);
 		float GetGearPos(char* gearcode);
+		float GetGearPos(char* gearcode, double max_age);
+		bool SetAllGear(void);
+		bool Get_Gear(float* status, float* left, float* right, float* center, double max_age);
+		float Get_GearStatus(double max_age);
 		bool ToggleGear(void);		
 		bool SetGearDown(void);
 		bool SetGearUp(void);
@@ -347,14 +543,78 @@ class C_DeviceLink
 		bool ManualGearDown(void);
 		bool Query_Chocks(void);
 		int Get_Chocks(void);
+		int Get_Chocks(double max_age);
 		bool Set_Chocks(void);
 //Misc utility functions
 		bool HasData(void);
 		bool IsInitialized(void);
 		bool GetDLVersion(char* verstr, unsigned int buff_size = 64);
 		bool ValidGet(const char* code);
+//Max-age cache methods
+		bool Prefetch(DLParam param, double max_age, const int eng_num = 0);
+		bool RefreshPending(void);
+		double GetAge(DLParam param, const int eng_num = 0);
+//Polling scheduler methods
+		bool SetPollRate(DLParam param, double period, const int eng_num = 0);
+		bool PollTick(void);
+		double NextPollDue(void);
+		bool GetPollStats(DLParam param, DLPollStats* stats, const int eng_num = 0);
+		void ResetPollStats(void);
+//Polling thread methods
+		bool StartPollThread(double period, int priority = 0, int cpu = -1);
+		void StopPollThread(void);
+		bool IsPollThreadRunning(void);
+		void GetPollThreadStats(DLPollThreadStats* stats);
+		void ResetPollThreadStats(void);
+//Busy-poll receive methods
+		bool EnableBusyPoll(bool enable, double budget = 0.2, int sock_us = 0);
+		void GetRttStats(DLRttStats* stats);
+		void ResetRttStats(void);
+//Attitude estimator methods
+		void EnableAttitudeEstimator(bool enable, double max_extrap = 100.0);
+		bool EstimateAttitude(double t, float* pitch, float* roll, float* azimuth);
+//Switch snapshot methods
+		bool SetAllSwitches(void);
+		unsigned long Get_Switches(void);
+		unsigned long Get_SwitchesValid(void);
+//Toggle layer methods
+		bool SetToggle(DLToggle toggle, bool on);
+		void CancelToggle(DLToggle toggle);
+		bool ToggleTick(void);
+		DLToggleState GetToggleState(DLToggle toggle);
+		void SetToggleTimeout(double timeout, int tries = DL_TOGGLE_TRIES);
+//Aircraft profile methods
+		bool RefreshProfile(void);
+		void InvalidateProfile(void);
+		void SetProfileCheck(double period);
+//Control frame methods
+		void EnableControlFrame(bool enable);
+		bool FlushControls(void);
+		void GetControlStats(DLControlStats* stats);
+		void ResetControlStats(void);
+		bool SetControlPolicy(DLControl ctrl, const DLControlPolicy* policy);
+		bool GetControlPolicy(DLControl ctrl, DLControlPolicy* policy);
+		void EnablePiggyback(bool enable, double budget = 20.0);
+//Lock-free queue methods
+		void EnableUpdateQueue(bool enable);
+		unsigned int PopUpdates(DLRecord* recs, unsigned int max);
+		void SetUpdateCallback(DLUpdateCallback callback, void* user);
+		unsigned int DispatchUpdates(void);
+		unsigned long GetDroppedUpdates(void);
+		void EnableControlQueue(bool enable);
+//Executor methods
+		void SetExecutor(C_DLExecutor* exec);
+		bool Submit(DLTaskFunc fn, void* arg);
+//Lock statistics methods
+		void EnableLockStats(bool enable);
+		void GetLockStats(MC_LockStats* stats);
+		void ResetLockStats(void);
+//Shared memory export methods
+		bool ExportShm(const char* name = DL_SHM_NAME);
+		void CloseShm(void);
 //Engine Methods
 		bool Set_Engine_Data(const int eng_num);
+		bool SetAllEngineData(void);
 		bool Set_RPM(const int eng_num);
 		bool Set_Temp_Cyl(const int eng_num);
 		bool Set_Temp_Oilin(const int eng_num);
@@ -362,12 +622,19 @@ class C_DeviceLink
 		bool Set_Temp_Water(const int eng_num);
 		bool Set_Manifold(const int eng_num);
 		float Get_RPM(const int eng_num);
+		float Get_RPM(const int eng_num, double max_age);
 		float Get_Temp_Cyl(const int eng_num);
+		float Get_Temp_Cyl(const int eng_num, double max_age);
 		float Get_Temp_Oilin(const int eng_num);
+		float Get_Temp_Oilin(const int eng_num, double max_age);
 		float Get_Temp_Oilout(const int eng_num);
+		float Get_Temp_Oilout(const int eng_num, double max_age);
 		float Get_Temp_Water(const int eng_num);
+		float Get_Temp_Water(const int eng_num, double max_age);
 		float Get_Manifold(const int eng_num);
+		float Get_Manifold(const int eng_num, double max_age);
 		int Get_WEP(void);
+		int Get_WEP(double max_age);
 		bool SuperChgNxt(const int eng_num);
 		bool SuperChgPrv(const int eng_num);
 		bool ToggleWEP(void);
@@ -394,19 +661,31 @@ class C_DeviceLink
 		bool StartEng3(void);
 		bool StartEng4(void);
 		int GetMags(const int eng_num);
+		int Get_Magneto(const int eng_num);
 		int GetNumEngines(void);		
 // Instrument methods	
 		float Get_IAS(void);
+		float Get_IAS(double max_age);
 		float Get_Alt(void);
+		float Get_Alt(double max_age);
 		float Get_AngSpd(void);
+		float Get_AngSpd(double max_age);
 		float Get_Azimuth(void);
+		float Get_Azimuth(double max_age);
 		float Get_BeaconAzimuth(void);
+		float Get_BeaconAzimuth(double max_age);
 		float Get_Pitch(void);
+		float Get_Pitch(double max_age);
 		float Get_Roll(void);
+		float Get_Roll(double max_age);
 		float Get_Slip(void);
+		float Get_Slip(double max_age);
 		float Get_Turn(void);
+		float Get_Turn(double max_age);
 		float Get_Vario(void);
+		float Get_Vario(double max_age);
 		float Get_Fuel(void);
+		float Get_Fuel(double max_age);
 		bool Set_IAS(void);
 		bool Set_Alt(void);
 		void Set_AngSpd(void);
@@ -421,55 +700,73 @@ class C_DeviceLink
 		bool SetAllInstruments(void);
 // Controls Methods
 		float Get_Aileron(void);
+		float Get_Aileron(double max_age);
 		bool Query_Aileron(void);
 		bool Set_Aileron(float pos);
 		float Get_Elevator(void);
+		float Get_Elevator(double max_age);
 		bool Query_Elevator(void);
 		bool Set_Elevator(float pos);
 		float Get_Rudder(void);
+		float Get_Rudder(double max_age);
 		bool Query_Rudder(void);
 		bool Set_Rudder(float pos);
 		float Get_Power(const int eng_idx);
+		float Get_Power(const int eng_idx, double max_age);
 		bool Query_Power(const int eng_idx);
 		bool Set_Power(const int eng_idx,float pos);
 		float Get_PropPitch(const int eng_idx);
+		float Get_PropPitch(const int eng_idx, double max_age);
 		bool Query_PropPitch(const int eng_idx);
 		bool Set_PropPitch(const int eng_idx,float pos);
+		bool Query_EngineControls(void);
+		bool Set_EngineControls(unsigned char eng_mask, const float* power, const float* pitch);
 		float Get_Brakes(void);
+		float Get_Brakes(double max_age);
 		bool Query_Brakes(void);
 		bool Set_Brakes(float pos);
 		float Get_AilTrim(void);
+		float Get_AilTrim(double max_age);
 		bool Query_AilTrim(void);
 		bool Set_AilTrim(float pos);
 		float Get_ElvTrim(void);
+		float Get_ElvTrim(double max_age);
 		bool Query_ElvTrim(void);
 		bool Set_ElvTrim(float pos);
 		float Get_RudTrim(void);
+		float Get_RudTrim(double max_age);
 		bool Query_RudTrim(void);
 		bool Set_RudTrim(float pos);
 		float Get_Flaps(void);
+		float Get_Flaps(double max_age);
 		bool Query_Flaps(void);
 		bool Set_Flaps(float pos);
 		bool Query_Airbrakes(void);
 		int Get_Airbrakes(void);
+		int Get_Airbrakes(double max_age);
 		bool Set_Airbrakes(void);
 		bool Query_Tailwheel(void);
 		int Get_Tailwheel(void);
+		int Get_Tailwheel(double max_age);
 		bool Set_Tailwheel(void);
 		bool Set_CowlFlaps(void);
 		bool Query_WingFold(void);
 		int Get_WingFold(void);
+		int Get_WingFold(double max_age);
 		bool Set_WingFold(void);
 		bool Query_TailHook(void);
 		int Get_TailHook(void);
+		int Get_TailHook(double max_age);
 		bool Set_TailHook(void);
 
 // Weapons Methods
 		int Get_Weapon(WeapType weap);
+		int Get_Weapon(WeapType weap, double max_age);
 		bool Query_Weapon(WeapType weap);
 		bool Set_Weapon(WeapType weap, int ival);
 		bool Query_GunPods(void);
 		int GetGunPodsState(void);
+		int GetGunPodsState(double max_age);
 		bool ToggleGunPods(void);
 		bool ToggleBombSight(void);
 		bool IncSightDist(void);
@@ -483,17 +780,57 @@ class C_DeviceLink
 
 
 	private:
-		/// struct for containing the various engine data.
+		C_DeviceLink(const C_DeviceLink&); //!< not copyable. A session owns its socket and lock
+		C_DeviceLink& operator=(const C_DeviceLink&); //!< not copyable
+		DL_CritSection m_critsec; //!< this session's lock. Sessions never wait for each other
+		/// struct for keeping the recent history of one attitude angle
+		struct m_att_type
+		{
+			double t[DL_ATT_HISTORY]; //!< receive stamps, oldest overwritten first
+			float val[DL_ATT_HISTORY]; //!< the angle received at each stamp
+			unsigned int head; //!< slot the next sample goes in
+			unsigned int count; //!< number of valid samples
+		};
+		/// struct for one control slot of the control frame
+		struct m_ctrl_type
+		{
+			float value; //!< the last value written
+			bool pending; //!< TRUE if value hasn't been sent yet
+			double written; //!< MC_Timer::Now() of the first write since the last send
+			bool ever_sent; //!< TRUE once a value has been sent
+			float sent_value; //!< the last value sent
+			double sent_time; //!< MC_Timer::Now() of the last send
+			double rate_start; //!< start of the current one second max_rate window
+			unsigned int rate_cnt; //!< sends in the current max_rate window
+		};
+		/// struct for keeping the schedule and timing of a polled value
+		struct m_poll_type
+		{
+			double period; //!< poll period in ms. 0 means not scheduled
+			double due; //!< MC_Timer::Now() when the value is next due
+			double last; //!< stamp of the last value PollTick() received
+			unsigned long polls; //!< values received
+			unsigned long misses; //!< values sent but not received
+			unsigned long intervals; //!< number of intervals summed in sum_interval
+			double sum_interval; //!< sum of the intervals between received values
+			double sum_jitter; //!< sum of the absolute jitter
+			double max_jitter; //!< worst absolute jitter
+		};
+		/*! \brief struct for containing the various engine data.
+			\note Laid out as one array per reading, indexed by engine, so a gauge
+			walking all the engines for one reading touches contiguous memory.
+		*/
 		struct m_engine_type
 		{
-			float rpm; //!< stores an engine's RPM value
-			float manifold; //!< stores an engine's manifold pressure
-			float temp_oilin; //!< stores an engine's Oil In temperature
-			float temp_oilout; //!< stores an engine's Oil Out tempature
-			float temp_water; //!< stores an engine's water tempature
-			float temp_cylinders; //!< stores an engine's cylinders temperature
-			float power; //!< stores the engine's power setting
-			float prop_pitch; //!< stores the prop pitch of the engine
+			float rpm[DL_MAX_ENGINES]; //!< stores each engine's RPM value
+			float manifold[DL_MAX_ENGINES]; //!< stores each engine's manifold pressure
+			float temp_oilin[DL_MAX_ENGINES]; //!< stores each engine's Oil In temperature
+			float temp_oilout[DL_MAX_ENGINES]; //!< stores each engine's Oil Out tempature
+			float temp_water[DL_MAX_ENGINES]; //!< stores each engine's water tempature
+			float temp_cylinders[DL_MAX_ENGINES]; //!< stores each engine's cylinders temperature
+			float power[DL_MAX_ENGINES]; //!< stores each engine's power setting
+			float prop_pitch[DL_MAX_ENGINES]; //!< stores the prop pitch of each engine
+			int magneto[DL_MAX_ENGINES]; //!< stores each engine's magneto setting 0-3
 		};
 		int m_weap[5]; //!< array for storing the state of the weapons
 		float m_ias; //!< priv var for indicated airspeed 0--infinite
@@ -524,7 +861,35 @@ class C_DeviceLink
 		int m_tailhook; //!< stores whether the tail hook is deployed or not. 0 or 1.
 		int m_chocks; //!< stores whether the chocks are in or out. 0 or 1
 		int m_gunner; //!< stores whether the gunner is firing or not. 0 or 1.
+		float m_overload; //!< stores the last overload value
+		float m_shake; //!< stores the last shake level. 0.00 to 1.00 range
+		int m_wep; //!< stores the WEP state of the selected engine. 0 or 1
+		int m_feather; //!< stores the feather state of the selected engine. 0 or 1
+		float m_gear_status; //!< stores the gear status. 0.00 is up
+		float m_gear_left; //!< stores the left leg position. 0.00 to 1.00 range
+		float m_gear_right; //!< stores the right leg position. 0.00 to 1.00 range
+		float m_gear_center; //!< stores the center leg position. 0.00 to 1.00 range
+		unsigned long m_switches; //!< every discrete state packed one bit per DLSwitch
+		unsigned long m_switches_valid; //!< bit set for each DLSwitch that has been received at least once
+		/*! \brief What the toggle layer wants from one subsystem and what it has sent so far.
+		*/
+		struct m_toggle_type
+		{
+			DLToggleState state; //!< where the subsystem is
+			bool on; //!< the wanted state
+			double sent; //!< MC_Timer::Now() of the last toggle sent. 0 if none yet
+			int tries; //!< toggles sent for the current wanted state
+		};
+		struct m_toggle_type m_toggle[DLT_COUNT]; //!< toggle layer state of each subsystem
+		double m_toggle_timeout; //!< ms before an unconfirmed toggle is checked and tried again
+		int m_toggle_tries; //!< most toggles sent for one wanted state
+		bool toggle_read_due(DLToggle toggle, double now);
 		char m_dl_ver[32]; //!< private variable for holding the devicelink version number
+		char m_plane[64]; //!< cached aircraft id from DL_GET_PLANE
+		int m_num_cockpits; //!< cached number of cockpits from DL_GET_COCKPITS
+		double m_profile_stamp; //!< MC_Timer::Now() the aircraft profile was loaded. 0 means not loaded
+		double m_profile_checked; //!< MC_Timer::Now() the plane id was last confirmed. 0 forces a check
+		double m_profile_check; //!< ms between plane id checks. 0 disables the periodic check
 		bool m_readdata; //!< flag to indicate whether any data was actually read from the buffer
 		FILE *dl_output; //!< filename for the debug file output.
 		bool m_initialized; //!< flag to indicate whether the devicelink object has been initialized
@@ -534,29 +899,125 @@ class C_DeviceLink
 		struct sockaddr_in m_this_end; //!< struct for socket ops
 		struct sockaddr_in m_other_end; //!< struct for socket ops
 		SOCKET m_sock; //!< stores the socket number
-		char m_cmd[64]; //!< buffer for sotring a command string to be sent to the game
-		char m_buff[256]; //!< buffer for storing what we read from the UDP socket.
-		unsigned int m_ret_cnt; //!< a count of the expected number of returned values from a function call.
+		char m_cmd[DL_MAX_QUERY]; //!< buffer for sotring a command string to be sent to the game
+		char m_buff[DL_MAX_REPLY]; //!< the last packet read from the UDP socket, for ReadMsg() callers
+		/*! \brief One query waiting for its answer.
+			\note Lives on the stack of the thread that sent it and is linked into m_requests
+			until it returns, so concurrent queries never share a command or a result buffer.
+		*/
+		struct m_request_type
+		{
+			char keys[DL_MAX_QUERY]; //!< the codes sent, without the leading "R/"
+			char* reply; //!< receives the answer records routed to this query. May be NULL
+			unsigned int size; //!< size of reply
+			unsigned int len; //!< bytes used in reply
+			unsigned int expected; //!< key/value pairs the game should answer with
+			unsigned int got; //!< key/value pairs routed to this query so far
+			unsigned char answered[DL_MAX_QUERY / 2]; //!< nonzero for each code of keys already answered, in order
+			struct m_request_type* next; //!< next query in flight, oldest first
+		};
+		struct m_request_type* m_requests; //!< queries in flight, oldest first
+		bool send_packet(const char* code);
+		unsigned int request(struct m_request_type* req);
+		int recv_route(double wait_ms);
+		int read_route(void);
+		bool m_busy; //!< TRUE when recv_route() spins before it blocks
+		double m_busy_budget; //!< longest spin in ms of one recv_route()
+		int m_busy_sock_us; //!< SO_BUSY_POLL of the socket in microseconds. 0 leaves it alone
+		bool set_busy_sock(void);
+		DLRttStats m_rtt; //!< round-trip and spin statistics
+		double m_rtt_sum; //!< sum of every round trip in m_rtt
+		void rtt_record(double rtt);
+		void route_reply(const char* buff);
 		
 		bool setengfloats(const int eng_num, const char* code, float *engine_part);
 		float getengfloats(const int eng_num, float *engine_part);
-		bool getparamval(const char* code, char* strval, unsigned int buff_size = 64);
 		bool querystring(const char* code, char* qstr, unsigned int buff_size = 64);
 		float queryfloat(const char* code);
-		void getval(const char* code, float* val);
-		void getval(const char* code, int* val);
 		int queryint(const char* code);
 		bool set_command_buff(const char* code);
 		bool get_cmd_buff(char* temp_buff, unsigned int buff_size = 64);
 		bool toggleswitch(const char* code);
-		struct m_engine_type m_engine[4];
+		struct m_engine_type m_engine; //!< the cached data for every engine
+		int m_num_engines; //!< number of engines reported by GetNumEngines(). 0 until queried
+		double m_stamp[DLP_COUNT][DL_MAX_ENGINES]; //!< MC_Timer::Now() of the last received value. 0 means never received
+		unsigned char m_pending[DLP_COUNT]; //!< bitmask of engine slots waiting for the next RefreshPending(). bit 0 for non-engine values
+		struct m_poll_type m_poll[DLP_COUNT][DL_MAX_ENGINES]; //!< polling schedule and jitter statistics
+#ifdef _WIN32
+		HANDLE m_pt_handle; //!< the polling thread. NULL when not running
+		static DWORD WINAPI poll_thread_entry(LPVOID arg);
+#else
+		pthread_t m_pt_handle; //!< the polling thread. valid while m_pt_started
+		static void* poll_thread_entry(void* arg);
+#endif
+		bool m_pt_started; //!< TRUE between StartPollThread() and StopPollThread()
+		volatile bool m_pt_run; //!< cleared by StopPollThread() to end the thread at its next wake
+		double m_pt_period; //!< tick period of the polling thread in ms
+		int m_pt_priority; //!< requested real-time priority. 0 for none
+		int m_pt_cpu; //!< requested CPU. -1 for any
+		DLPollThreadStats m_pt_stats; //!< timing statistics of the polling thread
+		double m_pt_sum_jitter; //!< sum of the jitter of every measured interval
+		double m_pt_sum_work; //!< sum of the time spent in every PollTick()
+		unsigned long m_pt_intervals; //!< intervals measured since ResetPollThreadStats()
+		void poll_thread(void);
+		void pt_schedule(void);
+		void pt_record(double wake, double last, unsigned long missed, double work);
+		struct m_att_type m_att[3]; //!< pitch, roll and azimuth history for EstimateAttitude()
+		bool m_att_enabled; //!< flag to indicate whether the attitude history is being recorded
+		double m_att_max_extrap; //!< longest time in ms EstimateAttitude() will extrapolate past the newest sample
+		DL_ShmSnapshot* m_shm; //!< segment mapped by ExportShm(). NULL when not exporting
+		void* m_shm_handle; //!< file mapping handle on Win32. unused elsewhere
+		char m_shm_name[64]; //!< name passed to ExportShm(), needed to remove the segment
+		int m_shm_depth; //!< nesting count of shm_begin() so a whole A packet is published as one update
+		bool check_profile(void);
+		void shm_begin(void);
+		void shm_end(void);
+		float param_value(DLParam param, const int eng_num);
+		void push_attitude(DLParam param, double stamp);
+		float estimate_angle(int chan, double t, float rate_hint, bool use_hint);
+		DLParam find_param(const char* code);
+		void stamp_param(DLParam param, const int eng_num = 0);
+		bool store_param(DLParam param, const int eng_num, const char* strval);
+		void refresh_if_stale(DLParam param, double max_age, const int eng_num = 0);
+		unsigned int parse_reply(const char* buff);
+		unsigned int querybatch(const char* keys, unsigned int expected);
 		void init_err(void);
 		void errmsg(const char* str);
 		bool set_has_read_data(bool flag);
 		bool set_read_buff(const char* temp_buff, unsigned int buff_size = 64);
-		bool get_read_buff(char* temp_buff, unsigned int buff_size = 64);
 		bool starteng(const char* seleng, const char* togeng);
-		bool setctrl(const char* code, float pos);
+		bool setctrl(DLControl ctrl, const int eng_num, float pos, bool flush = TRUE);
+		struct m_ctrl_type m_ctrl[DLC_COUNT][DL_MAX_ENGINES]; //!< pending control values for FlushControls()
+		bool m_ctrl_frame; //!< TRUE when the control Set_ methods only fill m_ctrl
+		DLControlPolicy m_ctrl_policy[DLC_COUNT]; //!< output policy of each control
+		unsigned long m_ctrl_filtered; //!< values dropped by the deadband since ResetControlStats()
+		unsigned long m_ctrl_held; //!< values held back by the rate limits since ResetControlStats()
+		unsigned long m_ctrl_refreshed; //!< values resent by the refresh policy since ResetControlStats()
+		bool ctrl_due(DLControl ctrl, struct m_ctrl_type* slot, double now);
+		unsigned int pack_controls(char* keys, unsigned int size, unsigned int* len, int* next, double now);
+		bool m_piggy; //!< TRUE when pending controls wait for the next poll packet
+		double m_piggy_budget; //!< longest a control may wait for a poll packet in ms
+		unsigned long m_ctrl_piggybacked; //!< values sent on poll packets since ResetControlStats()
+		unsigned long m_ctrl_writes; //!< control writes since ResetControlStats()
+		void ctrl_write(DLControl ctrl, const int eng_num, float pos, double when);
+		volatile bool m_ctrl_queue_on; //!< TRUE when control frame writes go through m_ctrl_queue
+		C_DLMpscRing<DLRecord, DL_CONTROL_QUEUE> m_ctrl_queue; //!< control writes waiting for drain_controls()
+		void drain_controls(void);
+		volatile bool m_update_queue_on; //!< TRUE when store_param() copies each value to m_updates
+		C_DLSpscRing<DLRecord, DL_UPDATE_QUEUE> m_updates; //!< received values waiting for PopUpdates(). pushed under m_critsec
+		unsigned long m_updates_dropped; //!< values lost because m_updates was full
+		DLUpdateCallback m_update_cb; //!< called by DispatchUpdates(). NULL if none
+		void* m_update_user; //!< passed to m_update_cb
+		C_DLExecutor* m_exec; //!< pool DispatchUpdates() and Submit() run on. NULL for none
+		C_DLStrand m_strand; //!< keeps this session's work on m_exec in order
+		bool m_exec_pending; //!< TRUE while a DispatchUpdates() task is queued and hasn't started
+		void exec_kick(void);
+		static void exec_dispatch(void* arg);
+		unsigned long m_ctrl_packets; //!< control packets since ResetControlStats()
+		unsigned long m_ctrl_sent; //!< control values sent since ResetControlStats()
+		double m_ctrl_since; //!< MC_Timer::Now() of the last ResetControlStats()
+		double m_ctrl_sum_latency; //!< sum of the write to send latency of every value sent
+		double m_ctrl_max_latency; //!< worst write to send latency
 				
 		void dl_strncpy(char * dest_str, char * src_str, unsigned int dest_size);//!< modified copy command to distinguish between VS2003 and VS2005 buffer handling.
 };
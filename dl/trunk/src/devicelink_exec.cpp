@@ -0,0 +1,499 @@
+/*! \file devicelink_exec.cpp
+	\brief The source file for the work-stealing executor.
+*/
+
+#include "devicelink.h"
+#include <string.h>
+#ifndef _WIN32
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#define DLX_INC(p) InterlockedIncrement(p) //!< full barrier increment, returns the new value
+#define DLX_DEC(p) InterlockedDecrement(p) //!< full barrier decrement, returns the new value
+#else
+#define DLX_INC(p) __sync_add_and_fetch((p), 1)
+#define DLX_DEC(p) __sync_sub_and_fetch((p), 1)
+#endif
+
+typedef MC_LockT<MC_SpinCritSection> DLX_Lock; //!< guards a strand or a worker's deque. Held for a few instructions only
+
+/*! \brief Constructor for C_DLStrand. The strand starts empty.
+*/
+C_DLStrand::C_DLStrand()
+{
+	m_head = 0;
+	m_tail = 0;
+	m_scheduled = FALSE;
+}
+
+/*! \brief Returns whether the strand has nothing queued and nothing running.
+\return \b boolean
+*/
+bool C_DLStrand::IsIdle(void)
+{
+	DLX_Lock m_Lock(&m_lock);
+	return ((m_scheduled == FALSE) && (m_head == m_tail));
+}
+
+/*! \brief Waits until every task submitted to the strand so far has run.
+\note Must not be called from one of the strand's own tasks.
+*/
+void C_DLStrand::Wait(void)
+{
+	while (IsIdle() == FALSE)
+	{
+#ifdef _WIN32
+		Sleep(1);
+#else
+		usleep(1000);
+#endif
+	}
+}
+
+/*! \brief Constructor for C_DLExecutor. No threads run until Start().
+*/
+C_DLExecutor::C_DLExecutor()
+{
+	m_worker = NULL;
+	m_count = 0;
+	m_run = 0;
+	m_ready = 0;
+	m_sleepers = 0;
+	m_next = 0;
+#ifdef _WIN32
+	m_wake = CreateSemaphore(NULL, 0, DL_EXEC_MAX_WORKERS, NULL);
+#else
+	pthread_mutex_init(&m_wake_mutex, NULL);
+	pthread_cond_init(&m_wake_cond, NULL);
+	m_wake_count = 0;
+#endif
+}
+
+/*! \brief Deconstructor. Stops the workers.
+*/
+C_DLExecutor::~C_DLExecutor()
+{
+	Stop();
+#ifdef _WIN32
+	if (m_wake != NULL)
+	{
+		CloseHandle(m_wake);
+	}
+#else
+	pthread_cond_destroy(&m_wake_cond);
+	pthread_mutex_destroy(&m_wake_mutex);
+#endif
+}
+
+/*! \brief Starts the worker threads.
+\param workers : number of threads. 0 starts one per processor
+\return \b boolean : FALSE if already started or a thread couldn't be created
+*/
+bool C_DLExecutor::Start(int workers)
+{
+	if ((m_worker != NULL) || (workers < 0))
+	{
+		return FALSE;
+	}
+	if (workers == 0)
+	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		workers = static_cast<int>(info.dwNumberOfProcessors);
+#else
+		workers = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+	}
+	if (workers < 1)
+	{
+		workers = 1;
+	}
+	if (workers > DL_EXEC_MAX_WORKERS)
+	{
+		workers = DL_EXEC_MAX_WORKERS;
+	}
+	m_worker = new m_worker_type[workers];
+	m_count = workers;
+	m_ready = 0;
+	m_run = 1;
+	double now = MC_Timer::Now();
+	for (int i = 0; i < workers; ++i)
+	{
+		m_worker[i].exec = this;
+		m_worker[i].index = i;
+		m_worker[i].top = 0;
+		m_worker[i].bottom = 0;
+		memset(&m_worker[i].stats, 0, sizeof(m_worker[i].stats));
+		m_worker[i].since = now;
+	}
+	for (int i = 0; i < workers; ++i)
+	{
+#ifdef _WIN32
+		m_worker[i].thread = CreateThread(NULL, 0, worker_entry, &m_worker[i], 0, NULL);
+		if (m_worker[i].thread == NULL)
+#else
+		if (pthread_create(&m_worker[i].thread, NULL, worker_entry, &m_worker[i]) != 0)
+#endif
+		{
+			m_count = i; //Stop() joins the ones that did start
+			Stop();
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*! \brief Stops the workers and waits for them to end.
+\note Stop submitting first. A worker finishes the strand it is running and any strand
+still ready before it ends, but tasks submitted after Stop() began are refused.
+*/
+void C_DLExecutor::Stop(void)
+{
+	if (m_worker == NULL)
+	{
+		return;
+	}
+	m_run = 0;
+	for (int i = 0; i < m_count; ++i)
+	{
+		wake_one();
+	}
+	for (int i = 0; i < m_count; ++i)
+	{
+#ifdef _WIN32
+		WaitForSingleObject(m_worker[i].thread, INFINITE);
+		CloseHandle(m_worker[i].thread);
+#else
+		pthread_join(m_worker[i].thread, NULL);
+#endif
+	}
+	delete [] m_worker;
+	m_worker = NULL;
+	m_count = 0;
+}
+
+/*! \brief Queues a task on a strand.
+\param strand : the strand. Its tasks run one at a time in the order submitted
+\param fn : the task
+\param arg : passed to fn
+\return \b boolean : FALSE if the executor isn't running or the strand already holds DL_STRAND_TASKS tasks
+\note Safe from any thread, tasks included. A strand that wasn't ready goes on a worker's deque,
+round robin, and wakes a sleeping worker.
+*/
+bool C_DLExecutor::Submit(C_DLStrand* strand, DLTaskFunc fn, void* arg)
+{
+	if ((strand == NULL) || (fn == NULL) || (m_run == 0))
+	{
+		return FALSE;
+	}
+	bool idle = FALSE;
+	{
+	DLX_Lock m_Lock(&strand->m_lock);
+	if ((strand->m_tail - strand->m_head) >= DL_STRAND_TASKS)
+	{
+		return FALSE;
+	}
+	C_DLStrand::m_task_type* task = &strand->m_task[strand->m_tail & (DL_STRAND_TASKS - 1)];
+	task->fn = fn;
+	task->arg = arg;
+	++strand->m_tail;
+	idle = (strand->m_scheduled == FALSE);
+	strand->m_scheduled = TRUE;
+	}
+	if (idle == TRUE)
+	{
+		schedule(static_cast<int>(static_cast<unsigned long>(DLX_INC(&m_next)) % m_count), strand, FALSE);
+	}
+	return TRUE;
+}
+
+/*! \brief Returns the number of worker threads. 0 when stopped.
+\return \b integer
+*/
+int C_DLExecutor::GetWorkerCount(void)
+{
+	return m_count;
+}
+
+/*! \brief Copies the utilization of one worker.
+\param worker : 0 to GetWorkerCount() - 1
+\param stats : receives the counters
+\return \b boolean : FALSE on an invalid worker
+*/
+bool C_DLExecutor::GetWorkerStats(int worker, DLWorkerStats* stats)
+{
+	if ((stats == NULL) || (m_worker == NULL) || (worker < 0) || (worker >= m_count))
+	{
+		return FALSE;
+	}
+	struct m_worker_type* w = &m_worker[worker];
+	DLX_Lock m_Lock(&w->lock);
+	memcpy(stats, &w->stats, sizeof(w->stats));
+	stats->elapsed = MC_Timer::Now() - w->since;
+	stats->utilization = (stats->elapsed > 0.00) ? (stats->busy_time / stats->elapsed) : 0.00;
+	return TRUE;
+}
+
+/*! \brief Zeroes the utilization counters of every worker.
+*/
+void C_DLExecutor::ResetStats(void)
+{
+	double now = MC_Timer::Now();
+	for (int i = 0; i < m_count; ++i)
+	{
+		DLX_Lock m_Lock(&m_worker[i].lock);
+		memset(&m_worker[i].stats, 0, sizeof(m_worker[i].stats));
+		m_worker[i].since = now;
+	}
+}
+
+#ifdef _WIN32
+DWORD WINAPI C_DLExecutor::worker_entry(LPVOID arg)
+#else
+void* C_DLExecutor::worker_entry(void* arg)
+#endif
+{
+	struct m_worker_type* self = static_cast<struct m_worker_type*>(arg);
+	self->exec->worker(self);
+	return 0;
+}
+
+/*! \brief Body of a worker. Runs its own strands, steals when it has none and sleeps when nobody has any.
+*/
+void C_DLExecutor::worker(struct m_worker_type* self)
+{
+	for (;;)
+	{
+		bool stolen = FALSE;
+		C_DLStrand* strand = pop(self);
+		if (strand == NULL)
+		{
+			strand = steal(self);
+			stolen = (strand != NULL);
+		}
+		if (strand == NULL)
+		{
+			if (m_run == 0)
+			{
+				break;
+			}
+			{
+			DLX_Lock m_Lock(&self->lock);
+			++self->stats.sleeps;
+			}
+			idle_wait();
+			continue;
+		}
+		bool more = FALSE;
+		double start = MC_Timer::Now();
+		unsigned int cnt = run_strand(strand, &more);
+		double busy = MC_Timer::Now() - start;
+		{
+		DLX_Lock m_Lock(&self->lock);
+		self->stats.tasks += cnt;
+		++self->stats.strands;
+		if (stolen == TRUE)
+		{
+			++self->stats.steals;
+		}
+		self->stats.busy_time += busy;
+		}
+		if (more == TRUE)
+		{
+			schedule(self->index, strand, TRUE); //behind its neighbours, and first in line for a thief
+		}
+	}
+}
+
+/*! \brief Puts a ready strand on a worker's deque.
+\param index : the worker
+\param strand : the strand
+\param oldest : TRUE to put it at the end thieves take from, FALSE at the end the owner takes from
+\return \b boolean : FALSE if the deque is full
+*/
+bool C_DLExecutor::push(int index, C_DLStrand* strand, bool oldest)
+{
+	struct m_worker_type* w = &m_worker[index];
+	{
+	DLX_Lock m_Lock(&w->lock);
+	if ((w->bottom - w->top) >= DL_EXEC_MAX_STRANDS)
+	{
+		return FALSE;
+	}
+	if (oldest == TRUE)
+	{
+		--w->top;
+		w->deque[w->top & (DL_EXEC_MAX_STRANDS - 1)] = strand;
+	} else
+	{
+		w->deque[w->bottom & (DL_EXEC_MAX_STRANDS - 1)] = strand;
+		++w->bottom;
+	}
+	}
+	DLX_INC(&m_ready);
+	return TRUE;
+}
+
+/*! \brief Puts a ready strand on a deque, the given worker's if it has room, and wakes a sleeper.
+\param index : the preferred worker
+\param strand : the strand
+\param oldest : passed to push()
+\note A strand sits in at most one deque, so this only has to try other workers when more
+than DL_EXEC_MAX_STRANDS strands are ready on one of them.
+*/
+void C_DLExecutor::schedule(int index, C_DLStrand* strand, bool oldest)
+{
+	int i = 0;
+	while (push((index + i) % m_count, strand, oldest) == FALSE)
+	{
+		if ((++i % m_count) == 0)
+		{
+#ifdef _WIN32
+			Sleep(0);
+#else
+			sched_yield();
+#endif
+		}
+	}
+	if (m_sleepers > 0)
+	{
+		wake_one();
+	}
+}
+
+/*! \brief Takes the newest strand from a worker's own deque.
+\return \b C_DLStrand* : NULL if the deque is empty
+*/
+C_DLStrand* C_DLExecutor::pop(struct m_worker_type* self)
+{
+	C_DLStrand* strand = NULL;
+	{
+	DLX_Lock m_Lock(&self->lock);
+	if (self->bottom == self->top)
+	{
+		return NULL;
+	}
+	--self->bottom;
+	strand = self->deque[self->bottom & (DL_EXEC_MAX_STRANDS - 1)];
+	}
+	DLX_DEC(&m_ready);
+	return strand;
+}
+
+/*! \brief Takes the oldest strand from another worker's deque, trying each once.
+\return \b C_DLStrand* : NULL if every other deque is empty
+*/
+C_DLStrand* C_DLExecutor::steal(struct m_worker_type* self)
+{
+	if (m_ready <= 0)
+	{
+		return NULL;
+	}
+	for (int i = 1; i < m_count; ++i)
+	{
+		struct m_worker_type* victim = &m_worker[(self->index + i) % m_count];
+		C_DLStrand* strand = NULL;
+		{
+		DLX_Lock m_Lock(&victim->lock);
+		if (victim->bottom == victim->top)
+		{
+			continue;
+		}
+		strand = victim->deque[victim->top & (DL_EXEC_MAX_STRANDS - 1)];
+		++victim->top;
+		}
+		DLX_DEC(&m_ready);
+		return strand;
+	}
+	return NULL;
+}
+
+/*! \brief Runs up to DL_STRAND_BATCH tasks of a strand, in order.
+\param strand : the strand, taken off a deque by this worker
+\param more : receives TRUE if tasks are left and the strand must go back on a deque
+\return \b unsigned \b int : tasks run
+\note The strand lock is only held to take each task, never while one runs, so a task may
+submit to its own strand.
+*/
+unsigned int C_DLExecutor::run_strand(C_DLStrand* strand, bool* more)
+{
+	unsigned int cnt = 0;
+	*more = FALSE;
+	for (;;)
+	{
+		C_DLStrand::m_task_type task;
+		{
+		DLX_Lock m_Lock(&strand->m_lock);
+		if (strand->m_head == strand->m_tail)
+		{
+			strand->m_scheduled = FALSE; //the next Submit() schedules it again
+			return cnt;
+		}
+		if (cnt >= DL_STRAND_BATCH)
+		{
+			*more = TRUE;
+			return cnt;
+		}
+		task = strand->m_task[strand->m_head & (DL_STRAND_TASKS - 1)];
+		++strand->m_head;
+		}
+		task.fn(task.arg);
+		++cnt;
+	}
+}
+
+/*! \brief Wakes one worker sleeping in idle_wait().
+*/
+void C_DLExecutor::wake_one(void)
+{
+#ifdef _WIN32
+	ReleaseSemaphore(m_wake, 1, NULL);
+#else
+	pthread_mutex_lock(&m_wake_mutex);
+	if (m_wake_count < DL_EXEC_MAX_WORKERS)
+	{
+		++m_wake_count;
+	}
+	pthread_cond_signal(&m_wake_cond);
+	pthread_mutex_unlock(&m_wake_mutex);
+#endif
+}
+
+/*! \brief Sleeps until a strand is scheduled, Stop() is called or DL_EXEC_IDLE_WAIT passes.
+\note The sleeper count goes up before m_ready is checked and schedule() checks the sleeper
+count after m_ready goes up, both with full barriers, so one of the two always sees the other.
+*/
+void C_DLExecutor::idle_wait(void)
+{
+	DLX_INC(&m_sleepers);
+#ifdef _WIN32
+	if ((m_ready <= 0) && (m_run != 0))
+	{
+		WaitForSingleObject(m_wake, DL_EXEC_IDLE_WAIT);
+	}
+#else
+	pthread_mutex_lock(&m_wake_mutex);
+	if ((m_wake_count == 0) && (m_ready <= 0) && (m_run != 0))
+	{
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += DL_EXEC_IDLE_WAIT * 1000000L;
+		if (until.tv_nsec >= 1000000000L)
+		{
+			++until.tv_sec;
+			until.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&m_wake_cond, &m_wake_mutex, &until);
+	}
+	if (m_wake_count > 0)
+	{
+		--m_wake_count;
+	}
+	pthread_mutex_unlock(&m_wake_mutex);
+#endif
+	DLX_DEC(&m_sleepers);
+}
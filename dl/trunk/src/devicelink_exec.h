@@ -0,0 +1,142 @@
+/*! \file devicelink_exec.h
+	\brief The header for the work-stealing executor that runs per-session work on a pool of threads.
+
+	Work is submitted to a strand. A strand runs its tasks one at a time in the order they
+	were submitted, so everything belonging to one session stays ordered, but different
+	strands run on whichever worker is free. Each worker keeps a deque of the strands that
+	are ready; it takes its own newest first and, when it runs dry, steals the oldest from
+	another worker. A session with a lot to do therefore doesn't hold up the idle ones.
+*/
+#pragma once
+#ifdef _WIN32
+#include "windows.h"
+#else
+#include <pthread.h>
+#endif
+#include "mc_lock.h"
+#include "mc_timer.h"
+
+#define DL_EXEC_MAX_WORKERS 64 //!< most worker threads one executor starts
+#define DL_EXEC_MAX_STRANDS 1024 //!< most strands that can be ready at once on one worker
+#define DL_STRAND_TASKS 256 //!< most tasks one strand holds. power of two
+#define DL_STRAND_BATCH 16 //!< most tasks a worker runs from one strand before it lets the others in
+#define DL_EXEC_IDLE_WAIT 10 //!< ms an idle worker sleeps before it looks for work again
+
+typedef void (*DLTaskFunc)(void* arg); //!< a task. Runs on a worker thread
+
+/*! \brief Utilization of one worker since the last ResetStats(). Times are in milliseconds.
+*/
+struct DLWorkerStats
+{
+	unsigned long tasks; //!< tasks run
+	unsigned long strands; //!< strand turns taken, each up to DL_STRAND_BATCH tasks
+	unsigned long steals; //!< strand turns taken from another worker's deque
+	unsigned long sleeps; //!< times the worker found no work and slept
+	double busy_time; //!< time spent running tasks
+	double elapsed; //!< time since the last ResetStats()
+	double utilization; //!< busy_time / elapsed, 0 to 1
+};
+
+class C_DLExecutor;
+
+/*!	\brief An ordered queue of tasks, typically one per session.
+	\note A strand must outlive the tasks submitted to it. Call Wait() before destroying one
+	that may still have work queued.
+*/
+class C_DLStrand
+{
+	public:
+		C_DLStrand();
+		void Wait(void);
+		bool IsIdle(void);
+
+	private:
+		friend class C_DLExecutor;
+		/// one queued task
+		struct m_task_type
+		{
+			DLTaskFunc fn; //!< the function
+			void* arg; //!< its argument
+		};
+		typedef char size_must_be_a_power_of_two[((DL_STRAND_TASKS & (DL_STRAND_TASKS - 1)) == 0) ? 1 : -1];
+		MC_SpinCritSection m_lock; //!< guards the tasks and the scheduled flag
+		struct m_task_type m_task[DL_STRAND_TASKS]; //!< the tasks, a ring
+		unsigned long m_head; //!< next task to run
+		unsigned long m_tail; //!< next free slot
+		bool m_scheduled; //!< TRUE while the strand sits in a deque or a worker is running it
+
+		C_DLStrand(const C_DLStrand&); //!< not copyable
+		C_DLStrand& operator=(const C_DLStrand&); //!< not copyable
+};
+
+/*!	\brief A pool of worker threads that balance strands between them by work stealing.
+	- Example:
+	*	- C_DLExecutor exec;\n
+	*	- exec.Start(0);\n
+	*	- dl.SetExecutor(&exec);\n
+	*	- ... every session's DispatchUpdates() now runs on the pool ...\n
+	*	- dl.SetExecutor(NULL);\n
+	*	- exec.Stop();\n
+	*	.
+*/
+class C_DLExecutor
+{
+	public:
+		C_DLExecutor();
+		~C_DLExecutor();
+		bool Start(int workers = 0);
+		void Stop(void);
+		bool Submit(C_DLStrand* strand, DLTaskFunc fn, void* arg);
+		int GetWorkerCount(void);
+		bool GetWorkerStats(int worker, DLWorkerStats* stats);
+		void ResetStats(void);
+
+	private:
+		/// one worker thread and its deque of ready strands
+		struct m_worker_type
+		{
+			C_DLExecutor* exec; //!< back pointer for the thread entry
+			int index; //!< position in m_worker
+#ifdef _WIN32
+			HANDLE thread; //!< the thread
+#else
+			pthread_t thread; //!< the thread
+#endif
+			MC_SpinCritSection lock; //!< guards the deque and the stats
+			C_DLStrand* deque[DL_EXEC_MAX_STRANDS]; //!< ready strands, a ring. the owner pops the newest, thieves the oldest
+			unsigned long top; //!< oldest strand, where thieves take from
+			unsigned long bottom; //!< one past the newest strand, where the owner pushes and pops
+			DLWorkerStats stats; //!< utilization counters
+			double since; //!< MC_Timer::Now() of the last ResetStats()
+		};
+		typedef char deque_must_be_a_power_of_two[((DL_EXEC_MAX_STRANDS & (DL_EXEC_MAX_STRANDS - 1)) == 0) ? 1 : -1];
+		struct m_worker_type* m_worker; //!< the workers. NULL when stopped
+		int m_count; //!< number of workers
+		volatile long m_run; //!< 1 while the workers should keep going
+		volatile long m_ready; //!< strands sitting in deques, all workers together
+		volatile long m_sleepers; //!< workers waiting for work
+		volatile long m_next; //!< round robin counter for submissions from outside the pool
+#ifdef _WIN32
+		HANDLE m_wake; //!< semaphore sleeping workers wait on
+#else
+		pthread_mutex_t m_wake_mutex; //!< guards m_wake_count
+		pthread_cond_t m_wake_cond; //!< sleeping workers wait on this
+		long m_wake_count; //!< wakes posted and not yet taken
+#endif
+#ifdef _WIN32
+		static DWORD WINAPI worker_entry(LPVOID arg);
+#else
+		static void* worker_entry(void* arg);
+#endif
+		void worker(struct m_worker_type* self);
+		bool push(int index, C_DLStrand* strand, bool oldest);
+		void schedule(int index, C_DLStrand* strand, bool oldest);
+		C_DLStrand* pop(struct m_worker_type* self);
+		C_DLStrand* steal(struct m_worker_type* self);
+		unsigned int run_strand(C_DLStrand* strand, bool* more);
+		void wake_one(void);
+		void idle_wait(void);
+
+		C_DLExecutor(const C_DLExecutor&); //!< not copyable
+		C_DLExecutor& operator=(const C_DLExecutor&); //!< not copyable
+};
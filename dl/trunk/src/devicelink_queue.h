@@ -0,0 +1,194 @@
+/*! \file devicelink_queue.h
+	\brief Bounded lock-free ring queues for handing DeviceLink records between threads.
+
+	C_DLSpscRing has one producer and one consumer and never uses an atomic
+	read-modify-write. C_DLMpscRing takes any number of producers and one consumer,
+	and a producer claims its slot with a single compare-and-swap. Neither ever waits:
+	a push to a full queue and a pop from an empty one just return 0.
+*/
+#pragma once
+#ifdef _WIN32
+#include "windows.h"
+#if _MSC_VER >= 1400
+#include <intrin.h>
+#else
+extern "C" void _ReadWriteBarrier(void);
+#endif
+#pragma intrinsic(_ReadWriteBarrier)
+#define DLQ_BARRIER() _ReadWriteBarrier() //!< x86 keeps stores in order and loads in order, only the compiler needs fencing
+#define DLQ_CAS(p, o, n) InterlockedCompareExchange((p), (n), (o)) //!< returns the old value
+#else
+#define DLQ_BARRIER() __sync_synchronize()
+#define DLQ_CAS(p, o, n) __sync_val_compare_and_swap((p), (o), (n))
+#endif
+
+/*! \brief One value as it travels through a queue. 16 bytes, so four share a cache line.
+*/
+struct DLRecord
+{
+	unsigned short key; //!< a DLParam for received values, a DLControl for control writes
+	unsigned char eng; //!< engine index. 0 for values that aren't per engine
+	unsigned char flags; //!< free for the producer's use. 0 from the library
+	float value; //!< the value. Integer values are converted
+	double stamp; //!< MC_Timer::Now() when the value was received or written
+};
+
+/*!	\brief Bounded single producer, single consumer ring.
+	\note N must be a power of two. One slot is never used, so it holds N-1 items.
+	Push from one thread and pop from one thread; they may be different threads.
+*/
+template <class T, unsigned int N>
+class C_DLSpscRing
+{
+	public:
+		C_DLSpscRing() : m_head(0), m_tail(0) {}
+
+		/*! \brief Appends up to count items.
+		\return \b unsigned \b int : items appended. Less than count when the ring fills
+		*/
+		unsigned int PushBatch(const T* items, unsigned int count)
+		{
+			unsigned long tail = m_tail;
+			unsigned long space = (N - 1) - (tail - m_head);
+			if (count > space)
+			{
+				count = static_cast<unsigned int>(space);
+			}
+			for (unsigned int i = 0; i < count; ++i)
+			{
+				m_buf[(tail + i) & (N - 1)] = items[i];
+			}
+			DLQ_BARRIER(); //items before the tail that publishes them
+			m_tail = tail + count;
+			return count;
+		}
+
+		/*! \brief Removes up to max items, oldest first.
+		\return \b unsigned \b int : items removed. 0 when empty
+		*/
+		unsigned int PopBatch(T* items, unsigned int max)
+		{
+			unsigned long head = m_head;
+			unsigned long avail = m_tail - head;
+			DLQ_BARRIER(); //tail before the items it published
+			if (max > avail)
+			{
+				max = static_cast<unsigned int>(avail);
+			}
+			for (unsigned int i = 0; i < max; ++i)
+			{
+				items[i] = m_buf[(head + i) & (N - 1)];
+			}
+			DLQ_BARRIER(); //finish reading before the producer may overwrite
+			m_head = head + max;
+			return max;
+		}
+
+		bool Push(const T& item) { return (PushBatch(&item, 1) == 1); } //!< appends one item. false if full
+		bool Pop(T* item) { return (PopBatch(item, 1) == 1); } //!< removes one item. false if empty
+		unsigned int Size(void) const { return static_cast<unsigned int>(m_tail - m_head); } //!< items queued. a snapshot
+		void Clear(void) { m_head = m_tail; } //!< drops everything queued. Consumer thread only
+
+	private:
+		typedef char size_must_be_a_power_of_two[((N & (N - 1)) == 0) ? 1 : -1];
+		volatile unsigned long m_head; //!< next slot to pop. written by the consumer only
+		char m_pad[64]; //!< keeps head and tail on different cache lines
+		volatile unsigned long m_tail; //!< next slot to push. written by the producer only
+		T m_buf[N]; //!< the items
+};
+
+/*!	\brief Bounded multiple producer, single consumer ring.
+	\note N must be a power of two and the ring holds N items. Each slot carries a
+	sequence number that says whether it is free, being filled or ready, so producers
+	claim slots with one compare-and-swap and the consumer never waits for a slow one:
+	it just stops at the first slot that isn't ready yet.
+*/
+template <class T, unsigned int N>
+class C_DLMpscRing
+{
+	public:
+		C_DLMpscRing() : m_enqueue(0), m_dequeue(0)
+		{
+			for (unsigned int i = 0; i < N; ++i)
+			{
+				m_cell[i].seq = static_cast<long>(i);
+			}
+		}
+
+		/*! \brief Appends up to count items as one contiguous run.
+		\return \b unsigned \b int : items appended. Less than count when the ring fills
+		*/
+		unsigned int PushBatch(const T* items, unsigned int count)
+		{
+			if (count == 0)
+			{
+				return 0;
+			}
+			unsigned long pos = 0;
+			for (;;)
+			{
+				pos = static_cast<unsigned long>(m_enqueue);
+				//the consumer frees slots in order, so if the last slot of the run is free all of it is
+				while ((count > 0) && (static_cast<long>(static_cast<unsigned long>(m_cell[(pos + count - 1) & (N - 1)].seq) - (pos + count - 1)) < 0))
+				{
+					--count;
+				}
+				if (count == 0)
+				{
+					return 0;
+				}
+				if (static_cast<unsigned long>(DLQ_CAS(&m_enqueue, static_cast<long>(pos), static_cast<long>(pos + count))) == pos)
+				{
+					break;
+				}
+			}
+			for (unsigned int i = 0; i < count; ++i)
+			{
+				struct m_cell_type* cell = &m_cell[(pos + i) & (N - 1)];
+				cell->item = items[i];
+				DLQ_BARRIER(); //item before the sequence that publishes it
+				cell->seq = static_cast<long>(pos + i + 1);
+			}
+			return count;
+		}
+
+		/*! \brief Removes up to max ready items, oldest first. Consumer thread only.
+		\return \b unsigned \b int : items removed. 0 when empty
+		*/
+		unsigned int PopBatch(T* items, unsigned int max)
+		{
+			unsigned long pos = m_dequeue;
+			unsigned int cnt = 0;
+			while (cnt < max)
+			{
+				struct m_cell_type* cell = &m_cell[pos & (N - 1)];
+				if (static_cast<unsigned long>(cell->seq) != (pos + 1))
+				{
+					break; //empty, or a producer is still filling this slot
+				}
+				DLQ_BARRIER(); //sequence before the item it published
+				items[cnt++] = cell->item;
+				DLQ_BARRIER(); //finish reading before a producer may reuse the slot
+				cell->seq = static_cast<long>(pos + N);
+				++pos;
+			}
+			m_dequeue = pos;
+			return cnt;
+		}
+
+		bool Push(const T& item) { return (PushBatch(&item, 1) == 1); } //!< appends one item. false if full
+		bool Pop(T* item) { return (PopBatch(item, 1) == 1); } //!< removes one item. false if empty
+
+	private:
+		typedef char size_must_be_a_power_of_two[((N & (N - 1)) == 0) ? 1 : -1];
+		/// one slot and its sequence number
+		struct m_cell_type
+		{
+			volatile long seq; //!< pos when free, pos + 1 when ready, for the pos that owns it
+			T item; //!< the item
+		};
+		volatile long m_enqueue; //!< next position a producer claims
+		char m_pad[64]; //!< keeps the producers' and the consumer's positions on different cache lines
+		unsigned long m_dequeue; //!< next position to pop. consumer only
+		struct m_cell_type m_cell[N]; //!< the slots
+};
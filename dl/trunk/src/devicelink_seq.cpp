@@ -0,0 +1,282 @@
+/*! \file devicelink_seq.cpp
+	\brief The source file for building command sequences.
+*/
+
+#include "devicelink_seq.h"
+
+/*! \brief A range of odd set codes the game accepts.
+*/
+struct DLKeyRange
+{
+	int first; //!< lowest set code in the range
+	int last; //!< highest set code in the range
+};
+
+/*!
+\note Every odd code from first to last is a set code DeviceLink.txt defines, whether or not
+devicelink.h has a name for it. 219 is the one odd code from 81 to 223 the game doesn't know.
+*/
+static const DLKeyRange dl_set_keys[] =
+{
+	{11, 11}, {81, 217}, {221, 223}, {301, 377}, {381, 449}, {479, 479}
+};
+
+/*! \brief Checks that a parameter is a plain number.
+\param str : start of the parameter
+\param len : its length
+\return \b boolean
+*/
+static bool valid_number(const char* str, unsigned int len)
+{
+	bool digit = FALSE;
+	for (unsigned int i = 0; i < len; ++i)
+	{
+		if ((str[i] >= '0') && (str[i] <= '9'))
+		{
+			digit = TRUE;
+		} else if ((str[i] != '-') && (str[i] != '+') && (str[i] != '.') && (str[i] != 'e') && (str[i] != 'E'))
+		{
+			return FALSE;
+		}
+	}
+	return digit;
+}
+
+/*! \brief Constructor.
+*/
+C_DLSequence::C_DLSequence(void)
+{
+	Clear();
+}
+
+/*! \brief Deconstructor.
+*/
+C_DLSequence::~C_DLSequence()
+{
+}
+
+/*! \brief Empties the sequence and stops it if it is running.
+*/
+void C_DLSequence::Clear(void)
+{
+	memset(m_packet, 0, sizeof(m_packet));
+	memset(m_at, 0, sizeof(m_at));
+	m_count = 0;
+	m_wait = 0.00;
+	m_valid = TRUE;
+	m_dl = NULL;
+	m_start = 0.00;
+	m_next = 0;
+}
+
+/*! \brief Checks one or more set codes against the codes the game accepts.
+\param code : set codes with their parameters separated by DELIM_1, i.e. "123/103" or "81\0\0.5"
+\return \b boolean : FALSE for an empty code, a get code, an unknown code or a parameter that isn't a number
+*/
+bool C_DLSequence::ValidSet(const char* code)
+{
+	if ((code == NULL) || (code[0] == '\0'))
+	{
+		return FALSE;
+	}
+	const char* tok = code;
+	while (*tok != '\0')
+	{
+		unsigned int len = 0;
+		while ((tok[len] != '\0') && (tok[len] != DELIM_1))
+		{
+			++len;
+		}
+		unsigned int klen = 0;
+		int key = 0;
+		while ((klen < len) && (tok[klen] >= '0') && (tok[klen] <= '9') && (klen < 4))
+		{
+			key = (key * 10) + (tok[klen] - '0');
+			++klen;
+		}
+		if ((klen == 0) || ((key & 1) == 0) || ((klen < len) && (tok[klen] != DELIM_2)))
+		{
+			return FALSE;
+		}
+		bool known = FALSE;
+		for (unsigned int i = 0; i < (sizeof(dl_set_keys) / sizeof(dl_set_keys[0])); ++i)
+		{
+			if ((key >= dl_set_keys[i].first) && (key <= dl_set_keys[i].last))
+			{
+				known = TRUE;
+				break;
+			}
+		}
+		if (known == FALSE)
+		{
+			return FALSE;
+		}
+		//every parameter between the DELIM_2s has to be a number
+		unsigned int pos = klen;
+		while (pos < len)
+		{
+			unsigned int plen = 0;
+			++pos;
+			while (((pos + plen) < len) && (tok[pos + plen] != DELIM_2))
+			{
+				++plen;
+			}
+			if (valid_number(tok + pos, plen) == FALSE)
+			{
+				return FALSE;
+			}
+			pos += plen;
+		}
+		tok += len;
+		if (*tok == DELIM_1)
+		{
+			++tok;
+			if (*tok == '\0')
+			{
+				return FALSE;
+			}
+		}
+	}
+	return TRUE;
+}
+
+/*! \brief Appends set codes to the sequence.
+\param code : one or more set codes with their parameters separated by DELIM_1, i.e. DL_TOGGLE_ENGINE1
+\return \b boolean : FALSE if the code isn't valid or the sequence is full. The sequence then refuses to Start().
+\note Codes go into the same packet as the code before them unless a Wait() came in between
+or the packet is full.
+*/
+bool C_DLSequence::Add(const char* code)
+{
+	if ((m_valid == FALSE) || (ValidSet(code) == FALSE))
+	{
+		m_valid = FALSE;
+		return FALSE;
+	}
+	unsigned int add = static_cast<unsigned int>(strlen(code));
+	unsigned int len = 0;
+	if (m_count > 0)
+	{
+		len = static_cast<unsigned int>(strlen(m_packet[m_count - 1]));
+	}
+	if ((m_count == 0) || (m_at[m_count - 1] != m_wait) || ((len + add + 1) >= sizeof(m_packet[0])))
+	{
+		if ((m_count >= DL_SEQ_MAX_PACKETS) || (add >= sizeof(m_packet[0])))
+		{
+			m_valid = FALSE;
+			return FALSE;
+		}
+		m_at[m_count] = m_wait;
+		++m_count;
+		len = 0;
+	}
+	char* packet = m_packet[m_count - 1];
+	if (len > 0)
+	{
+		packet[len++] = DELIM_1;
+	}
+	memcpy(packet + len, code, add);
+	packet[len + add] = '\0';
+	return TRUE;
+}
+
+/*! \brief Appends a set code that takes one value.
+\param code : the set code, i.e. DL_SET_FLAPS
+\param val : the value
+\return \b boolean : FALSE if the code isn't valid or the sequence is full
+*/
+bool C_DLSequence::Add(const char* code, float val)
+{
+	char temp_cmd[64];
+	memset(temp_cmd, 0, sizeof(temp_cmd));
+#if _MSC_VER >= 1400
+	_snprintf_s(temp_cmd,sizeof(temp_cmd),_TRUNCATE,"%s%c%f",code,DELIM_2,val);
+#else
+	_snprintf(temp_cmd,sizeof(temp_cmd),"%s%c%f",code,DELIM_2,val);
+#endif
+	return Add(temp_cmd);
+}
+
+/*! \brief Delays the codes added after this call.
+\param ms : milliseconds to wait after the codes before it went out
+\return \b boolean : FALSE for a negative wait
+*/
+bool C_DLSequence::Wait(double ms)
+{
+	if (ms < 0.00)
+	{
+		m_valid = FALSE;
+		return FALSE;
+	}
+	m_wait += ms;
+	return TRUE;
+}
+
+/*! \brief Returns true if every code added so far was accepted.
+\return \b boolean
+*/
+bool C_DLSequence::IsValid(void)
+{
+	return m_valid;
+}
+
+/*! \brief Returns how many R packets the sequence sends.
+\return \b unsigned \b int
+*/
+unsigned int C_DLSequence::GetPacketCount(void)
+{
+	return m_count;
+}
+
+/*! \brief Starts the sequence and sends every packet that isn't waiting.
+\param dl : an initialized link to send on. It has to outlive the run.
+\return \b boolean : FALSE if the sequence is invalid, empty or the first packet couldn't be sent
+\note A sequence without waits is completely sent by this call.
+*/
+bool C_DLSequence::Start(C_DeviceLink* dl)
+{
+	if ((dl == NULL) || (m_valid == FALSE) || (m_count == 0))
+	{
+		return FALSE;
+	}
+	m_dl = dl;
+	m_start = MC_Timer::Now();
+	m_next = 0;
+	return Tick();
+}
+
+/*! \brief Sends every packet whose wait is over. Never blocks.
+\return \b boolean : FALSE if a packet couldn't be sent. The sequence carries on with the next one.
+\note Call it from the application loop while IsRunning() is TRUE. The waits are measured from
+Start(), so a late Tick() doesn't push the later steps back.
+*/
+bool C_DLSequence::Tick(void)
+{
+	if (m_dl == NULL)
+	{
+		return TRUE;
+	}
+	bool flag = TRUE;
+	double elapsed = MC_Timer::Now() - m_start;
+	while ((m_next < m_count) && (m_at[m_next] <= elapsed))
+	{
+		if (m_dl->SendCmd(m_packet[m_next]) == FALSE)
+		{
+			flag = FALSE;
+		}
+		++m_next;
+	}
+	if (m_next >= m_count)
+	{
+		m_dl = NULL;
+	}
+	return flag;
+}
+
+/*! \brief Returns true while a started sequence still has packets to send.
+\return \b boolean
+*/
+bool C_DLSequence::IsRunning(void)
+{
+	return (m_dl != NULL);
+}
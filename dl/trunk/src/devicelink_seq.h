@@ -0,0 +1,48 @@
+/*! \file devicelink_seq.h
+	\brief The header for building command sequences such as an engine start or a landing configuration.
+
+	A sequence is a list of set codes with optional waits between them. Codes that
+	follow each other without a wait are packed into as few R packets as possible,
+	and the waits are run by Tick() so the caller's thread never sleeps.
+*/
+#pragma once
+#include "devicelink.h"
+
+#define DL_SEQ_MAX_PACKETS 16 //!< most packets one sequence compiles to
+
+/*!	\brief A compiled command sequence.
+	- Example, landing configuration:
+	*	- C_DLSequence seq;\n
+	*	- seq.Add(DL_SET_GEAR_STATUS);\n
+	*	- seq.Wait(2000.0);\n
+	*	- seq.Add(DL_SET_FLAPS_POS, 1.0f);\n
+	*	- seq.Start(&dl);\n
+	*	- while (seq.IsRunning()) { seq.Tick(); ... other work ... }\n
+	*	.
+*/
+class C_DLSequence
+{
+	public:
+		C_DLSequence();
+		~C_DLSequence();
+		void Clear(void);
+		bool Add(const char* code);
+		bool Add(const char* code, float val);
+		bool Wait(double ms);
+		bool IsValid(void);
+		unsigned int GetPacketCount(void);
+		bool Start(C_DeviceLink* dl);
+		bool Tick(void);
+		bool IsRunning(void);
+		static bool ValidSet(const char* code);
+
+	private:
+		char m_packet[DL_SEQ_MAX_PACKETS][DL_MAX_QUERY - 2]; //!< compiled packets without the leading "R/"
+		double m_at[DL_SEQ_MAX_PACKETS]; //!< when each packet is due, in ms after Start()
+		unsigned int m_count; //!< packets compiled so far
+		double m_wait; //!< time of the packet the next code goes into
+		bool m_valid; //!< FALSE once an Add() or Wait() has failed
+		C_DeviceLink* m_dl; //!< link the running sequence sends on. NULL when not running
+		double m_start; //!< MC_Timer::Now() of Start()
+		unsigned int m_next; //!< next packet Tick() sends
+};
@@ -0,0 +1,304 @@
+/*! \file devicelink_shm.cpp
+	\brief The source file for the shared memory snapshot of the devicelink cache.
+*/
+
+#include "devicelink_shm.h"
+#ifdef _WIN32
+#include "windows.h"
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+/*! \brief Creates or reuses a segment and maps it read/write.
+\param name : segment name, e.g. DL_SHM_NAME
+\param handle : receives the mapping handle to pass to dl_shm_close()
+\return \b DL_ShmSnapshot* : the mapped segment or NULL on failure
+*/
+DL_ShmSnapshot* dl_shm_create(const char* name, void** handle)
+{
+	if ((name == NULL) || (handle == NULL))
+	{
+		return NULL;
+	}
+	*handle = NULL;
+#ifdef _WIN32
+	HANDLE map = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(DL_ShmSnapshot), name);
+	if (map == NULL)
+	{
+		return NULL;
+	}
+	void* addr = MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, sizeof(DL_ShmSnapshot));
+	if (addr == NULL)
+	{
+		CloseHandle(map);
+		return NULL;
+	}
+	*handle = map;
+	return static_cast<DL_ShmSnapshot*>(addr);
+#else
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(DL_ShmSnapshot)) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	void* addr = mmap(NULL, sizeof(DL_ShmSnapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); //the mapping keeps the segment alive
+	if (addr == MAP_FAILED)
+	{
+		return NULL;
+	}
+	return static_cast<DL_ShmSnapshot*>(addr);
+#endif
+}
+
+/*! \brief Maps an existing segment read-only.
+\param name : segment name the writer passed to ExportShm()
+\param handle : receives the mapping handle to pass to dl_shm_close()
+\return \b const \b DL_ShmSnapshot* : the mapped segment or NULL on failure
+*/
+const DL_ShmSnapshot* dl_shm_open(const char* name, void** handle)
+{
+	if ((name == NULL) || (handle == NULL))
+	{
+		return NULL;
+	}
+	*handle = NULL;
+#ifdef _WIN32
+	HANDLE map = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+	if (map == NULL)
+	{
+		return NULL;
+	}
+	void* addr = MapViewOfFile(map, FILE_MAP_READ, 0, 0, sizeof(DL_ShmSnapshot));
+	if (addr == NULL)
+	{
+		CloseHandle(map);
+		return NULL;
+	}
+	*handle = map;
+	return static_cast<const DL_ShmSnapshot*>(addr);
+#else
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || (st.st_size < static_cast<off_t>(sizeof(DL_ShmSnapshot))))
+	{
+		close(fd);
+		return NULL;
+	}
+	void* addr = mmap(NULL, sizeof(DL_ShmSnapshot), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+	{
+		return NULL;
+	}
+	return static_cast<const DL_ShmSnapshot*>(addr);
+#endif
+}
+
+/*! \brief Unmaps a segment returned by dl_shm_create() or dl_shm_open().
+\param shm : the mapped segment
+\param handle : the handle returned with it
+\param name : segment name. only used when owner is TRUE
+\param owner : TRUE for the writer, which removes the name so a restart starts clean.
+Readers that still have it mapped keep their view.
+*/
+void dl_shm_close(const DL_ShmSnapshot* shm, void* handle, const char* name, bool owner)
+{
+#ifdef _WIN32
+	if (shm != NULL)
+	{
+		UnmapViewOfFile(shm);
+	}
+	if (handle != NULL)
+	{
+		CloseHandle(static_cast<HANDLE>(handle));
+	}
+	(void)name;
+	(void)owner;
+#else
+	if (shm != NULL)
+	{
+		munmap(const_cast<DL_ShmSnapshot*>(shm), sizeof(DL_ShmSnapshot));
+	}
+	if ((owner == TRUE) && (name != NULL))
+	{
+		shm_unlink(name);
+	}
+	(void)handle;
+#endif
+}
+
+/*! \brief Constructor.
+*/
+C_DeviceLinkShm::C_DeviceLinkShm(void)
+: m_shm(NULL)
+,m_handle(NULL)
+{
+}
+
+/*! \brief Deconstructor. Unmaps the segment.
+*/
+C_DeviceLinkShm::~C_DeviceLinkShm()
+{
+	Close();
+}
+
+/*! \brief Maps the segment exported by another process.
+\param name : segment name the writer passed to ExportShm()
+\return \b boolean : FALSE if the segment doesn't exist or was written by an incompatible version
+*/
+bool C_DeviceLinkShm::Open(const char* name)
+{
+	Close();
+	m_shm = dl_shm_open(name, &m_handle);
+	if (m_shm == NULL)
+	{
+		return FALSE;
+	}
+	if ((m_shm->magic != DL_SHM_MAGIC) || (m_shm->version != DL_SHM_VERSION) || (m_shm->size != sizeof(DL_ShmSnapshot))
+		|| (m_shm->num_params != DLP_COUNT) || (m_shm->max_engines != DL_MAX_ENGINES))
+	{
+		Close();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*! \brief Unmaps the segment. Safe to call when not open.
+*/
+void C_DeviceLinkShm::Close(void)
+{
+	if (m_shm != NULL)
+	{
+		dl_shm_close(m_shm, m_handle, NULL, FALSE);
+	}
+	m_shm = NULL;
+	m_handle = NULL;
+}
+
+/*! \brief Returns true if a valid segment is mapped.
+\return \b boolean
+*/
+bool C_DeviceLinkShm::IsOpen(void)
+{
+	return (m_shm != NULL);
+}
+
+/*! \brief Copies the whole segment in one consistent read.
+\param snap : receives the copy
+\return \b boolean : FALSE if not open or the writer never finished an update
+*/
+bool C_DeviceLinkShm::Read(DL_ShmSnapshot* snap)
+{
+	if ((m_shm == NULL) || (snap == NULL))
+	{
+		return FALSE;
+	}
+	for (int i = 0; i < DL_SHM_MAX_RETRY; ++i)
+	{
+		long seq = m_shm->seq;
+		DL_SHM_BARRIER();
+		if ((seq & 1) != 0)
+		{
+			continue;
+		}
+		memcpy(snap, m_shm, sizeof(DL_ShmSnapshot));
+		DL_SHM_BARRIER();
+		if (m_shm->seq == seq)
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*! \brief Reads one value and the time it was received.
+\param param : the value to read
+\param val : receives the value. Integer values come back as floats
+\param stamp : receives MC_Timer::Now() when the writer received it, 0 if never. May be NULL
+\param eng_num : engine index for engine values, 0 otherwise
+\return \b boolean : FALSE if not open, on a bad parameter or if the writer never finished an update
+*/
+bool C_DeviceLinkShm::Get(DLParam param, float* val, double* stamp, const int eng_num)
+{
+	if ((m_shm == NULL) || (val == NULL) || (param < 0) || (param >= DLP_COUNT) || (eng_num < 0) || (eng_num >= DL_MAX_ENGINES))
+	{
+		return FALSE;
+	}
+	for (int i = 0; i < DL_SHM_MAX_RETRY; ++i)
+	{
+		long seq = m_shm->seq;
+		DL_SHM_BARRIER();
+		if ((seq & 1) != 0)
+		{
+			continue;
+		}
+		float fval = m_shm->value[param][eng_num];
+		double dval = m_shm->stamp[param][eng_num];
+		DL_SHM_BARRIER();
+		if (m_shm->seq == seq)
+		{
+			*val = fval;
+			if (stamp != NULL)
+			{
+				*stamp = dval;
+			}
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*! \brief Overload for Get() that just returns the value.
+\param param : the value to read
+\param eng_num : engine index for engine values, 0 otherwise
+\return \b float : the value or 0.00 on failure
+*/
+float C_DeviceLinkShm::Get(DLParam param, const int eng_num)
+{
+	float fval = 0.00;
+	if (Get(param, &fval, NULL, eng_num) == FALSE)
+	{
+		return 0.00;
+	}
+	return fval;
+}
+
+/*! \brief Returns how long ago the writer received a value.
+\param param : the value
+\param eng_num : engine index for engine values, 0 otherwise
+\return \b double : age in milliseconds or -1 if the value has never been received
+*/
+double C_DeviceLinkShm::GetAge(DLParam param, const int eng_num)
+{
+	float fval = 0.00;
+	double stamp = 0.00;
+	if ((Get(param, &fval, &stamp, eng_num) == FALSE) || (stamp == 0.00))
+	{
+		return -1.00;
+	}
+	return MC_Timer::Now() - stamp;
+}
+
+/*! \brief Returns the number of engines the writer last read from the game.
+\return \b integer : 0 if not open or not yet queried
+*/
+int C_DeviceLinkShm::GetNumEngines(void)
+{
+	if (m_shm == NULL)
+	{
+		return 0;
+	}
+	return m_shm->num_engines;
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+/*! \file devicelink_shm.h
+	\brief The header for the shared memory snapshot of the devicelink cache.
+
+	One process owns the C_DeviceLink and calls ExportShm(). Every other process on
+	the same PC opens the segment with C_DeviceLinkShm and reads the cached values
+	without sending anything to the game.
+*/
+#pragma once
+#include "devicelink.h"
+
+#define DL_SHM_MAGIC 0x4B4E4C44 //!< "DLNK". first field of a valid segment
+#define DL_SHM_VERSION 3 //!< bump whenever DL_ShmSnapshot or DLParam changes
+#define DL_SHM_MAX_RETRY 10000 //!< reads give up after this many torn copies, i.e. a writer died mid-update
+
+#ifdef _WIN32
+#if _MSC_VER >= 1400
+#include <intrin.h>
+#else
+extern "C" void _ReadWriteBarrier(void);
+#endif
+#pragma intrinsic(_ReadWriteBarrier)
+#define DL_SHM_INC(p) InterlockedIncrement(p) //!< full barrier increment of the sequence counter
+#define DL_SHM_BARRIER() _ReadWriteBarrier() //!< x86 never reorders loads with loads, only the compiler does
+#else
+#define DL_SHM_INC(p) __sync_add_and_fetch(p, 1)
+#define DL_SHM_BARRIER() __sync_synchronize()
+#endif
+
+/*! \brief The layout of the shared memory segment.
+
+	Writers bump seq to an odd number before changing anything and back to an even
+	number when done. A reader copies what it needs and only trusts the copy if seq
+	was even and unchanged on both sides of it.
+	\note The arrays are indexed by DLParam and engine like the private cache in
+	C_DeviceLink. Integer values are stored as floats. A stamp of 0 means the value
+	has never been received. Stamps are MC_Timer::Now() of the writer, which is the
+	same clock for every process on the PC.
+*/
+struct DL_ShmSnapshot
+{
+	unsigned int magic; //!< DL_SHM_MAGIC once the writer has initialized the segment
+	unsigned int version; //!< DL_SHM_VERSION of the writer
+	unsigned int size; //!< sizeof(DL_ShmSnapshot) of the writer
+	unsigned int num_params; //!< DLP_COUNT of the writer
+	unsigned int max_engines; //!< DL_MAX_ENGINES of the writer
+	int num_engines; //!< number of engines reported by the game. 0 until queried
+	volatile long seq; //!< sequence counter. odd while an update is in progress
+	double published; //!< MC_Timer::Now() of the last update
+	double stamp[DLP_COUNT][DL_MAX_ENGINES]; //!< MC_Timer::Now() each value was received
+	float value[DLP_COUNT][DL_MAX_ENGINES]; //!< the cached values
+};
+
+DL_ShmSnapshot* dl_shm_create(const char* name, void** handle);
+const DL_ShmSnapshot* dl_shm_open(const char* name, void** handle);
+void dl_shm_close(const DL_ShmSnapshot* shm, void* handle, const char* name, bool owner);
+
+/*!	\brief Read-only view of a segment exported by C_DeviceLink::ExportShm().
+
+	Reads never block and never touch the network. They spin only while the writer is
+	in the middle of an update, which is a few hundred nanoseconds at most.
+*/
+class C_DeviceLinkShm
+{
+	public:
+		C_DeviceLinkShm();
+		~C_DeviceLinkShm();
+		bool Open(const char* name = DL_SHM_NAME);
+		void Close(void);
+		bool IsOpen(void);
+		bool Read(DL_ShmSnapshot* snap);
+		bool Get(DLParam param, float* val, double* stamp = NULL, const int eng_num = 0);
+		float Get(DLParam param, const int eng_num = 0);
+		double GetAge(DLParam param, const int eng_num = 0);
+		int GetNumEngines(void);
+
+	private:
+		const DL_ShmSnapshot* m_shm; //!< the mapped segment. NULL when closed
+		void* m_handle; //!< file mapping handle on Win32. unused elsewhere
+};
\ No newline at end of file
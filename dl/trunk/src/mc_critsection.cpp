@@ -1,26 +1,388 @@
 #include "mc_critsection.h"
+#include "mc_timer.h"
+#include <string.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#endif
+
+#ifdef _WIN32
+#define MC_CAS(p, o, n) InterlockedCompareExchange((p), (n), (o)) //!< returns the old value
+#define MC_XCHG(p, v) InterlockedExchange((p), (v)) //!< full barrier exchange
+#define MC_RELEASE(p) InterlockedExchange((p), 0) //!< full barrier store of 0, returns the old value
+#if defined(_M_IX86)
+#define MC_CPU_PAUSE() __asm { pause }
+#else
+#define MC_CPU_PAUSE() ((void)0)
+#endif
+#else
+#define MC_CAS(p, o, n) __sync_val_compare_and_swap((p), (o), (n))
+#define MC_XCHG(p, v) __sync_lock_test_and_set((p), (v))
+#define MC_RELEASE(p) __sync_fetch_and_and((p), 0)
+#if defined(__i386__) || defined(__x86_64__)
+#define MC_CPU_PAUSE() __builtin_ia32_pause()
+#else
+#define MC_CPU_PAUSE() __sync_synchronize()
+#endif
+#endif
+
+/*! \brief Returns a number unique to the calling thread. Never 0.
+*/
+static long current_thread(void)
+{
+#ifdef _WIN32
+	return static_cast<long>(GetCurrentThreadId());
+#else
+	return (long)pthread_self(); //pthread_t is an integer on Linux and a pointer elsewhere
+#endif
+}
 
 /*! \brief Constructor for MC_CritSection. Initializes the ID and cnt.
 
 */
 
 MC_CritSection::MC_CritSection()
-    {
-        m_nThreadId = 0;
-        m_nLockCnt = 0;
-    }
+{
+	m_nState = 0;
+	m_nThreadId = 0;
+	m_nLockCnt = 0;
+	m_nSpin = 0;
+	m_bStats = false;
+	memset(&m_stats, 0, sizeof(m_stats));
+#ifdef _WIN32
+	m_hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	m_nMaxSpin = (info.dwNumberOfProcessors > 1) ? MC_CS_MAX_SPIN : 0;
+#else
+	m_nMaxSpin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? MC_CS_MAX_SPIN : 0;
+#endif
+}
 
-    void MC_CritSection::Enter()
+/*! \brief Takes the lock if it is free.
+\param nThreadId : the calling thread, recorded as the owner
+\return \b boolean : false if another thread holds it
+*/
+bool MC_CritSection::SetLock(const long nThreadId)
+{
+	if (MC_CAS(&m_nState, 0, 1) != 0)
+	{
+		return false;
+	}
+	m_nThreadId = nThreadId;
+	return true;
+}
+
+/*! \brief Sleeps until Wake() is called or the lock word is no longer 2.
+*/
+void MC_CritSection::Park(void)
+{
+#ifdef _WIN32
+	WaitForSingleObject(m_hEvent, INFINITE);
+#elif defined(__linux__)
+	syscall(SYS_futex, &m_nState, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+#else
+	sched_yield();
+#endif
+}
+
+/*! \brief Wakes one thread sleeping in Park().
+*/
+void MC_CritSection::Wake(void)
+{
+#ifdef _WIN32
+	SetEvent(m_hEvent);
+#elif defined(__linux__)
+	syscall(SYS_futex, &m_nState, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+/*! \brief Enters the critical section, waiting if another thread is in it.
+\note The owner may enter again. Each Enter() needs its own Leave().
+*/
+void MC_CritSection::Enter()
+{
+	long tid = current_thread();
+	if (m_nThreadId == tid)
+	{
+		++m_nLockCnt;
+		if (m_bStats == true)
+		{
+			++m_stats.acquisitions;
+		}
+		return;
+	}
+	if (SetLock(tid) == true)
+	{
+		m_nLockCnt = 1;
+		if (m_bStats == true)
+		{
+			++m_stats.acquisitions;
+		}
+		return;
+	}
+	//contended. spin a little in case the owner is about to leave, then sleep
+	double start = (m_bStats == true) ? MC_Timer::Now() : 0.00;
+	long limit = (m_nSpin * 2) + 10;
+	if (limit > m_nMaxSpin)
 	{
-	} //!< Function for entering a critical section
-    void MC_CritSection::Leave()
+		limit = m_nMaxSpin;
+	}
+	long spins = 0;
+	bool locked = false;
+	while ((locked == false) && (spins < limit))
 	{
-	} //!< Function for leaving a critical section
-    bool MC_CritSection::Try()
+		MC_CPU_PAUSE();
+		++spins;
+		if (m_nState == 0)
+		{
+			locked = SetLock(tid);
+		}
+	}
+	bool parked = false;
+	if (locked == false)
 	{
-		return true;
-	} //!< try block call
-	
+		//2 tells Leave() someone may be asleep. Taking the lock with 2 is harmless, it costs one spare Wake()
+		while (MC_XCHG(&m_nState, 2) != 0)
+		{
+			parked = true;
+			Park();
+		}
+		m_nThreadId = tid;
+	}
+	m_nLockCnt = 1;
+	m_nSpin += (spins - m_nSpin) / 8;
+	if (m_bStats == true)
+	{
+		double wait = MC_Timer::Now() - start;
+		++m_stats.acquisitions;
+		++m_stats.contended;
+		if (parked == true)
+		{
+			++m_stats.parked;
+		}
+		m_stats.wait_time += wait;
+		if (wait > m_stats.max_wait)
+		{
+			m_stats.max_wait = wait;
+		}
+	}
+}
+
+/*! \brief Leaves the critical section once the owner has left as many times as it entered.
+*/
+void MC_CritSection::Leave()
+{
+	if (m_nThreadId != current_thread())
+	{
+		return; //not the owner. nothing to release
+	}
+	if (--m_nLockCnt > 0)
+	{
+		return;
+	}
+	m_nThreadId = 0;
+	if (MC_RELEASE(&m_nState) == 2)
+	{
+		Wake();
+	}
+}
+
+/*! \brief Enters the critical section only if that doesn't mean waiting.
+\return \b boolean : true if entered. Must then be matched by a Leave()
+*/
+bool MC_CritSection::Try()
+{
+	long tid = current_thread();
+	if (m_nThreadId == tid)
+	{
+		++m_nLockCnt;
+	} else if (SetLock(tid) == true)
+	{
+		m_nLockCnt = 1;
+	} else
+	{
+		return false;
+	}
+	if (m_bStats == true)
+	{
+		++m_stats.acquisitions;
+	}
+	return true;
+}
+
+/*! \brief Turns the contention counters on or off. They keep their values while off.
+\param enable : true to start counting
+*/
+void MC_CritSection::EnableStats(bool enable)
+{
+	Enter();
+	m_bStats = enable;
+	Leave();
+}
+
+/*! \brief Copies the contention counters.
+\param stats : receives the counters
+*/
+void MC_CritSection::GetStats(MC_LockStats* stats)
+{
+	if (stats == NULL)
+	{
+		return;
+	}
+	Enter();
+	memcpy(stats, &m_stats, sizeof(m_stats));
+	Leave();
+}
+
+/*! \brief Zeroes the contention counters.
+*/
+void MC_CritSection::ResetStats(void)
+{
+	Enter();
+	memset(&m_stats, 0, sizeof(m_stats));
+	Leave();
+}
+
 MC_CritSection::~MC_CritSection()
 {
-}
\ No newline at end of file
+#ifdef _WIN32
+	if (m_hEvent != NULL)
+	{
+		CloseHandle(m_hEvent);
+	}
+#endif
+}
+
+/*! \brief Constructor for MC_SpinCritSection.
+*/
+MC_SpinCritSection::MC_SpinCritSection()
+{
+	m_nState = 0;
+	m_nThreadId = 0;
+	m_nLockCnt = 0;
+	m_bStats = false;
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+/*! \brief Enters the critical section, spinning if another thread is in it.
+\note The owner may enter again. Each Enter() needs its own Leave().
+*/
+void MC_SpinCritSection::Enter()
+{
+	long tid = current_thread();
+	if (m_nThreadId != tid)
+	{
+		if (MC_CAS(&m_nState, 0, 1) != 0)
+		{
+			double start = (m_bStats == true) ? MC_Timer::Now() : 0.00;
+			long spins = 0;
+			do
+			{
+				MC_CPU_PAUSE();
+				if ((++spins % MC_SPIN_YIELD) == 0)
+				{
+#ifdef _WIN32
+					Sleep(0);
+#else
+					sched_yield();
+#endif
+				}
+			} while ((m_nState != 0) || (MC_CAS(&m_nState, 0, 1) != 0));
+			if (m_bStats == true)
+			{
+				double wait = MC_Timer::Now() - start;
+				++m_stats.contended;
+				m_stats.wait_time += wait;
+				if (wait > m_stats.max_wait)
+				{
+					m_stats.max_wait = wait;
+				}
+			}
+		}
+		m_nThreadId = tid;
+		m_nLockCnt = 0;
+	}
+	++m_nLockCnt;
+	if (m_bStats == true)
+	{
+		++m_stats.acquisitions;
+	}
+}
+
+/*! \brief Leaves the critical section once the owner has left as many times as it entered.
+*/
+void MC_SpinCritSection::Leave()
+{
+	if (m_nThreadId != current_thread())
+	{
+		return; //not the owner. nothing to release
+	}
+	if (--m_nLockCnt > 0)
+	{
+		return;
+	}
+	m_nThreadId = 0;
+	MC_RELEASE(&m_nState);
+}
+
+/*! \brief Enters the critical section only if that doesn't mean spinning.
+\return \b boolean : true if entered. Must then be matched by a Leave()
+*/
+bool MC_SpinCritSection::Try()
+{
+	long tid = current_thread();
+	if (m_nThreadId != tid)
+	{
+		if (MC_CAS(&m_nState, 0, 1) != 0)
+		{
+			return false;
+		}
+		m_nThreadId = tid;
+		m_nLockCnt = 0;
+	}
+	++m_nLockCnt;
+	if (m_bStats == true)
+	{
+		++m_stats.acquisitions;
+	}
+	return true;
+}
+
+/*! \brief Turns the contention counters on or off. They keep their values while off.
+\param enable : true to start counting
+*/
+void MC_SpinCritSection::EnableStats(bool enable)
+{
+	Enter();
+	m_bStats = enable;
+	Leave();
+}
+
+/*! \brief Copies the contention counters.
+\param stats : receives the counters
+*/
+void MC_SpinCritSection::GetStats(MC_LockStats* stats)
+{
+	if (stats == NULL)
+	{
+		return;
+	}
+	Enter();
+	memcpy(stats, &m_stats, sizeof(m_stats));
+	Leave();
+}
+
+/*! \brief Zeroes the contention counters.
+*/
+void MC_SpinCritSection::ResetStats(void)
+{
+	Enter();
+	memset(&m_stats, 0, sizeof(m_stats));
+	Leave();
+}
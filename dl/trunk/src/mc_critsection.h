@@ -3,16 +3,56 @@
 
 */
 #pragma once
+#ifdef _WIN32
 #include "windows.h"
+#endif
+
+#define MC_CS_MAX_SPIN 100 //!< most times Enter() retries a held lock before it sleeps
+#define MC_SPIN_YIELD 64 //!< spins MC_SpinCritSection makes between yields of its time slice
+
+#ifdef _WIN32
+typedef long MC_LockWord; //!< the Interlocked functions work on a LONG
+#else
+typedef int MC_LockWord; //!< futex() works on a 32 bit int
+#endif
+
+/*! \brief Contention counters of one MC_CritSection. Times are in milliseconds.
+*/
+struct MC_LockStats
+{
+	unsigned long acquisitions; //!< Enter() and successful Try() calls, recursive ones included
+	unsigned long contended; //!< acquisitions that found the lock held by another thread
+	unsigned long parked; //!< contended acquisitions that gave up spinning and slept
+	double wait_time; //!< total time spent waiting in contended acquisitions
+	double max_wait; //!< longest single wait
+};
 
 /*!	\brief The critical section class for thread safe operation
 
+	A recursive lock that spins briefly when it is held by another thread and then sleeps,
+	on a futex on Linux and on an event on Win32. The spin count adapts to how long the
+	lock is usually held, and is 0 on a single processor where spinning can't help.
+	\note Counters are off by default. They are updated while the lock is held, so turning
+	them on costs nothing on the uncontended path but an increment.
 */
 class MC_CritSection
 {
-	long m_nLockCnt; //!< keeps count of the number of locks
-	long m_nThreadId; //!< stores the thread id
+	volatile MC_LockWord m_nState; //!< 0 free, 1 held, 2 held with threads sleeping on it
+	volatile long m_nThreadId; //!< stores the thread id of the owner. 0 when free
+	long m_nLockCnt; //!< keeps count of the number of locks held by the owner
+	long m_nSpin; //!< running average of the spins a contended Enter() needed
+	long m_nMaxSpin; //!< spin limit. 0 on a single processor
+	bool m_bStats; //!< TRUE when the counters are being updated
+	MC_LockStats m_stats; //!< contention counters
+#ifdef _WIN32
+	HANDLE m_hEvent; //!< auto-reset event the sleeping threads wait on
+#endif
 	bool SetLock(const long nThreadId); //!< sets a lock on the thread indicated by the ID.
+	void Park(void); //!< sleeps until the lock is released
+	void Wake(void); //!< wakes one sleeping thread
+
+	MC_CritSection(const MC_CritSection&); //!< not copyable
+	MC_CritSection& operator=(const MC_CritSection&); //!< not copyable
 
 public:
 
@@ -20,6 +60,62 @@ public:
     void Enter(); //!< Function for entering a critical section
     void Leave(); //!< Function for leaving a critical section
     bool Try(); //!< try block call
-	
+	void EnableStats(bool enable); //!< turns the contention counters on or off
+	void GetStats(MC_LockStats* stats); //!< copies the contention counters
+	void ResetStats(void); //!< zeroes the contention counters
+
 	~MC_CritSection();
 };
+
+/*!	\brief Lock policy for single threaded programs. Every call compiles to nothing.
+	\note Same interface as MC_CritSection so MC_LockT and the library can use either.
+*/
+class MC_NullCritSection
+{
+public:
+	void Enter() {} //!< does nothing
+	void Leave() {} //!< does nothing
+	bool Try() { return true; } //!< always succeeds
+	void EnableStats(bool enable) { (void)enable; } //!< there is nothing to count
+	void GetStats(MC_LockStats* stats) //!< always zero
+	{
+		if (stats != 0)
+		{
+			stats->acquisitions = 0;
+			stats->contended = 0;
+			stats->parked = 0;
+			stats->wait_time = 0.00;
+			stats->max_wait = 0.00;
+		}
+	}
+	void ResetStats(void) {} //!< does nothing
+};
+
+/*!	\brief Lock policy that never enters the kernel.
+
+	A recursive lock built only on atomic instructions. A contended Enter() spins and
+	gives up its time slice every MC_SPIN_YIELD spins, but never sleeps on a kernel
+	object, so it suits short critical sections on machines with a core per thread.
+	\note parked in MC_LockStats is always 0.
+*/
+class MC_SpinCritSection
+{
+	volatile MC_LockWord m_nState; //!< 0 free, 1 held
+	volatile long m_nThreadId; //!< stores the thread id of the owner. 0 when free
+	long m_nLockCnt; //!< keeps count of the number of locks held by the owner
+	bool m_bStats; //!< TRUE when the counters are being updated
+	MC_LockStats m_stats; //!< contention counters
+
+	MC_SpinCritSection(const MC_SpinCritSection&); //!< not copyable
+	MC_SpinCritSection& operator=(const MC_SpinCritSection&); //!< not copyable
+
+public:
+
+	MC_SpinCritSection();
+	void Enter(); //!< Function for entering a critical section
+	void Leave(); //!< Function for leaving a critical section
+	bool Try(); //!< try block call
+	void EnableStats(bool enable); //!< turns the contention counters on or off
+	void GetStats(MC_LockStats* stats); //!< copies the contention counters
+	void ResetStats(void); //!< zeroes the contention counters
+};
@@ -3,16 +3,43 @@
 
 */
 #pragma once
-#include "MC_CritSection.h"
+#include "mc_critsection.h"
 
-class MC_Lock
+/*! \brief MC_LockT class for thread safe operation.
+
+Handles locking on entry and auomatically unlocks when going out of scope by 
+using the deconstructor to do so.  Prevents threads hanging in case of some
+sort of untrapped exception being thrown.
+\note CS is the lock policy: MC_CritSection, MC_SpinCritSection or MC_NullCritSection.
+Everything is inline, so with MC_NullCritSection a lock compiles to nothing.
+*/
+template <class CS>
+class MC_LockT
 {
-    MC_CritSection* m_pCS; //!< var for creating MC_CritSection object
+    CS* m_pCS; //!< the critical section held for the lifetime of the lock
+
+	MC_LockT(const MC_LockT&); //!< not copyable
+	MC_LockT& operator=(const MC_LockT&); //!< not copyable
 
 public:
 /*! \brief This sets up the lock for the accessing thread.
 
 */
-    MC_Lock(MC_CritSection* pCS);
-    ~MC_Lock();
+    MC_LockT(CS* pCS)
+	: m_pCS(pCS)
+    {
+        if(m_pCS)
+            m_pCS->Enter();
+    }
+
+/*! \brief Deconstructor which automatically closes out the lock when it goes out of scope.
+
+*/
+    ~MC_LockT()
+    {
+        if(m_pCS)
+            m_pCS->Leave();
+    }
 };
+
+typedef MC_LockT<MC_CritSection> MC_Lock; //!< the lock for an MC_CritSection
@@ -0,0 +1,28 @@
+#include "mc_timer.h"
+#ifdef _WIN32
+#include "windows.h"
+#else
+#include <time.h>
+#endif
+
+/*! \brief Returns a monotonic time stamp in milliseconds.
+\return \b double : milliseconds since an arbitrary fixed point. Only differences are meaningful.
+\note On Win32 the counter frequency is read once and kept in a static.
+*/
+double MC_Timer::Now(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq = {0};
+	LARGE_INTEGER cnt;
+	if (freq.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&freq);
+	}
+	QueryPerformanceCounter(&cnt);
+	return (static_cast<double>(cnt.QuadPart) * 1000.0) / static_cast<double>(freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (static_cast<double>(ts.tv_sec) * 1000.0) + (static_cast<double>(ts.tv_nsec) / 1000000.0);
+#endif
+}
\ No newline at end of file
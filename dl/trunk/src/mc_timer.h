@@ -0,0 +1,16 @@
+/*! \file mc_timer.h
+	\brief The header for the high resolution timer used to timestamp cached values.
+
+*/
+#pragma once
+
+/*!	\brief Monotonic millisecond clock.
+
+	Wraps QueryPerformanceCounter on Win32 and clock_gettime(CLOCK_MONOTONIC) elsewhere
+	so the rest of the library can timestamp values without caring about the OS.
+*/
+class MC_Timer
+{
+public:
+	static double Now(void); //!< returns the current monotonic time in milliseconds
+};
\ No newline at end of file
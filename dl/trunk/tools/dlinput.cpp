@@ -0,0 +1,767 @@
+/*! \file dlinput.cpp
+	\brief Linux evdev input bridge.
+
+	Reads joysticks, pedals and button boxes straight from /dev/input with epoll and
+	drives a C_DeviceLink session with them. Axes feed the control frame, so every
+	axis that moved in one wakeup goes out in a single packet. Switches go through
+	the toggle layer and buttons can send any set code.
+
+	Usage: dlinput map_file
+	The game's IP and port come from config.ini as usual. Linux only, so there is no
+	project file. Build it with the library sources in ../src and link with -lrt.
+
+	The map file has a section per device, named by its path or by name: and a part
+	of the name the kernel reports, followed by one line per axis or button:
+	*	- [name:T.16000M]\n
+	*	- ABS_X = aileron dz=0.02\n
+	*	- ABS_Y = elevator invert\n
+	*	- ABS_THROTTLE = power:0 half invert\n
+	*	- BTN_TRIGGER = press:411\n
+	*	- [/dev/input/event7]\n
+	*	- BTN_0 = switch:gear\n
+	*	.
+	Axis targets are aileron, elevator, rudder, brakes, ail_trim, elv_trim, rud_trim,
+	flaps, power:eng and pitch:eng. Options are invert, half (0 to 1 instead of -1 to 1)
+	and dz=fraction for a center deadzone. switch:name follows a latching switch with the
+	toggle layer (gear, lvl_stab, airbrakes, tailwheel, wing_fold, canopy, hook, chocks,
+	wep, feather). press:code sends set codes each time the button goes down. Events can
+	also be given as ABS:number or KEY:number.
+
+	To test without hardware, create a virtual device with uinput (python-evdev's UInput
+	or a few ioctls on /dev/uinput), map it by name: and write events to it. The latency
+	line covers the kernel's event time stamp to the return of sendto().
+*/
+
+#include "devicelink.h"
+#include "devicelink_seq.h"
+#include <linux/input.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+
+#define IB_MAX_DEVS 16 //!< input devices one bridge reads
+#define IB_MAX_MAPS 128 //!< axis and button mappings
+#define IB_STATS_PERIOD 5000.00 //!< ms between statistics lines
+#define IB_LAT_STEP 0.05 //!< width of a latency histogram bucket in ms
+#define IB_LAT_BUCKETS 400 //!< latency buckets. the last one holds everything slower
+#define IB_TOGGLE_PERIOD 20.00 //!< ms between ToggleTick() calls
+
+/*!	\brief What a mapping drives.
+*/
+enum ib_kind {IB_AXIS, IB_SWITCH, IB_PRESS};
+
+/*!	\brief One input device.
+*/
+struct ib_device
+{
+	char spec[128]; //!< the section name from the map file
+	int fd; //!< the open event device. -1 when closed
+};
+
+/*!	\brief One axis or button and what it drives.
+*/
+struct ib_map
+{
+	int dev; //!< index into the device table
+	int type; //!< EV_ABS or EV_KEY
+	int code; //!< event code, i.e. ABS_X
+	ib_kind kind; //!< what the event drives
+	DLControl ctrl; //!< axis target
+	int eng; //!< engine index for power and pitch
+	DLToggle toggle; //!< switch target
+	char cmd[64]; //!< set codes for a button
+	bool invert; //!< reverse the axis
+	bool half; //!< axis runs 0 to 1 instead of -1 to 1
+	float dz; //!< center deadzone as a fraction of the axis
+	int min; //!< lowest raw value from EVIOCGABS
+	int max; //!< highest raw value from EVIOCGABS
+};
+
+/*!	\brief Pairs an event name with its code.
+*/
+struct ib_name
+{
+	const char* name; //!< name as in linux/input-event-codes.h
+	int type; //!< EV_ABS or EV_KEY
+	int code; //!< the event code
+};
+
+static const ib_name ib_events[] =
+{
+	{"ABS_X", EV_ABS, ABS_X}, {"ABS_Y", EV_ABS, ABS_Y}, {"ABS_Z", EV_ABS, ABS_Z},
+	{"ABS_RX", EV_ABS, ABS_RX}, {"ABS_RY", EV_ABS, ABS_RY}, {"ABS_RZ", EV_ABS, ABS_RZ},
+	{"ABS_THROTTLE", EV_ABS, ABS_THROTTLE}, {"ABS_RUDDER", EV_ABS, ABS_RUDDER},
+	{"ABS_WHEEL", EV_ABS, ABS_WHEEL}, {"ABS_GAS", EV_ABS, ABS_GAS}, {"ABS_BRAKE", EV_ABS, ABS_BRAKE},
+	{"ABS_HAT0X", EV_ABS, ABS_HAT0X}, {"ABS_HAT0Y", EV_ABS, ABS_HAT0Y},
+	{"ABS_MISC", EV_ABS, ABS_MISC},
+	{"BTN_0", EV_KEY, BTN_0}, {"BTN_1", EV_KEY, BTN_1}, {"BTN_2", EV_KEY, BTN_2},
+	{"BTN_3", EV_KEY, BTN_3}, {"BTN_4", EV_KEY, BTN_4}, {"BTN_5", EV_KEY, BTN_5},
+	{"BTN_6", EV_KEY, BTN_6}, {"BTN_7", EV_KEY, BTN_7}, {"BTN_8", EV_KEY, BTN_8},
+	{"BTN_9", EV_KEY, BTN_9},
+	{"BTN_TRIGGER", EV_KEY, BTN_TRIGGER}, {"BTN_THUMB", EV_KEY, BTN_THUMB},
+	{"BTN_THUMB2", EV_KEY, BTN_THUMB2}, {"BTN_TOP", EV_KEY, BTN_TOP},
+	{"BTN_TOP2", EV_KEY, BTN_TOP2}, {"BTN_PINKIE", EV_KEY, BTN_PINKIE},
+	{"BTN_BASE", EV_KEY, BTN_BASE}, {"BTN_BASE2", EV_KEY, BTN_BASE2},
+	{"BTN_BASE3", EV_KEY, BTN_BASE3}, {"BTN_BASE4", EV_KEY, BTN_BASE4},
+	{"BTN_BASE5", EV_KEY, BTN_BASE5}, {"BTN_BASE6", EV_KEY, BTN_BASE6},
+	{"BTN_SOUTH", EV_KEY, BTN_SOUTH}, {"BTN_EAST", EV_KEY, BTN_EAST},
+	{"BTN_NORTH", EV_KEY, BTN_NORTH}, {"BTN_WEST", EV_KEY, BTN_WEST},
+	{"BTN_TL", EV_KEY, BTN_TL}, {"BTN_TR", EV_KEY, BTN_TR},
+	{"BTN_SELECT", EV_KEY, BTN_SELECT}, {"BTN_START", EV_KEY, BTN_START}
+};
+
+static const char* ib_axes[DLC_COUNT] =
+{
+	"aileron", "elevator", "rudder", "brakes", "ail_trim", "elv_trim", "rud_trim", "flaps", "power", "pitch"
+};
+
+static const char* ib_toggles[DLT_COUNT] =
+{
+	"gear", "lvl_stab", "airbrakes", "tailwheel", "wing_fold", "canopy", "hook", "chocks", "wep", "feather"
+};
+
+/*!	\brief The bridge. Owns the devices, the mappings and the session to the game.
+*/
+class C_DLInput
+{
+	public:
+		C_DLInput();
+		~C_DLInput();
+		bool Init(const char* map_file);
+		void Run(void);
+
+	private:
+		C_DeviceLink m_dl; //!< the session to the game
+		int m_epoll; //!< epoll set of every open device
+		struct ib_device m_dev[IB_MAX_DEVS]; //!< devices from the map file
+		int m_ndev; //!< number of devices in m_dev
+		struct ib_map m_map[IB_MAX_MAPS]; //!< mappings from the map file
+		int m_nmap; //!< number of mappings in m_map
+		bool m_any_switch; //!< TRUE if a mapping uses the toggle layer
+		unsigned long m_events; //!< input events read
+		unsigned long m_frames; //!< control frames that sent a packet
+		unsigned long m_packets; //!< control packets at the end of the last frame
+		double m_sum_lat; //!< sum of event to sendto latency
+		double m_max_lat; //!< worst event to sendto latency
+		unsigned long m_hist[IB_LAT_BUCKETS]; //!< latency histogram
+		double m_stats_due; //!< MC_Timer::Now() of the next statistics line
+
+		bool read_map(const char* map_file);
+		bool parse_line(char* line, int lineno);
+		int open_device(const char* spec);
+		void read_device(int dev, double* oldest, bool* moved);
+		void apply(struct ib_map* map, int value);
+		void record_latency(double latency);
+		double percentile(double frac);
+		void print_stats(void);
+};
+
+/*! \brief Cuts leading and trailing white space off a string in place.
+\param str : the string
+\return \b char* : the first non blank character
+*/
+static char* trim(char* str)
+{
+	while ((*str == ' ') || (*str == '\t'))
+	{
+		++str;
+	}
+	size_t len = strlen(str);
+	while ((len > 0) && ((str[len - 1] == ' ') || (str[len - 1] == '\t') || (str[len - 1] == '\r') || (str[len - 1] == '\n')))
+	{
+		str[--len] = '\0';
+	}
+	return str;
+}
+
+/*! \brief Looks up an event by name or by ABS:number / KEY:number.
+\param name : the event
+\param type : receives EV_ABS or EV_KEY
+\param code : receives the event code
+\return \b boolean : FALSE for an unknown name
+*/
+static bool find_event(const char* name, int* type, int* code)
+{
+	if (strncmp(name, "ABS:", 4) == 0)
+	{
+		*type = EV_ABS;
+		*code = atoi(name + 4);
+		return ((*code >= 0) && (*code <= ABS_MAX));
+	}
+	if (strncmp(name, "KEY:", 4) == 0)
+	{
+		*type = EV_KEY;
+		*code = atoi(name + 4);
+		return ((*code >= 0) && (*code <= KEY_MAX));
+	}
+	for (unsigned int i = 0; i < (sizeof(ib_events) / sizeof(ib_events[0])); ++i)
+	{
+		if (strcmp(name, ib_events[i].name) == 0)
+		{
+			*type = ib_events[i].type;
+			*code = ib_events[i].code;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*! \brief Constructor.
+*/
+C_DLInput::C_DLInput(void)
+: m_epoll(-1)
+,m_ndev(0)
+,m_nmap(0)
+,m_any_switch(FALSE)
+,m_events(0)
+,m_frames(0)
+,m_packets(0)
+,m_sum_lat(0.00)
+,m_max_lat(0.00)
+,m_stats_due(0.00)
+{
+	memset(m_dev, 0, sizeof(m_dev));
+	memset(m_map, 0, sizeof(m_map));
+	memset(m_hist, 0, sizeof(m_hist));
+}
+
+/*! \brief Deconstructor. Closes the devices.
+*/
+C_DLInput::~C_DLInput()
+{
+	for (int i = 0; i < m_ndev; ++i)
+	{
+		if (m_dev[i].fd >= 0)
+		{
+			close(m_dev[i].fd);
+		}
+	}
+	if (m_epoll >= 0)
+	{
+		close(m_epoll);
+	}
+}
+
+/*! \brief Opens an event device by path or by name:part of its name.
+\param spec : the section name from the map file
+\return \b integer : the open descriptor or -1
+\note The clock is switched to CLOCK_MONOTONIC so the event time stamps compare with MC_Timer::Now().
+*/
+int C_DLInput::open_device(const char* spec)
+{
+	int fd = -1;
+	if (strncmp(spec, "name:", 5) == 0)
+	{
+		DIR* dir = opendir("/dev/input");
+		if (dir == NULL)
+		{
+			return -1;
+		}
+		struct dirent* ent = NULL;
+		while ((fd < 0) && ((ent = readdir(dir)) != NULL))
+		{
+			if (strncmp(ent->d_name, "event", 5) != 0)
+			{
+				continue;
+			}
+			char path[300];
+			char name[256];
+			memset(name, 0, sizeof(name));
+			snprintf(path, sizeof(path), "/dev/input/%s", ent->d_name);
+			int cand = open(path, O_RDONLY | O_NONBLOCK);
+			if (cand < 0)
+			{
+				continue;
+			}
+			if ((ioctl(cand, EVIOCGNAME(sizeof(name) - 1), name) >= 0) && (strstr(name, spec + 5) != NULL))
+			{
+				fd = cand;
+			} else
+			{
+				close(cand);
+			}
+		}
+		closedir(dir);
+	} else
+	{
+		fd = open(spec, O_RDONLY | O_NONBLOCK);
+	}
+	if (fd >= 0)
+	{
+		int clk = CLOCK_MONOTONIC;
+		ioctl(fd, EVIOCSCLOCKID, &clk);
+	}
+	return fd;
+}
+
+/*! \brief Parses one mapping line of the map file.
+\param line : the line without its comment
+\param lineno : line number for error messages
+\return \b boolean : FALSE on a line that can't be used
+*/
+bool C_DLInput::parse_line(char* line, int lineno)
+{
+	if (m_ndev == 0)
+	{
+		fprintf(stderr, "dlinput: line %d: mapping before the first [device]\n", lineno);
+		return FALSE;
+	}
+	if (m_nmap >= IB_MAX_MAPS)
+	{
+		fprintf(stderr, "dlinput: line %d: too many mappings\n", lineno);
+		return FALSE;
+	}
+	char* eq = strchr(line, '=');
+	if (eq == NULL)
+	{
+		fprintf(stderr, "dlinput: line %d: expected event = target\n", lineno);
+		return FALSE;
+	}
+	*eq = '\0';
+	struct ib_map* map = &m_map[m_nmap];
+	memset(map, 0, sizeof(struct ib_map));
+	map->dev = m_ndev - 1;
+	if (find_event(trim(line), &map->type, &map->code) == FALSE)
+	{
+		fprintf(stderr, "dlinput: line %d: unknown event %s\n", lineno, trim(line));
+		return FALSE;
+	}
+	char* tok = strtok(eq + 1, " \t\r\n");
+	if (tok == NULL)
+	{
+		fprintf(stderr, "dlinput: line %d: missing target\n", lineno);
+		return FALSE;
+	}
+	bool found = FALSE;
+	if (strncmp(tok, "switch:", 7) == 0)
+	{
+		for (int t = 0; t < DLT_COUNT; ++t)
+		{
+			if (strcmp(tok + 7, ib_toggles[t]) == 0)
+			{
+				map->kind = IB_SWITCH;
+				map->toggle = static_cast<DLToggle>(t);
+				m_any_switch = TRUE;
+				found = TRUE;
+			}
+		}
+	} else if (strncmp(tok, "press:", 6) == 0)
+	{
+		map->kind = IB_PRESS;
+		snprintf(map->cmd, sizeof(map->cmd), "%s", tok + 6);
+		found = C_DLSequence::ValidSet(map->cmd);
+	} else
+	{
+		char* colon = strchr(tok, ':');
+		if (colon != NULL)
+		{
+			*colon = '\0';
+			map->eng = atoi(colon + 1);
+		}
+		for (int c = 0; c < DLC_COUNT; ++c)
+		{
+			if (strcmp(tok, ib_axes[c]) == 0)
+			{
+				map->kind = IB_AXIS;
+				map->ctrl = static_cast<DLControl>(c);
+				found = ((map->eng >= 0) && (map->eng < DL_MAX_ENGINES));
+			}
+		}
+	}
+	if (found == FALSE)
+	{
+		fprintf(stderr, "dlinput: line %d: bad target %s\n", lineno, tok);
+		return FALSE;
+	}
+	if ((map->kind == IB_AXIS) != (map->type == EV_ABS))
+	{
+		fprintf(stderr, "dlinput: line %d: axes need an ABS_ event and buttons a BTN_ or KEY: event\n", lineno);
+		return FALSE;
+	}
+	while ((tok = strtok(NULL, " \t\r\n")) != NULL)
+	{
+		if (strcmp(tok, "invert") == 0)
+		{
+			map->invert = TRUE;
+		} else if (strcmp(tok, "half") == 0)
+		{
+			map->half = TRUE;
+		} else if (strncmp(tok, "dz=", 3) == 0)
+		{
+			map->dz = static_cast<float>(atof(tok + 3));
+		} else
+		{
+			fprintf(stderr, "dlinput: line %d: unknown option %s\n", lineno, tok);
+			return FALSE;
+		}
+	}
+	if (map->kind == IB_AXIS)
+	{
+		struct input_absinfo abs;
+		memset(&abs, 0, sizeof(abs));
+		if (ioctl(m_dev[map->dev].fd, EVIOCGABS(map->code), &abs) < 0)
+		{
+			abs.minimum = -32768;
+			abs.maximum = 32767;
+		}
+		map->min = abs.minimum;
+		map->max = abs.maximum;
+		if (map->max <= map->min)
+		{
+			fprintf(stderr, "dlinput: line %d: axis reports an empty range\n", lineno);
+			return FALSE;
+		}
+	}
+	++m_nmap;
+	return TRUE;
+}
+
+/*! \brief Reads the map file and opens every device in it.
+\param map_file : path of the map file
+\return \b boolean : FALSE if the file or a device can't be used
+*/
+bool C_DLInput::read_map(const char* map_file)
+{
+	FILE* fp = fopen(map_file, "r");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "dlinput: cannot open %s\n", map_file);
+		return FALSE;
+	}
+	char temp[256];
+	int lineno = 0;
+	bool flag = TRUE;
+	while ((flag == TRUE) && (fgets(temp, sizeof(temp), fp) != NULL))
+	{
+		++lineno;
+		char* hash = strchr(temp, '#');
+		if (hash != NULL)
+		{
+			*hash = '\0';
+		}
+		char* line = trim(temp);
+		if (line[0] == '\0')
+		{
+			continue;
+		}
+		if (line[0] != '[')
+		{
+			flag = parse_line(line, lineno);
+			continue;
+		}
+		char* end = strchr(line, ']');
+		if ((end == NULL) || (m_ndev >= IB_MAX_DEVS))
+		{
+			fprintf(stderr, "dlinput: line %d: bad or too many [device] sections\n", lineno);
+			flag = FALSE;
+			continue;
+		}
+		*end = '\0';
+		struct ib_device* dev = &m_dev[m_ndev];
+		snprintf(dev->spec, sizeof(dev->spec), "%s", line + 1);
+		dev->fd = open_device(dev->spec);
+		if (dev->fd < 0)
+		{
+			fprintf(stderr, "dlinput: cannot open device %s. Error %d\n", dev->spec, errno);
+			flag = FALSE;
+			continue;
+		}
+		++m_ndev;
+	}
+	fclose(fp);
+	if ((flag == TRUE) && (m_nmap == 0))
+	{
+		fprintf(stderr, "dlinput: %s has no mappings\n", map_file);
+		flag = FALSE;
+	}
+	return flag;
+}
+
+/*! \brief Reads the map file, opens the devices and the session to the game.
+\param map_file : path of the map file
+\return \b boolean
+*/
+bool C_DLInput::Init(const char* map_file)
+{
+	if (read_map(map_file) == FALSE)
+	{
+		return FALSE;
+	}
+	if (m_dl.Init() == FALSE)
+	{
+		fprintf(stderr, "dlinput: could not open the session to the game. Check config.ini\n");
+		return FALSE;
+	}
+	m_dl.EnableControlFrame(TRUE);
+	m_epoll = epoll_create(IB_MAX_DEVS);
+	if (m_epoll < 0)
+	{
+		fprintf(stderr, "dlinput: epoll_create failed. Error %d\n", errno);
+		return FALSE;
+	}
+	for (int i = 0; i < m_ndev; ++i)
+	{
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = static_cast<unsigned int>(i);
+		if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_dev[i].fd, &ev) != 0)
+		{
+			fprintf(stderr, "dlinput: epoll_ctl failed for %s. Error %d\n", m_dev[i].spec, errno);
+			return FALSE;
+		}
+	}
+	fprintf(stderr, "dlinput: %d devices, %d mappings\n", m_ndev, m_nmap);
+	return TRUE;
+}
+
+/*! \brief Feeds one input event value to its target.
+\param map : the mapping
+\param value : the raw event value
+*/
+void C_DLInput::apply(struct ib_map* map, int value)
+{
+	if (map->kind == IB_SWITCH)
+	{
+		m_dl.SetToggle(map->toggle, (value != 0));
+		return;
+	}
+	if (map->kind == IB_PRESS)
+	{
+		if (value == 1)
+		{
+			m_dl.SendCmd(map->cmd);
+		}
+		return;
+	}
+	float pos = static_cast<float>(value - map->min) / static_cast<float>(map->max - map->min);
+	if (map->invert == TRUE)
+	{
+		pos = 1.00f - pos;
+	}
+	if (map->half == FALSE)
+	{
+		pos = (pos * 2.00f) - 1.00f;
+		if ((pos < map->dz) && (pos > -map->dz))
+		{
+			pos = 0.00f;
+		}
+	}
+	switch (map->ctrl)
+	{
+	case DLC_AILERON:
+		m_dl.Set_Aileron(pos);
+		break;
+	case DLC_ELEVATOR:
+		m_dl.Set_Elevator(pos);
+		break;
+	case DLC_RUDDER:
+		m_dl.Set_Rudder(pos);
+		break;
+	case DLC_BRAKES:
+		m_dl.Set_Brakes(pos);
+		break;
+	case DLC_AIL_TRIM:
+		m_dl.Set_AilTrim(pos);
+		break;
+	case DLC_ELV_TRIM:
+		m_dl.Set_ElvTrim(pos);
+		break;
+	case DLC_RUDDER_TRIM:
+		m_dl.Set_RudTrim(pos);
+		break;
+	case DLC_FLAPS:
+		m_dl.Set_Flaps(pos);
+		break;
+	case DLC_POWER:
+		m_dl.Set_Power(map->eng, pos);
+		break;
+	case DLC_PROP_PITCH:
+		m_dl.Set_PropPitch(map->eng, pos);
+		break;
+	default:
+		break;
+	}
+}
+
+/*! \brief Reads every queued event of a device and applies the mapped ones.
+\param dev : index into m_dev
+\param oldest : receives the time stamp of the oldest axis event, if older than what it holds
+\param moved : set to TRUE if an axis was written
+*/
+void C_DLInput::read_device(int dev, double* oldest, bool* moved)
+{
+	struct input_event evs[64];
+	for (;;)
+	{
+		ssize_t len = read(m_dev[dev].fd, evs, sizeof(evs));
+		if (len <= 0)
+		{
+			if ((len == 0) || ((errno != EAGAIN) && (errno != EINTR)))
+			{
+				fprintf(stderr, "dlinput: lost device %s. Error %d\n", m_dev[dev].spec, (len == 0) ? 0 : errno);
+				epoll_ctl(m_epoll, EPOLL_CTL_DEL, m_dev[dev].fd, NULL);
+				close(m_dev[dev].fd);
+				m_dev[dev].fd = -1;
+			}
+			return;
+		}
+		int cnt = static_cast<int>(len / sizeof(struct input_event));
+		for (int i = 0; i < cnt; ++i)
+		{
+			if ((evs[i].type != EV_ABS) && (evs[i].type != EV_KEY))
+			{
+				continue;
+			}
+			++m_events;
+			for (int m = 0; m < m_nmap; ++m)
+			{
+				struct ib_map* map = &m_map[m];
+				if ((map->dev != dev) || (map->type != evs[i].type) || (map->code != evs[i].code))
+				{
+					continue;
+				}
+				apply(map, evs[i].value);
+				if (map->kind == IB_AXIS)
+				{
+					double stamp = (static_cast<double>(evs[i].time.tv_sec) * 1000.0) + (static_cast<double>(evs[i].time.tv_usec) / 1000.0);
+					if ((*oldest == 0.00) || (stamp < *oldest))
+					{
+						*oldest = stamp;
+					}
+					*moved = TRUE;
+				}
+			}
+		}
+	}
+}
+
+/*! \brief Adds one event to sendto latency to the statistics.
+\param latency : in ms
+*/
+void C_DLInput::record_latency(double latency)
+{
+	if (latency < 0.00)
+	{
+		latency = 0.00;
+	}
+	++m_frames;
+	m_sum_lat += latency;
+	if (latency > m_max_lat)
+	{
+		m_max_lat = latency;
+	}
+	int bucket = static_cast<int>(latency / IB_LAT_STEP);
+	if (bucket >= IB_LAT_BUCKETS)
+	{
+		bucket = IB_LAT_BUCKETS - 1;
+	}
+	++m_hist[bucket];
+}
+
+/*! \brief Returns the upper edge of the bucket holding a percentile of the latencies.
+\param frac : the percentile, i.e. 0.99
+\return \b double : latency in ms
+*/
+double C_DLInput::percentile(double frac)
+{
+	unsigned long want = static_cast<unsigned long>(static_cast<double>(m_frames) * frac);
+	unsigned long seen = 0;
+	for (int i = 0; i < IB_LAT_BUCKETS; ++i)
+	{
+		seen += m_hist[i];
+		if (seen > want)
+		{
+			return (i + 1) * IB_LAT_STEP;
+		}
+	}
+	return IB_LAT_BUCKETS * IB_LAT_STEP;
+}
+
+/*! \brief Prints and clears the statistics.
+*/
+void C_DLInput::print_stats(void)
+{
+	DLControlStats st;
+	m_dl.GetControlStats(&st);
+	double mean = 0.00;
+	double p50 = 0.00;
+	double p99 = 0.00;
+	if (m_frames > 0)
+	{
+		mean = m_sum_lat / static_cast<double>(m_frames);
+		p50 = percentile(0.50);
+		p99 = percentile(0.99);
+	}
+	fprintf(stderr, "dlinput: %lu events, %lu frames, %lu control packets, event to sendto mean %.3f p50 %.2f p99 %.2f max %.3f ms\n",
+		m_events, m_frames, st.packets, mean, p50, p99, m_max_lat);
+	m_events = 0;
+	m_frames = 0;
+	m_sum_lat = 0.00;
+	m_max_lat = 0.00;
+	memset(m_hist, 0, sizeof(m_hist));
+	m_dl.ResetControlStats();
+	m_packets = 0;
+}
+
+/*! \brief Main loop. Never returns.
+\note Every wakeup drains all ready devices before one FlushControls(), so axes that moved
+together go out in one packet.
+*/
+void C_DLInput::Run(void)
+{
+	struct epoll_event evs[IB_MAX_DEVS];
+	double toggle_due = 0.00;
+	m_stats_due = MC_Timer::Now() + IB_STATS_PERIOD;
+	for (;;)
+	{
+		int n = epoll_wait(m_epoll, evs, IB_MAX_DEVS, static_cast<int>(IB_TOGGLE_PERIOD));
+		double oldest = 0.00;
+		bool moved = FALSE;
+		for (int i = 0; i < n; ++i)
+		{
+			read_device(static_cast<int>(evs[i].data.u32), &oldest, &moved);
+		}
+		if (moved == TRUE)
+		{
+			DLControlStats st;
+			m_dl.FlushControls();
+			double sent = MC_Timer::Now();
+			m_dl.GetControlStats(&st);
+			if (st.packets != m_packets)
+			{
+				//only frames that reached sendto count, not ones the control policies held back
+				record_latency(sent - oldest);
+				m_packets = st.packets;
+			}
+		}
+		double now = MC_Timer::Now();
+		if ((m_any_switch == TRUE) && (now >= toggle_due))
+		{
+			m_dl.ToggleTick();
+			toggle_due = now + IB_TOGGLE_PERIOD;
+		}
+		if (now >= m_stats_due)
+		{
+			print_stats();
+			m_stats_due = now + IB_STATS_PERIOD;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: dlinput map_file\n");
+		return 1;
+	}
+	C_DLInput bridge;
+	if (bridge.Init(argv[1]) == FALSE)
+	{
+		return 1;
+	}
+	bridge.Run();
+	return 0;
+}
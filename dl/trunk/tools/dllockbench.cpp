@@ -0,0 +1,240 @@
+/*! \file dllockbench.cpp
+	\brief Measures what the lock policies cost a Get_ method.
+
+	Every cached Get_ method is a lock around a read of one private var. This times
+	that exact shape with each policy (MC_NullCritSection, MC_CritSection and
+	MC_SpinCritSection) on one thread and on several threads sharing one lock, then
+	times the library's own Get_IAS() and Get_RPM() with the DL_LOCK_POLICY it was
+	built with. Last it runs 1 to threads threads, first all on one shared session and
+	then each on its own session. Every session has its own lock, so the second set
+	should scale with the number of cores.
+
+	Usage: dllockbench [threads] [calls_per_thread]
+	The library part needs config.ini like any other program but no running game.
+	Build the library with -DDL_LOCK_POLICY=DL_LOCK_NULL, DL_LOCK_MUTEX or DL_LOCK_SPIN
+	to compare the real methods. Every file linked together must use the same policy.
+*/
+
+#include "devicelink.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#define LB_MAX_THREADS 64 //!< most threads one run starts
+#define LB_DEF_THREADS 4 //!< threads when none are given
+#define LB_DEF_CALLS 2000000 //!< calls per thread when none are given
+
+/*!	\brief A Get_ method reduced to its locking: a lock around a read of one cached value.
+*/
+template <class CS>
+struct lb_cache
+{
+	CS lock; //!< the policy under test
+	float value; //!< the cached value
+};
+
+/*!	\brief What one benchmark thread runs.
+*/
+struct lb_job
+{
+	void (*run)(void* target, long calls, float* sink); //!< the loop
+	void* target; //!< what the loop reads
+	long calls; //!< iterations
+	float sink; //!< sum of the values read, so the compiler can't drop the reads
+};
+
+/*! \brief Reads the cached value calls times, taking the lock each time like a Get_ does.
+*/
+template <class CS>
+static void lb_get_loop(void* target, long calls, float* sink)
+{
+	lb_cache<CS>* cache = static_cast<lb_cache<CS>*>(target);
+	float sum = 0.00;
+	for (long i = 0; i < calls; ++i)
+	{
+		MC_LockT<CS> m_Lock(&cache->lock);
+		sum += cache->value;
+	}
+	*sink = sum;
+}
+
+/*! \brief Calls C_DeviceLink::Get_IAS() and Get_RPM() calls times in turn.
+*/
+static void lb_devicelink_loop(void* target, long calls, float* sink)
+{
+	C_DeviceLink* dl = static_cast<C_DeviceLink*>(target);
+	float sum = 0.00;
+	for (long i = 0; i < calls; ++i)
+	{
+		sum += ((i & 1) == 0) ? dl->Get_IAS() : dl->Get_RPM(ENGINE_ONE);
+	}
+	*sink = sum;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI lb_thread(LPVOID arg)
+#else
+static void* lb_thread(void* arg)
+#endif
+{
+	lb_job* job = static_cast<lb_job*>(arg);
+	job->run(job->target, job->calls, &job->sink);
+	return 0;
+}
+
+/*! \brief Starts one thread per job and waits for all of them.
+\return \b double : wall time in milliseconds
+*/
+static double lb_run(lb_job* jobs, int n)
+{
+#ifdef _WIN32
+	HANDLE handles[LB_MAX_THREADS];
+#else
+	pthread_t handles[LB_MAX_THREADS];
+#endif
+	double start = MC_Timer::Now();
+	for (int i = 0; i < n; ++i)
+	{
+		jobs[i].sink = 0.00;
+#ifdef _WIN32
+		handles[i] = CreateThread(NULL, 0, lb_thread, &jobs[i], 0, NULL);
+#else
+		pthread_create(&handles[i], NULL, lb_thread, &jobs[i]);
+#endif
+	}
+	for (int i = 0; i < n; ++i)
+	{
+#ifdef _WIN32
+		WaitForSingleObject(handles[i], INFINITE);
+		CloseHandle(handles[i]);
+#else
+		pthread_join(handles[i], NULL);
+#endif
+	}
+	return MC_Timer::Now() - start;
+}
+
+/*! \brief Runs one loop on the given number of threads at once.
+\return \b double : nanoseconds per call, i.e. wall time divided by the calls of one thread
+*/
+static double lb_time(void (*run)(void*, long, float*), void* target, int threads, long calls)
+{
+	lb_job jobs[LB_MAX_THREADS];
+	for (int i = 0; i < threads; ++i)
+	{
+		jobs[i].run = run;
+		jobs[i].target = target;
+		jobs[i].calls = calls;
+	}
+	return (lb_run(jobs, threads) * 1000000.00) / calls;
+}
+
+/*! \brief Runs the Get_ loop on n threads, each on sessions[i] or all on sessions[0].
+\return \b double : millions of calls per second over all threads
+*/
+static double lb_sessions(C_DeviceLink* sessions, int n, long calls, bool own)
+{
+	lb_job jobs[LB_MAX_THREADS];
+	for (int i = 0; i < n; ++i)
+	{
+		jobs[i].run = lb_devicelink_loop;
+		jobs[i].target = (own == TRUE) ? &sessions[i] : &sessions[0];
+		jobs[i].calls = calls;
+	}
+	return (static_cast<double>(n) * calls) / (lb_run(jobs, n) * 1000.00);
+}
+
+/*! \brief Prints one line: the policy, its cost on one thread and on all of them.
+*/
+static void lb_report(const char* name, void (*run)(void*, long, float*), void* target, int threads, long calls, bool thread_safe)
+{
+	double one = lb_time(run, target, 1, calls);
+	if (thread_safe == TRUE)
+	{
+		double many = lb_time(run, target, threads, calls);
+		printf("%-28s %8.1f ns/call %8.1f ns/call\n", name, one, many);
+	} else
+	{
+		printf("%-28s %8.1f ns/call %16s\n", name, one, "not thread safe");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int threads = LB_DEF_THREADS;
+	long calls = LB_DEF_CALLS;
+	if (argc > 1)
+	{
+		threads = atoi(argv[1]);
+	}
+	if (argc > 2)
+	{
+		calls = atol(argv[2]);
+	}
+	if ((threads < 1) || (threads > LB_MAX_THREADS) || (calls < 1))
+	{
+		printf("usage: dllockbench [threads 1-%d] [calls_per_thread]\n", LB_MAX_THREADS);
+		return 1;
+	}
+	printf("%-28s %17s %8d threads\n", "", "1 thread", threads);
+
+	lb_cache<MC_NullCritSection> null_cache;
+	null_cache.value = 1.00;
+	lb_report("MC_NullCritSection", lb_get_loop<MC_NullCritSection>, &null_cache, threads, calls, FALSE);
+	lb_cache<MC_CritSection> mutex_cache;
+	mutex_cache.value = 1.00;
+	lb_report("MC_CritSection", lb_get_loop<MC_CritSection>, &mutex_cache, threads, calls, TRUE);
+	lb_cache<MC_SpinCritSection> spin_cache;
+	spin_cache.value = 1.00;
+	lb_report("MC_SpinCritSection", lb_get_loop<MC_SpinCritSection>, &spin_cache, threads, calls, TRUE);
+
+	C_DeviceLink dl;
+	if (dl.Init() == FALSE)
+	{
+		printf("Init failed. Skipping the library methods. Is config.ini here?\n");
+		return 1;
+	}
+	const char* policy = (DL_LOCK_POLICY == DL_LOCK_NULL) ? "null" : ((DL_LOCK_POLICY == DL_LOCK_SPIN) ? "spin" : "mutex");
+	char name[64];
+#if _MSC_VER >= 1400
+	_snprintf_s(name,sizeof(name),_TRUNCATE,"Get_IAS/Get_RPM (%s)",policy);
+#else
+	_snprintf(name,sizeof(name),"Get_IAS/Get_RPM (%s)",policy);
+#endif
+	lb_report(name, lb_devicelink_loop, &dl, threads, calls, (DL_LOCK_POLICY != DL_LOCK_NULL));
+	dl.EnableLockStats(TRUE);
+	lb_time(lb_devicelink_loop, &dl, threads, calls);
+	MC_LockStats stats;
+	dl.GetLockStats(&stats);
+	printf("session lock: %lu acquisitions, %lu contended, %lu slept, %.1f ms waiting\n",
+		stats.acquisitions, stats.contended, stats.parked, stats.wait_time);
+	if (DL_LOCK_POLICY == DL_LOCK_NULL)
+	{
+		return 0; //a shared session isn't safe without a lock
+	}
+
+	C_DeviceLink* sessions = new C_DeviceLink[threads];
+	for (int i = 0; i < threads; ++i)
+	{
+		if (sessions[i].Init() == FALSE)
+		{
+			printf("Init failed on session %d.\n", i);
+			delete [] sessions;
+			return 1;
+		}
+	}
+	printf("\n%-8s %20s %20s\n", "threads", "shared session", "session per thread");
+	double base = 0.00;
+	for (int n = 1; n <= threads; ++n)
+	{
+		double shared = lb_sessions(sessions, n, calls, FALSE);
+		double own = lb_sessions(sessions, n, calls, TRUE);
+		if (n == 1)
+		{
+			base = own;
+		}
+		printf("%-8d %13.1f Mcall/s %13.1f Mcall/s  %3.0f%% of linear\n", n, shared, own, (own * 100.00) / (base * n));
+	}
+	delete [] sessions;
+	return 0;
+}
@@ -0,0 +1,433 @@
+/*! \file dlproxy.cpp
+	\brief DeviceLink multiplexing proxy.
+
+	Faces the game with a single C_DeviceLink session and accepts standard R packets
+	from any number of local DeviceLink clients. Identical get codes asked for within
+	the same window are sent upstream once and the answer is fanned back out to every
+	client that asked. Set codes are forwarded upstream in the order they arrive.
+
+	Usage: dlproxy [listen_port] [window_ms]
+	The game's IP and port come from config.ini as usual. Point the clients at this
+	machine and listen_port (default 10001) instead of the game.
+*/
+
+#include "devicelink.h"
+
+#define PX_DEF_PORT 10001 //!< default port the clients talk to
+#define PX_DEF_WINDOW 5.00 //!< default merge window in ms
+#define PX_MAX_REQ 64 //!< client packets held per window
+#define PX_MAX_KEYS 256 //!< distinct get codes held per window
+#define PX_MAX_REC 32 //!< longest get code with its parameters, i.e. "64\\7"
+#define PX_MAX_ANS 96 //!< longest answer record, i.e. "64\\7\\2400.0"
+#define PX_STATS_PERIOD 5000.00 //!< ms between statistics lines
+
+/*!	\brief One client packet waiting for the end of the window.
+*/
+struct px_request
+{
+	struct sockaddr_in from; //!< where the answer goes
+	int nkeys; //!< number of get codes in the packet
+	int keys[PX_MAX_KEYS]; //!< index into the window's key table, in the client's order
+};
+
+/*!	\brief One distinct get code in the current window.
+*/
+struct px_key
+{
+	char rec[PX_MAX_REC]; //!< the code and its parameters as the clients sent it
+	char ans[PX_MAX_ANS]; //!< the game's answer record. empty if it never came
+};
+
+/*!	\brief The proxy. Collects a window of client packets and answers them from one upstream query.
+*/
+class C_DLProxy
+{
+	public:
+		C_DLProxy();
+		~C_DLProxy();
+		bool Init(unsigned short port, double window);
+		void Run(void);
+
+	private:
+		C_DeviceLink m_dl; //!< the only session the game sees
+		SOCKET m_sock; //!< socket the clients send to
+		double m_window; //!< merge window in ms
+		struct px_request m_req[PX_MAX_REQ]; //!< client packets in this window
+		int m_nreq; //!< number of packets in m_req
+		struct px_key m_keys[PX_MAX_KEYS]; //!< distinct get codes in this window
+		int m_nkeys; //!< number of codes in m_keys
+		unsigned long m_client_pkts; //!< packets received from clients
+		unsigned long m_client_gets; //!< get codes received from clients
+		unsigned long m_client_sets; //!< set codes received from clients
+		unsigned long m_up_pkts; //!< packets sent to the game
+		unsigned long m_up_gets; //!< get codes sent to the game
+		double m_stats_due; //!< MC_Timer::Now() of the next statistics line
+
+		bool wait_readable(double ms);
+		void take_packet(const char* pkt, const struct sockaddr_in* from);
+		int add_key(const char* rec);
+		void flush_window(void);
+		void query_keys(const char* keys, unsigned int expected);
+		void answer_clients(void);
+		void print_stats(void);
+};
+
+/*! \brief Constructor.
+*/
+C_DLProxy::C_DLProxy(void)
+: m_sock(INVALID_SOCKET)
+,m_window(PX_DEF_WINDOW)
+,m_nreq(0)
+,m_nkeys(0)
+,m_client_pkts(0)
+,m_client_gets(0)
+,m_client_sets(0)
+,m_up_pkts(0)
+,m_up_gets(0)
+,m_stats_due(0.00)
+{
+	memset(m_req, 0, sizeof(m_req));
+	memset(m_keys, 0, sizeof(m_keys));
+}
+
+/*! \brief Deconstructor. Closes the client socket.
+*/
+C_DLProxy::~C_DLProxy()
+{
+	if (m_sock != INVALID_SOCKET)
+	{
+		closesocket(m_sock);
+	}
+}
+
+/*! \brief Opens the upstream session and the socket the clients talk to.
+\param port : UDP port the clients send to
+\param window : merge window in ms
+\return \b boolean
+*/
+bool C_DLProxy::Init(unsigned short port, double window)
+{
+	if (m_dl.Init() == FALSE)
+	{
+		fprintf(stderr, "dlproxy: could not open the session to the game. Check config.ini\n");
+		return FALSE;
+	}
+	m_window = window;
+	m_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (m_sock == INVALID_SOCKET)
+	{
+		fprintf(stderr, "dlproxy: socket failed. Error %d\n", WSAGetLastError());
+		return FALSE;
+	}
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(m_sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR)
+	{
+		fprintf(stderr, "dlproxy: bind to port %d failed. Error %d\n", port, WSAGetLastError());
+		return FALSE;
+	}
+	m_stats_due = MC_Timer::Now() + PX_STATS_PERIOD;
+	fprintf(stderr, "dlproxy: listening on port %d, window %.1f ms\n", port, m_window);
+	return TRUE;
+}
+
+/*! \brief Waits until a client packet is available.
+\param ms : longest wait in milliseconds
+\return \b boolean : TRUE if a packet can be read
+*/
+bool C_DLProxy::wait_readable(double ms)
+{
+	fd_set fds;
+	FD_ZERO(&fds);
+#ifdef _WIN32
+#pragma warning( push, 3 ) //Microsoft's FD_SET macro causes a Lvl 4 warning.
+#endif
+	FD_SET(m_sock, &fds);
+#ifdef _WIN32
+#pragma warning( pop )
+#endif
+	struct timeval tv;
+	if (ms < 0.00)
+	{
+		ms = 0.00;
+	}
+	tv.tv_sec = static_cast<long>(ms / 1000.00);
+	tv.tv_usec = static_cast<long>((ms - (tv.tv_sec * 1000.00)) * 1000.00);
+	return (select(static_cast<int>(m_sock) + 1, &fds, NULL, NULL, &tv) > 0);
+}
+
+/*! \brief Adds a get code to the window's key table unless it is already there.
+\param rec : the code and its parameters
+\return \b integer : index into m_keys or -1 if the table is full
+*/
+int C_DLProxy::add_key(const char* rec)
+{
+	for (int i = 0; i < m_nkeys; ++i)
+	{
+		if (strcmp(m_keys[i].rec, rec) == 0)
+		{
+			return i;
+		}
+	}
+	if (m_nkeys >= PX_MAX_KEYS)
+	{
+		return -1;
+	}
+	memset(&m_keys[m_nkeys], 0, sizeof(px_key));
+	strncpy(m_keys[m_nkeys].rec, rec, sizeof(m_keys[m_nkeys].rec) - 1);
+	return m_nkeys++;
+}
+
+/*! \brief Splits a client packet into sets, which go upstream now, and gets, which wait for the window.
+\param pkt : the R packet as received
+\param from : the client's address
+*/
+void C_DLProxy::take_packet(const char* pkt, const struct sockaddr_in* from)
+{
+	if ((pkt[0] != REQUEST) || (pkt[1] != DELIM_1))
+	{
+		return;
+	}
+	++m_client_pkts;
+	char sets[DL_MAX_QUERY - 2];
+	char rec[PX_MAX_ANS];
+	unsigned int slen = 0;
+	memset(sets, 0, sizeof(sets));
+	struct px_request* req = NULL;
+	if (m_nreq < PX_MAX_REQ)
+	{
+		req = &m_req[m_nreq];
+		req->from = *from;
+		req->nkeys = 0;
+	}
+	const char* ptr = pkt + 1;
+	while ((ptr = C_DeviceLink::NextRecord(ptr, rec, sizeof(rec))) != NULL)
+	{
+		int code = atoi(rec);
+		if ((code % 2) != 0)
+		{
+			//sets keep their order and go upstream right away
+			unsigned int rlen = static_cast<unsigned int>(strlen(rec));
+			if ((slen + rlen + 1) >= sizeof(sets))
+			{
+				m_dl.SendCmd(sets);
+				++m_up_pkts;
+				memset(sets, 0, sizeof(sets));
+				slen = 0;
+			}
+			if (slen > 0)
+			{
+				sets[slen++] = DELIM_1;
+			}
+			memcpy(sets + slen, rec, rlen);
+			slen += rlen;
+			++m_client_sets;
+			continue;
+		}
+		++m_client_gets;
+		if ((req == NULL) || (strlen(rec) >= PX_MAX_REC))
+		{
+			continue;
+		}
+		int idx = add_key(rec);
+		if ((idx >= 0) && (req->nkeys < PX_MAX_KEYS))
+		{
+			req->keys[req->nkeys++] = idx;
+		}
+	}
+	if (slen > 0)
+	{
+		m_dl.SendCmd(sets);
+		++m_up_pkts;
+	}
+	if ((req != NULL) && (req->nkeys > 0))
+	{
+		++m_nreq;
+	}
+}
+
+/*! \brief Sends one upstream query and files each answer record under the key it answers.
+\param keys : the get codes separated by DELIM_1
+\param expected : number of codes in keys
+\note An answer belongs to the longest key it starts with followed by a '\\', so "64\\0\\2400"
+goes to "64\\0".
+*/
+void C_DLProxy::query_keys(const char* keys, unsigned int expected)
+{
+	char reply[DL_MAX_REPLY * 4];
+	char rec[PX_MAX_ANS];
+	++m_up_pkts;
+	m_up_gets += expected;
+	m_dl.QueryRaw(keys, expected, reply, sizeof(reply));
+	const char* ptr = reply;
+	while ((ptr = C_DeviceLink::NextRecord(ptr, rec, sizeof(rec))) != NULL)
+	{
+		int best = -1;
+		size_t best_len = 0;
+		for (int i = 0; i < m_nkeys; ++i)
+		{
+			size_t len = strlen(m_keys[i].rec);
+			if ((len > best_len) && (strncmp(rec, m_keys[i].rec, len) == 0) && (rec[len] == DELIM_2))
+			{
+				best = i;
+				best_len = len;
+			}
+		}
+		if (best >= 0)
+		{
+#if _MSC_VER >= 1400
+			_snprintf_s(m_keys[best].ans, sizeof(m_keys[best].ans), _TRUNCATE, "%s", rec);
+#else
+			_snprintf(m_keys[best].ans, sizeof(m_keys[best].ans), "%s", rec);
+#endif
+		}
+	}
+}
+
+/*! \brief Sends every client its answers, in the order it asked, splitting at DL_MAX_REPLY.
+*/
+void C_DLProxy::answer_clients(void)
+{
+	char out[DL_MAX_REPLY];
+	for (int r = 0; r < m_nreq; ++r)
+	{
+		struct px_request* req = &m_req[r];
+		unsigned int len = 1;
+		out[0] = ANSWER;
+		out[1] = '\0';
+		for (int k = 0; k < req->nkeys; ++k)
+		{
+			const char* ans = m_keys[req->keys[k]].ans;
+			unsigned int alen = static_cast<unsigned int>(strlen(ans));
+			if (alen == 0)
+			{
+				continue;
+			}
+			if ((len + alen + 1) >= sizeof(out))
+			{
+				sendto(m_sock, out, len, 0, reinterpret_cast<struct sockaddr*>(&req->from), sizeof(req->from));
+				len = 1;
+			}
+			out[len++] = DELIM_1;
+			memcpy(out + len, ans, alen);
+			len += alen;
+			out[len] = '\0';
+		}
+		if (len > 1)
+		{
+			sendto(m_sock, out, len, 0, reinterpret_cast<struct sockaddr*>(&req->from), sizeof(req->from));
+		}
+	}
+}
+
+/*! \brief Queries the game for every distinct code in the window and answers the clients.
+*/
+void C_DLProxy::flush_window(void)
+{
+	char keys[DL_MAX_QUERY - 2];
+	unsigned int len = 0;
+	unsigned int expected = 0;
+	memset(keys, 0, sizeof(keys));
+	for (int i = 0; i < m_nkeys; ++i)
+	{
+		unsigned int rlen = static_cast<unsigned int>(strlen(m_keys[i].rec));
+		if ((len + rlen + 1) >= sizeof(keys))
+		{
+			query_keys(keys, expected);
+			memset(keys, 0, sizeof(keys));
+			len = 0;
+			expected = 0;
+		}
+		if (len > 0)
+		{
+			keys[len++] = DELIM_1;
+		}
+		memcpy(keys + len, m_keys[i].rec, rlen);
+		len += rlen;
+		++expected;
+	}
+	if (expected > 0)
+	{
+		query_keys(keys, expected);
+	}
+	answer_clients();
+	m_nreq = 0;
+	m_nkeys = 0;
+}
+
+/*! \brief Prints the traffic saved since the start.
+*/
+void C_DLProxy::print_stats(void)
+{
+	double saved = 0.00;
+	if (m_client_gets > 0)
+	{
+		saved = 100.00 * (1.00 - (static_cast<double>(m_up_gets) / static_cast<double>(m_client_gets)));
+	}
+	fprintf(stderr, "dlproxy: clients %lu pkts %lu gets %lu sets, game %lu pkts %lu gets, %.1f%% of gets merged\n",
+		m_client_pkts, m_client_gets, m_client_sets, m_up_pkts, m_up_gets, saved);
+}
+
+/*! \brief Main loop. Never returns.
+\note The window opens when the first client packet arrives, so an idle proxy sends nothing.
+*/
+void C_DLProxy::Run(void)
+{
+	char pkt[DL_MAX_QUERY + 1];
+	struct sockaddr_in from;
+	for (;;)
+	{
+		if (wait_readable(PX_STATS_PERIOD) == FALSE)
+		{
+			print_stats();
+			m_stats_due = MC_Timer::Now() + PX_STATS_PERIOD;
+			continue;
+		}
+		double close_at = MC_Timer::Now() + m_window;
+		do
+		{
+#ifdef _WIN32
+			int flen = sizeof(from);
+#else
+			socklen_t flen = sizeof(from);
+#endif
+			int len = recvfrom(m_sock, pkt, sizeof(pkt) - 1, 0, reinterpret_cast<struct sockaddr*>(&from), &flen);
+			if (len <= 0)
+			{
+				continue;
+			}
+			pkt[len] = '\0';
+			take_packet(pkt, &from);
+		} while ((m_nreq < PX_MAX_REQ) && (m_nkeys < PX_MAX_KEYS) && (wait_readable(close_at - MC_Timer::Now()) == TRUE));
+		flush_window();
+		if (MC_Timer::Now() >= m_stats_due)
+		{
+			print_stats();
+			m_stats_due = MC_Timer::Now() + PX_STATS_PERIOD;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned short port = PX_DEF_PORT;
+	double window = PX_DEF_WINDOW;
+	if (argc > 1)
+	{
+		port = static_cast<unsigned short>(atoi(argv[1]));
+	}
+	if (argc > 2)
+	{
+		window = atof(argv[2]);
+	}
+	C_DLProxy proxy;
+	if (proxy.Init(port, window) == FALSE)
+	{
+		return 1;
+	}
+	proxy.Run();
+	return 0;
+}
\ No newline at end of file
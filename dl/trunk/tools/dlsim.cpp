@@ -0,0 +1,784 @@
+/*! \file dlsim.cpp
+	\brief DeviceLink stand-in server for testing without the game.
+
+	Answers R packets the way IL2 does, following DeviceLink.txt: get codes come back
+	as "A/key\value" records, engine values as "key\idx\value", 4 and 6 report which
+	codes may be got and set, and set codes change the simulated aircraft without an
+	answer. The aircraft is a crude point mass driven by the controls, so values move
+	the way a program expects them to: power spins the engines up, the stick rolls and
+	pitches, altitude follows the climb rate and the temperatures follow the power.
+
+	The network in between can be made worse on purpose. Every answer packet can be
+	delayed, jittered, dropped or held back so it arrives after a later one, and answers
+	can be split into packets of a few records, as the game does with long answers. The
+	random choices come from a seeded generator, so a run can be repeated exactly.
+
+	Usage: dlsim [-p port] [-l latency_ms] [-j jitter_ms] [-d drop_rate] [-r reorder_rate]
+	             [-f records_per_packet] [-e engines] [-s seed] [-i 0|1]
+	Defaults: port 10000, no latency, jitter, drops or reordering, one packet per answer
+	up to SIM_MAX_PACKET bytes, one engine, seed 1. Rates are 0 to 1. -i 0 answers power (80)
+	and prop pitch (92) without the engine index even when asked with one, the way DeviceLink.txt
+	documents them; the default answers each engine. Point config.ini at this machine and port.
+*/
+
+#include "devicelink.h"
+#include "devicelink_seq.h"
+#include <math.h>
+
+#define SIM_DEF_PORT 10000 //!< default port, the game's default
+#define SIM_MAX_PENDING 128 //!< answer packets held back for latency at once
+#define SIM_MAX_PACKET 1024 //!< longest answer packet before it is split regardless of -f
+#define SIM_MAX_REC 96 //!< longest record in or out
+#define SIM_MAX_CODE 512 //!< codes the switch table covers
+#define SIM_STEP 0.01 //!< longest integration step in seconds
+#define SIM_STATS_PERIOD 5000.00 //!< ms between statistics lines
+#define SIM_PI 3.14159265358979 //!< pi
+#define SIM_G 9.81 //!< gravity in m/s^2
+
+/*!	\brief One answer packet waiting for its delivery time.
+*/
+struct sim_packet
+{
+	double due; //!< MC_Timer::Now() it goes out at
+	struct sockaddr_in to; //!< the client that asked
+	int len; //!< bytes in data
+	char data[SIM_MAX_PACKET + 1]; //!< the A packet
+};
+
+/*!	\brief The simulator. Holds the aircraft state and the answers on their way out.
+*/
+class C_DLSim
+{
+	public:
+		C_DLSim();
+		~C_DLSim();
+		bool Init(unsigned short port);
+		void Run(void);
+		double m_latency; //!< delay added to every answer packet in ms
+		double m_jitter; //!< the delay varies by up to this much either way in ms
+		double m_loss; //!< share of answer packets dropped, 0 to 1
+		double m_reorder; //!< share of answer packets held back behind later ones, 0 to 1
+		int m_frag; //!< most records per answer packet. 0 for no limit
+		int m_engines; //!< engines the aircraft has, 1 to DL_MAX_ENGINES
+		unsigned long m_seed; //!< seed of the random generator
+		bool m_lever_idx; //!< TRUE to answer 80 and 92 per engine when asked with an index. FALSE answers them as DeviceLink.txt documents, without one
+
+	private:
+		SOCKET m_sock; //!< socket the clients send to
+		unsigned long m_rand; //!< random generator state
+		struct sim_packet m_pending[SIM_MAX_PENDING]; //!< answer packets not yet due
+		int m_npending; //!< number of packets in m_pending
+		double m_last; //!< MC_Timer::Now() the aircraft was last moved to
+		//the aircraft
+		double m_tod; //!< time of day in hours
+		double m_speed; //!< airspeed in m/s
+		double m_alt; //!< altitude in m
+		double m_azi; //!< heading in degrees
+		double m_pitch; //!< pitch in degrees
+		double m_roll; //!< roll in degrees
+		double m_vario; //!< climb rate in m/s
+		double m_turn; //!< turn rate in degrees per second
+		double m_load; //!< load factor in g
+		double m_fuel; //!< fuel in kg
+		double m_gear; //!< gear position, 0 up to 1 down
+		double m_gear_to; //!< where the gear is going
+		double m_ctl[10]; //!< analog controls by (get code - 82) / 2, flaps to rudder trim. 5, prop pitch, is per engine in m_prop
+		double m_power[DL_MAX_ENGINES]; //!< throttle of each engine
+		double m_prop[DL_MAX_ENGINES]; //!< prop pitch of each engine
+		bool m_running[DL_MAX_ENGINES]; //!< TRUE while the engine runs
+		double m_rpm[DL_MAX_ENGINES]; //!< engine speed
+		double m_oil_in[DL_MAX_ENGINES]; //!< oil inlet temperature
+		double m_oil_out[DL_MAX_ENGINES]; //!< oil outlet temperature
+		double m_water[DL_MAX_ENGINES]; //!< coolant temperature
+		double m_cyl[DL_MAX_ENGINES]; //!< cylinder head temperature
+		int m_magneto; //!< magneto position, 0 to 3
+		int m_stage; //!< supercharger stage
+		int m_switch[SIM_MAX_CODE]; //!< 0/1 states, indexed by the get code that reports them
+		//statistics
+		unsigned long m_pkts_in; //!< R packets received
+		unsigned long m_gets; //!< get codes answered
+		unsigned long m_sets; //!< set codes applied
+		unsigned long m_unknown; //!< codes that got no answer
+		unsigned long m_pkts_out; //!< answer packets sent
+		unsigned long m_dropped; //!< answer packets dropped on purpose
+		unsigned long m_reordered; //!< answer packets held back on purpose
+		double m_stats_due; //!< MC_Timer::Now() of the next statistics line
+
+		double rnd(void);
+		bool wait_readable(double ms);
+		void step(double now);
+		void take_packet(const char* pkt, const struct sockaddr_in* from);
+		bool answer(const char* rec, char* out, unsigned int size);
+		bool value(int code, int idx, bool has_idx, char* val, unsigned int size);
+		void apply(int code, int nparams, const double* params);
+		void queue_packet(const char* data, int len, const struct sockaddr_in* to);
+		void send_due(double now);
+		double next_due(void);
+		void print_stats(void);
+};
+
+/*! \brief Limits a value to a range.
+*/
+static double clamp(double val, double lo, double hi)
+{
+	return (val < lo) ? lo : ((val > hi) ? hi : val);
+}
+
+/*! \brief Constructor. The aircraft starts in level flight at 2000 m, engines running at half power.
+*/
+C_DLSim::C_DLSim(void)
+: m_latency(0.00)
+,m_jitter(0.00)
+,m_loss(0.00)
+,m_reorder(0.00)
+,m_frag(0)
+,m_engines(1)
+,m_seed(1)
+,m_lever_idx(TRUE)
+,m_sock(INVALID_SOCKET)
+,m_rand(1)
+,m_npending(0)
+,m_last(0.00)
+,m_tod(12.00)
+,m_speed(100.00)
+,m_alt(2000.00)
+,m_azi(90.00)
+,m_pitch(0.00)
+,m_roll(0.00)
+,m_vario(0.00)
+,m_turn(0.00)
+,m_load(1.00)
+,m_fuel(500.00)
+,m_gear(0.00)
+,m_gear_to(0.00)
+,m_magneto(3)
+,m_stage(1)
+,m_pkts_in(0)
+,m_gets(0)
+,m_sets(0)
+,m_unknown(0)
+,m_pkts_out(0)
+,m_dropped(0)
+,m_reordered(0)
+,m_stats_due(0.00)
+{
+	memset(m_pending, 0, sizeof(m_pending));
+	memset(m_ctl, 0, sizeof(m_ctl));
+	memset(m_switch, 0, sizeof(m_switch));
+	for (int i = 0; i < DL_MAX_ENGINES; ++i)
+	{
+		m_power[i] = 0.50;
+		m_prop[i] = 1.00;
+		m_running[i] = TRUE;
+		m_rpm[i] = 2000.00;
+		m_oil_in[i] = 60.00;
+		m_oil_out[i] = 70.00;
+		m_water[i] = 80.00;
+		m_cyl[i] = 160.00;
+	}
+}
+
+/*! \brief Deconstructor. Closes the socket.
+*/
+C_DLSim::~C_DLSim()
+{
+	if (m_sock != INVALID_SOCKET)
+	{
+		closesocket(m_sock);
+	}
+}
+
+/*! \brief Opens the socket the clients talk to.
+\param port : UDP port to listen on
+\return \b boolean
+*/
+bool C_DLSim::Init(unsigned short port)
+{
+	WSADATA wsaData;
+	if (WSAStartup(0x202, &wsaData) != 0)
+	{
+		fprintf(stderr, "dlsim: WSAStartup failed\n");
+		return FALSE;
+	}
+	m_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (m_sock == INVALID_SOCKET)
+	{
+		fprintf(stderr, "dlsim: socket failed. Error %d\n", WSAGetLastError());
+		return FALSE;
+	}
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(m_sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR)
+	{
+		fprintf(stderr, "dlsim: bind to port %d failed. Error %d\n", port, WSAGetLastError());
+		return FALSE;
+	}
+	m_rand = (m_seed != 0) ? m_seed : 1;
+	m_last = MC_Timer::Now();
+	m_stats_due = m_last + SIM_STATS_PERIOD;
+	fprintf(stderr, "dlsim: port %d, %d engine(s), latency %.1f ms, jitter %.1f ms, drop %.2f, reorder %.2f, %d records per packet\n",
+		port, m_engines, m_latency, m_jitter, m_loss, m_reorder, m_frag);
+	return TRUE;
+}
+
+/*! \brief Returns the next number of a xorshift generator, so runs repeat for the same seed.
+\return \b double : 0 up to but not including 1
+*/
+double C_DLSim::rnd(void)
+{
+	m_rand ^= (m_rand << 13) & 0xffffffffUL;
+	m_rand ^= m_rand >> 17;
+	m_rand ^= (m_rand << 5) & 0xffffffffUL;
+	return static_cast<double>(m_rand & 0xffffffffUL) / 4294967296.00;
+}
+
+/*! \brief Waits until a client packet is available.
+\param ms : longest wait in milliseconds
+\return \b boolean : TRUE if a packet can be read
+*/
+bool C_DLSim::wait_readable(double ms)
+{
+	fd_set fds;
+	FD_ZERO(&fds);
+#ifdef _WIN32
+#pragma warning( push, 3 ) //Microsoft's FD_SET macro causes a Lvl 4 warning.
+#endif
+	FD_SET(m_sock, &fds);
+#ifdef _WIN32
+#pragma warning( pop )
+#endif
+	struct timeval tv;
+	if (ms < 0.00)
+	{
+		ms = 0.00;
+	}
+	tv.tv_sec = static_cast<long>(ms / 1000.00);
+	tv.tv_usec = static_cast<long>((ms - (tv.tv_sec * 1000.00)) * 1000.00);
+	return (select(static_cast<int>(m_sock) + 1, &fds, NULL, NULL, &tv) > 0);
+}
+
+/*! \brief Moves the aircraft forward to now in steps of at most SIM_STEP.
+\param now : MC_Timer::Now()
+*/
+void C_DLSim::step(double now)
+{
+	double left = (now - m_last) / 1000.00;
+	m_last = now;
+	while (left > 0.00)
+	{
+		double dt = (left > SIM_STEP) ? SIM_STEP : left;
+		left -= dt;
+		double thrust = 0.00;
+		for (int i = 0; i < m_engines; ++i)
+		{
+			if (m_fuel <= 0.00)
+			{
+				m_running[i] = FALSE;
+			}
+			double thr = clamp(m_power[i], 0.00, 1.10);
+			double rpm_to = (m_running[i] == TRUE) ? (600.00 + (2200.00 * thr * (0.50 + (0.50 * clamp(m_prop[i], 0.00, 1.00))))) : 0.00;
+			m_rpm[i] += (rpm_to - m_rpm[i]) * clamp(dt * 2.00, 0.00, 1.00);
+			double heat = (m_running[i] == TRUE) ? thr : -0.25;
+			double k = clamp(dt * 0.05, 0.00, 1.00);
+			m_oil_in[i] += ((40.00 + (60.00 * heat)) - m_oil_in[i]) * k;
+			m_oil_out[i] += ((50.00 + (70.00 * heat)) - m_oil_out[i]) * k;
+			m_water[i] += ((50.00 + (50.00 * heat)) - m_water[i]) * k;
+			m_cyl[i] += ((100.00 + (120.00 * heat)) - m_cyl[i]) * k;
+			if (m_running[i] == TRUE)
+			{
+				thrust += thr / m_engines;
+				m_fuel -= thr * 0.02 * dt;
+			}
+		}
+		if (m_fuel < 0.00)
+		{
+			m_fuel = 0.00;
+		}
+		double flaps = clamp(m_ctl[0], 0.00, 1.00);
+		double brakes = (m_alt <= 0.00) ? clamp(m_ctl[4], 0.00, 1.00) : 0.00;
+		double drag = 0.0006 * (1.00 + (0.50 * m_gear) + (0.30 * flaps)) * m_speed * m_speed;
+		double pitch_rad = m_pitch * SIM_PI / 180.00;
+		double roll_rad = m_roll * SIM_PI / 180.00;
+		m_speed += ((12.00 * thrust) - drag - (SIM_G * sin(pitch_rad)) - (5.00 * brakes)) * dt;
+		m_speed = clamp(m_speed, 0.00, 250.00);
+		double pitch_rate = (30.00 * m_ctl[2]) + (5.00 * m_ctl[7]);
+		m_pitch = clamp(m_pitch + (pitch_rate * dt), -90.00, 90.00);
+		m_roll += ((90.00 * m_ctl[1]) + (5.00 * m_ctl[6])) * dt;
+		if (m_roll > 180.00)
+		{
+			m_roll -= 360.00;
+		} else if (m_roll < -180.00)
+		{
+			m_roll += 360.00;
+		}
+		double cos_roll = cos(roll_rad);
+		m_turn = (SIM_G * sin(roll_rad) / ((fabs(cos_roll) > 0.10) ? cos_roll : 0.10) / ((m_speed > 20.00) ? m_speed : 20.00)) * 180.00 / SIM_PI;
+		m_turn += 5.00 * (m_ctl[3] + m_ctl[8]);
+		m_azi = fmod(m_azi + (m_turn * dt) + 360.00, 360.00);
+		m_load = (1.00 / ((fabs(cos_roll) > 0.20) ? fabs(cos_roll) : 0.20)) + (pitch_rate * m_speed / 1000.00);
+		m_vario = m_speed * sin(pitch_rad);
+		m_alt += m_vario * dt;
+		if (m_alt <= 0.00)
+		{
+			m_alt = 0.00;
+			m_vario = 0.00;
+			if (m_pitch < 0.00)
+			{
+				m_pitch = 0.00;
+			}
+		}
+		m_gear += clamp(m_gear_to - m_gear, -0.20 * dt, 0.20 * dt);
+		m_tod = fmod(m_tod + (dt / 3600.00), 24.00);
+	}
+}
+
+/*! \brief Formats the current value of a get code.
+\param code : the get code
+\param idx : engine index or parameter from the request
+\param has_idx : TRUE if the request carried idx
+\param val : receives the value, i.e. "2400.00" or for engine values "0\\2400.00"
+\param size : size of val
+\return \b boolean : FALSE if the code isn't one the game answers
+*/
+bool C_DLSim::value(int code, int idx, bool has_idx, char* val, unsigned int size)
+{
+	double f = 0.00;
+	bool is_int = FALSE;
+	bool per_engine = FALSE;
+	int eng = (has_idx == TRUE) ? idx : 0;
+	switch (code)
+	{
+		case 2:
+#if _MSC_VER >= 1400
+			_snprintf_s(val, size, _TRUNCATE, "DeviceLink 1.0 dlsim");
+#else
+			_snprintf(val, size, "DeviceLink 1.0 dlsim");
+#endif
+			return TRUE;
+		case 4:
+		case 6:
+		{
+			if (has_idx == FALSE)
+			{
+				return FALSE;
+			}
+			char key[16];
+			char probe[SIM_MAX_REC];
+#if _MSC_VER >= 1400
+			_snprintf_s(key, sizeof(key), _TRUNCATE, "%d", ((code == 6) && ((idx % 2) == 0)) ? (idx + 1) : idx);
+#else
+			_snprintf(key, sizeof(key), "%d", ((code == 6) && ((idx % 2) == 0)) ? (idx + 1) : idx);
+#endif
+			bool ok = (code == 4) ? (((idx % 2) == 0) && (idx != 4) && (idx != 6) && (value(idx, 0, TRUE, probe, sizeof(probe)) == TRUE)) : C_DLSequence::ValidSet(key);
+#if _MSC_VER >= 1400
+			_snprintf_s(val, size, _TRUNCATE, "%d%c%d", idx, DELIM_2, (ok == TRUE) ? 1 : 0);
+#else
+			_snprintf(val, size, "%d%c%d", idx, DELIM_2, (ok == TRUE) ? 1 : 0);
+#endif
+			return TRUE;
+		}
+		case 20: f = m_tod; break;
+		case 22:
+#if _MSC_VER >= 1400
+			_snprintf_s(val, size, _TRUNCATE, "dlsim");
+#else
+			_snprintf(val, size, "dlsim");
+#endif
+			return TRUE;
+		case 24: f = 1; is_int = TRUE; break;
+		case 26: f = 0; is_int = TRUE; break;
+		case 28: f = m_engines; is_int = TRUE; break;
+		case 30: f = m_speed * 3.60; break;
+		case 32: f = m_vario; break;
+		case 34: f = clamp(10.00 * m_ctl[3], -45.00, 45.00); break;
+		case 36: f = clamp(m_turn / 9.00, -1.00, 1.00); break;
+		case 38: f = m_turn; break;
+		case 40: f = m_alt; break;
+		case 42: f = m_azi; break;
+		case 44: f = fmod(360.00 - m_azi, 360.00); break;
+		case 46: f = m_roll; break;
+		case 48: f = m_pitch; break;
+		case 50: f = m_fuel; break;
+		case 52: f = m_load; break;
+		case 54: f = clamp((m_speed - 170.00) / 80.00, 0.00, 1.00); break;
+		case 56:
+		case 58:
+		case 60: f = m_gear; break;
+		case 62: per_engine = TRUE; is_int = TRUE; f = (m_running[eng] == TRUE) ? m_magneto : 0; break;
+		case 64: per_engine = TRUE; f = m_rpm[eng]; break;
+		case 66: per_engine = TRUE; f = (m_running[eng] == TRUE) ? (0.60 + (0.90 * clamp(m_power[eng], 0.00, 1.10))) : 1.00; break;
+		case 68: per_engine = TRUE; f = m_oil_in[eng]; break;
+		case 70: per_engine = TRUE; f = m_oil_out[eng]; break;
+		case 72: per_engine = TRUE; f = m_water[eng]; break;
+		case 74: per_engine = TRUE; f = m_cyl[eng]; break;
+		case 80: per_engine = ((has_idx == TRUE) && (m_lever_idx == TRUE)); f = m_power[(per_engine == TRUE) ? eng : 0]; break;
+		case 92: per_engine = ((has_idx == TRUE) && (m_lever_idx == TRUE)); f = m_prop[(per_engine == TRUE) ? eng : 0]; break;
+		case 82: case 84: case 86: case 88: case 90: case 94: case 96: case 98:
+			f = m_ctl[(code - 82) / 2];
+			break;
+		case 106:
+		case 108: f = m_magneto; is_int = TRUE; break;
+		case 110:
+		case 112: f = m_stage; is_int = TRUE; break;
+		case 164: f = m_gear_to; break;
+		case 100: case 104: case 162: case 172: case 174: case 180: case 182: case 184: case 186:
+		case 188: case 190: case 210: case 212: case 214: case 216: case 220:
+			f = m_switch[code];
+			is_int = TRUE;
+			break;
+		case 300: f = 0; is_int = TRUE; break;
+		case 348: f = 90.00; break;
+		default:
+			return FALSE;
+	}
+	if ((per_engine == TRUE) && ((has_idx == FALSE) || (idx < 0) || (idx >= m_engines)))
+	{
+		return FALSE;
+	}
+	char num[32];
+#if _MSC_VER >= 1400
+	_snprintf_s(num, sizeof(num), _TRUNCATE, (is_int == TRUE) ? "%.0f" : "%.2f", f);
+#else
+	_snprintf(num, sizeof(num), (is_int == TRUE) ? "%.0f" : "%.2f", f);
+#endif
+	if (per_engine == TRUE)
+	{
+#if _MSC_VER >= 1400
+		_snprintf_s(val, size, _TRUNCATE, "%d%c%s", idx, DELIM_2, num);
+#else
+		_snprintf(val, size, "%d%c%s", idx, DELIM_2, num);
+#endif
+	} else
+	{
+#if _MSC_VER >= 1400
+		_snprintf_s(val, size, _TRUNCATE, "%s", num);
+#else
+		_snprintf(val, size, "%s", num);
+#endif
+	}
+	return TRUE;
+}
+
+/*! \brief Applies a set code to the aircraft.
+\param code : the set code
+\param nparams : number of parameters that came with it
+\param params : the parameters
+\note Codes without a value act like one press of the key, as DeviceLink.txt says.
+Known codes that don't change anything here, like the camera, are accepted and ignored.
+*/
+void C_DLSim::apply(int code, int nparams, const double* params)
+{
+	switch (code)
+	{
+		case 81:
+		case 93:
+		{
+			double* lever = (code == 81) ? m_power : m_prop;
+			if (nparams >= 2)
+			{
+				int eng = static_cast<int>(params[0]);
+				if ((eng >= 0) && (eng < m_engines))
+				{
+					lever[eng] = clamp(params[1], -1.00, 1.10);
+				}
+			} else if (nparams == 1)
+			{
+				for (int i = 0; i < m_engines; ++i)
+				{
+					lever[i] = clamp(params[0], -1.00, 1.10);
+				}
+			}
+			break;
+		}
+		case 83: case 85: case 87: case 89: case 91: case 95: case 97: case 99:
+			if (nparams >= 1)
+			{
+				m_ctl[(code - 83) / 2] = clamp(params[0], -1.00, 1.00);
+			}
+			break;
+		case 103:
+			for (int i = 0; i < m_engines; ++i)
+			{
+				m_running[i] = ((m_running[i] == FALSE) && (m_fuel > 0.00));
+			}
+			break;
+		case 107: m_magneto = (m_magneto < 3) ? (m_magneto + 1) : 3; break;
+		case 109: m_magneto = (m_magneto > 0) ? (m_magneto - 1) : 0; break;
+		case 111: m_stage = (m_stage < 3) ? (m_stage + 1) : 3; break;
+		case 113: m_stage = (m_stage > 1) ? (m_stage - 1) : 1; break;
+		case 165: m_gear_to = (m_gear_to > 0.50) ? 0.00 : 1.00; break;
+		case 167: m_gear_to = 0.00; break;
+		case 169: m_gear_to = 1.00; break;
+		case 181: case 183: case 185: case 187: case 189: case 221:
+			m_switch[code - 1] = (nparams >= 1) ? ((params[0] != 0.00) ? 1 : 0) : (1 - m_switch[code - 1]);
+			break;
+		case 101: case 105: case 163: case 173: case 175: case 191: case 211: case 213: case 215: case 217:
+			m_switch[code - 1] = 1 - m_switch[code - 1];
+			break;
+		default:
+			break;
+	}
+}
+
+/*! \brief Handles one record of an R packet: applies a set code or formats the answer to a get code.
+\param rec : the record, i.e. "64\\0" or "81\\0.5"
+\param out : receives the answer record, empty for set codes and unknown codes
+\param size : size of out
+\return \b boolean : TRUE if out holds an answer
+*/
+bool C_DLSim::answer(const char* rec, char* out, unsigned int size)
+{
+	out[0] = '\0';
+	int code = atoi(rec);
+	double params[4];
+	int nparams = 0;
+	const char* ptr = strchr(rec, DELIM_2);
+	while ((ptr != NULL) && (nparams < 4))
+	{
+		params[nparams++] = atof(ptr + 1);
+		ptr = strchr(ptr + 1, DELIM_2);
+	}
+	if ((code % 2) != 0)
+	{
+		char key[16];
+#if _MSC_VER >= 1400
+		_snprintf_s(key, sizeof(key), _TRUNCATE, "%d", code);
+#else
+		_snprintf(key, sizeof(key), "%d", code);
+#endif
+		if (C_DLSequence::ValidSet(key) == FALSE)
+		{
+			++m_unknown;
+			return FALSE;
+		}
+		++m_sets;
+		apply(code, nparams, params);
+		return FALSE;
+	}
+	char val[SIM_MAX_REC];
+	if (value(code, (nparams > 0) ? static_cast<int>(params[0]) : 0, (nparams > 0), val, sizeof(val)) == FALSE)
+	{
+		++m_unknown;
+		return FALSE;
+	}
+	++m_gets;
+#if _MSC_VER >= 1400
+	_snprintf_s(out, size, _TRUNCATE, "%d%c%s", code, DELIM_2, val);
+#else
+	_snprintf(out, size, "%d%c%s", code, DELIM_2, val);
+#endif
+	return TRUE;
+}
+
+/*! \brief Puts an answer packet through the simulated network: drop, delay, jitter, reordering.
+\param data : the A packet
+\param len : its length
+\param to : the client
+*/
+void C_DLSim::queue_packet(const char* data, int len, const struct sockaddr_in* to)
+{
+	if ((m_loss > 0.00) && (rnd() < m_loss))
+	{
+		++m_dropped;
+		return;
+	}
+	double delay = m_latency;
+	if (m_jitter > 0.00)
+	{
+		delay += ((2.00 * rnd()) - 1.00) * m_jitter;
+	}
+	if ((m_reorder > 0.00) && (rnd() < m_reorder))
+	{
+		delay += m_latency + m_jitter + 1.00; //lands behind the packets sent after it
+		++m_reordered;
+	}
+	if ((delay <= 0.00) || (m_npending >= SIM_MAX_PENDING))
+	{
+		sendto(m_sock, data, len, 0, reinterpret_cast<const struct sockaddr*>(to), sizeof(*to));
+		++m_pkts_out;
+		return;
+	}
+	struct sim_packet* pkt = &m_pending[m_npending++];
+	pkt->due = MC_Timer::Now() + delay;
+	pkt->to = *to;
+	pkt->len = len;
+	memcpy(pkt->data, data, len);
+	pkt->data[len] = '\0';
+}
+
+/*! \brief Sends every held packet whose time has come, earliest first.
+\param now : MC_Timer::Now()
+*/
+void C_DLSim::send_due(double now)
+{
+	for (;;)
+	{
+		int first = -1;
+		for (int i = 0; i < m_npending; ++i)
+		{
+			if ((m_pending[i].due <= now) && ((first < 0) || (m_pending[i].due < m_pending[first].due)))
+			{
+				first = i;
+			}
+		}
+		if (first < 0)
+		{
+			return;
+		}
+		struct sim_packet* pkt = &m_pending[first];
+		sendto(m_sock, pkt->data, pkt->len, 0, reinterpret_cast<struct sockaddr*>(&pkt->to), sizeof(pkt->to));
+		++m_pkts_out;
+		m_pending[first] = m_pending[--m_npending];
+	}
+}
+
+/*! \brief Returns the time of the earliest held packet.
+\return \b double : MC_Timer::Now() it is due, or -1 if nothing is held
+*/
+double C_DLSim::next_due(void)
+{
+	double due = -1.00;
+	for (int i = 0; i < m_npending; ++i)
+	{
+		if ((due < 0.00) || (m_pending[i].due < due))
+		{
+			due = m_pending[i].due;
+		}
+	}
+	return due;
+}
+
+/*! \brief Answers one R packet, splitting the answer at m_frag records or SIM_MAX_PACKET bytes.
+\param pkt : the packet as received
+\param from : the client's address
+*/
+void C_DLSim::take_packet(const char* pkt, const struct sockaddr_in* from)
+{
+	if ((pkt[0] != REQUEST) || (pkt[1] != DELIM_1))
+	{
+		return;
+	}
+	++m_pkts_in;
+	char rec[SIM_MAX_REC];
+	char ans[SIM_MAX_REC];
+	char out[SIM_MAX_PACKET + 1];
+	unsigned int len = 1;
+	int nrec = 0;
+	out[0] = ANSWER;
+	const char* ptr = pkt + 1;
+	while ((ptr = C_DeviceLink::NextRecord(ptr, rec, sizeof(rec))) != NULL)
+	{
+		if (answer(rec, ans, sizeof(ans)) == FALSE)
+		{
+			continue;
+		}
+		unsigned int alen = static_cast<unsigned int>(strlen(ans));
+		if ((nrec > 0) && (((m_frag > 0) && (nrec >= m_frag)) || ((len + alen + 1) > SIM_MAX_PACKET)))
+		{
+			queue_packet(out, len, from);
+			len = 1;
+			nrec = 0;
+		}
+		out[len++] = DELIM_1;
+		memcpy(out + len, ans, alen);
+		len += alen;
+		++nrec;
+	}
+	if (nrec > 0)
+	{
+		queue_packet(out, len, from);
+	}
+}
+
+/*! \brief Prints the traffic since the start and where the aircraft is.
+*/
+void C_DLSim::print_stats(void)
+{
+	fprintf(stderr, "dlsim: in %lu pkts %lu gets %lu sets %lu unknown, out %lu pkts %lu dropped %lu reordered | %.0f km/h %.0f m hdg %.0f\n",
+		m_pkts_in, m_gets, m_sets, m_unknown, m_pkts_out, m_dropped, m_reordered, m_speed * 3.60, m_alt, m_azi);
+}
+
+/*! \brief Main loop. Never returns.
+*/
+void C_DLSim::Run(void)
+{
+	char pkt[DL_MAX_QUERY + 1];
+	struct sockaddr_in from;
+	for (;;)
+	{
+		double now = MC_Timer::Now();
+		send_due(now);
+		if (now >= m_stats_due)
+		{
+			print_stats();
+			m_stats_due = now + SIM_STATS_PERIOD;
+		}
+		double wait = m_stats_due - now;
+		double due = next_due();
+		if ((due >= 0.00) && ((due - now) < wait))
+		{
+			wait = due - now;
+		}
+		if (wait_readable(wait) == FALSE)
+		{
+			continue;
+		}
+#ifdef _WIN32
+		int flen = sizeof(from);
+#else
+		socklen_t flen = sizeof(from);
+#endif
+		int len = recvfrom(m_sock, pkt, sizeof(pkt) - 1, 0, reinterpret_cast<struct sockaddr*>(&from), &flen);
+		if (len <= 0)
+		{
+			continue;
+		}
+		pkt[len] = '\0';
+		step(MC_Timer::Now());
+		take_packet(pkt, &from);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned short port = SIM_DEF_PORT;
+	static C_DLSim sim; //too big for a small default stack
+	for (int i = 1; i < argc; ++i)
+	{
+		if ((argv[i][0] != '-') || (argv[i][1] == '\0') || (argv[i][2] != '\0') || ((i + 1) >= argc))
+		{
+			fprintf(stderr, "usage: dlsim [-p port] [-l latency_ms] [-j jitter_ms] [-d drop_rate] [-r reorder_rate] [-f records_per_packet] [-e engines] [-s seed] [-i 0|1]\n");
+			return 1;
+		}
+		const char* arg = argv[++i];
+		switch (argv[i - 1][1])
+		{
+			case 'p': port = static_cast<unsigned short>(atoi(arg)); break;
+			case 'l': sim.m_latency = atof(arg); break;
+			case 'j': sim.m_jitter = atof(arg); break;
+			case 'd': sim.m_loss = atof(arg); break;
+			case 'r': sim.m_reorder = atof(arg); break;
+			case 'f': sim.m_frag = atoi(arg); break;
+			case 'e': sim.m_engines = atoi(arg); break;
+			case 's': sim.m_seed = static_cast<unsigned long>(atol(arg)); break;
+			case 'i': sim.m_lever_idx = (atoi(arg) != 0); break;
+			default:
+				fprintf(stderr, "dlsim: unknown option %s\n", argv[i - 1]);
+				return 1;
+		}
+	}
+	if ((sim.m_engines < 1) || (sim.m_engines > DL_MAX_ENGINES) || (sim.m_frag < 0) || (sim.m_latency < 0.00) || (sim.m_jitter < 0.00))
+	{
+		fprintf(stderr, "dlsim: engines must be 1 to %d, the others not negative\n", DL_MAX_ENGINES);
+		return 1;
+	}
+	if (sim.Init(port) == FALSE)
+	{
+		return 1;
+	}
+	sim.Run();
+	return 0;
+}